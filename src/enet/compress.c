@@ -43,6 +43,10 @@ typedef struct _ENetRangeCoder
 {
     /* only allocate enough symbols for reasonable MTUs, would need to be larger for large file compression */
     ENetSymbol symbols[4096];
+
+    /* models primed from sample traffic that a packet may start from instead of an empty model */
+    ENetSymbol * dictionaries [ENET_RANGE_CODER_DICTIONARIES];
+    size_t dictionarySymbols [ENET_RANGE_CODER_DICTIONARIES];
 } ENetRangeCoder;
 
 void *
@@ -52,6 +56,9 @@ enet_range_coder_create (void)
     if (rangeCoder == NULL)
       return NULL;
 
+    memset (rangeCoder -> dictionaries, 0, sizeof (rangeCoder -> dictionaries));
+    memset (rangeCoder -> dictionarySymbols, 0, sizeof (rangeCoder -> dictionarySymbols));
+
     return rangeCoder;
 }
 
@@ -59,9 +66,14 @@ void
 enet_range_coder_destroy (void * context)
 {
     ENetRangeCoder * rangeCoder = (ENetRangeCoder *) context;
+    size_t i;
     if (rangeCoder == NULL)
       return;
 
+    for (i = 0; i < ENET_RANGE_CODER_DICTIONARIES; ++ i)
+      if (rangeCoder -> dictionaries [i] != NULL)
+        enet_free (rangeCoder -> dictionaries [i]);
+
     enet_free (rangeCoder);
 }
 
@@ -243,10 +255,21 @@ ENET_CONTEXT_WALK(context, { \
 })
 #endif
 
-size_t
-enet_range_coder_compress (void * context, const ENetBuffer * inBuffers, size_t inBufferCount, size_t inLimit, enet_uint8 * outData, size_t outLimit)
+#define ENET_RANGE_CODER_START(dictionary) \
+{ \
+    if ((dictionary) < ENET_RANGE_CODER_DICTIONARIES && rangeCoder -> dictionarySymbols [dictionary] > 0) \
+    { \
+        nextSymbol = rangeCoder -> dictionarySymbols [dictionary]; \
+        memcpy (rangeCoder -> symbols, rangeCoder -> dictionaries [dictionary], nextSymbol * sizeof (ENetSymbol)); \
+        root = & rangeCoder -> symbols [0]; \
+    } \
+    else \
+      ENET_CONTEXT_CREATE (root, ENET_CONTEXT_ESCAPE_MINIMUM, ENET_CONTEXT_SYMBOL_MINIMUM); \
+}
+
+static size_t
+enet_range_coder_encode (ENetRangeCoder * rangeCoder, size_t dictionary, const ENetBuffer * inBuffers, size_t inBufferCount, size_t inLimit, enet_uint8 * outData, size_t outLimit, size_t * symbolCount)
 {
-    ENetRangeCoder * rangeCoder = (ENetRangeCoder *) context;
     enet_uint8 * outStart = outData, * outEnd = & outData [outLimit];
     const enet_uint8 * inData, * inEnd;
     enet_uint32 encodeLow = 0, encodeRange = ~0;
@@ -262,7 +285,7 @@ enet_range_coder_compress (void * context, const ENetBuffer * inBuffers, size_t
     inBuffers ++;
     inBufferCount --;
 
-    ENET_CONTEXT_CREATE (root, ENET_CONTEXT_ESCAPE_MINIMUM, ENET_CONTEXT_SYMBOL_MINIMUM);
+    ENET_RANGE_CODER_START (dictionary);
 
     for (;;)
     {
@@ -338,9 +361,18 @@ enet_range_coder_compress (void * context, const ENetBuffer * inBuffers, size_t
 
     ENET_RANGE_CODER_FLUSH;
 
+    if (symbolCount != NULL)
+      * symbolCount = nextSymbol;
+
     return (size_t) (outData - outStart);
 }
 
+size_t
+enet_range_coder_compress (void * context, const ENetBuffer * inBuffers, size_t inBufferCount, size_t inLimit, enet_uint8 * outData, size_t outLimit)
+{
+    return enet_range_coder_encode ((ENetRangeCoder *) context, ENET_RANGE_CODER_DICTIONARIES, inBuffers, inBufferCount, inLimit, outData, outLimit, NULL);
+}
+
 #define ENET_RANGE_CODER_SEED \
 { \
     if (inData < inEnd) decodeCode |= * inData ++ << 24; \
@@ -495,10 +527,9 @@ typedef struct _ENetExclude
 
 #define ENET_CONTEXT_NOT_EXCLUDED(value_, after, before)
 
-size_t
-enet_range_coder_decompress (void * context, const enet_uint8 * inData, size_t inLimit, enet_uint8 * outData, size_t outLimit)
+static size_t
+enet_range_coder_decode (ENetRangeCoder * rangeCoder, size_t dictionary, const enet_uint8 * inData, size_t inLimit, enet_uint8 * outData, size_t outLimit)
 {
-    ENetRangeCoder * rangeCoder = (ENetRangeCoder *) context;
     enet_uint8 * outStart = outData, * outEnd = & outData [outLimit];
     const enet_uint8 * inEnd = & inData [inLimit];
     enet_uint32 decodeLow = 0, decodeCode = 0, decodeRange = ~0;
@@ -513,7 +544,7 @@ enet_range_coder_decompress (void * context, const enet_uint8 * inData, size_t i
     if (rangeCoder == NULL || inLimit <= 0)
       return 0;
 
-    ENET_CONTEXT_CREATE (root, ENET_CONTEXT_ESCAPE_MINIMUM, ENET_CONTEXT_SYMBOL_MINIMUM);
+    ENET_RANGE_CODER_START (dictionary);
 
     ENET_RANGE_CODER_SEED;
 
@@ -626,6 +657,102 @@ enet_range_coder_decompress (void * context, const enet_uint8 * inData, size_t i
     return (size_t) (outData - outStart);
 }
 
+size_t
+enet_range_coder_decompress (void * context, const enet_uint8 * inData, size_t inLimit, enet_uint8 * outData, size_t outLimit)
+{
+    return enet_range_coder_decode ((ENetRangeCoder *) context, ENET_RANGE_CODER_DICTIONARIES, inData, inLimit, outData, outLimit);
+}
+
+/** Primes a dictionary of the range coder by running sample data through an empty model.
+    Both ends of a connection must prime their range coders with identical samples.
+    @param context range coder created by enet_range_coder_create()
+    @param dictionary dictionary to prime, below ENET_RANGE_CODER_DICTIONARIES
+    @param data sample data
+    @param dataLength length of the sample, the resulting model must fit in half of the symbol table
+    @returns 0 on success, < 0 on failure
+*/
+int
+enet_range_coder_prime (void * context, size_t dictionary, const enet_uint8 * data, size_t dataLength)
+{
+    ENetRangeCoder * rangeCoder = (ENetRangeCoder *) context;
+    ENetBuffer buffer;
+    enet_uint8 * scratch;
+    size_t symbolCount = 0, written;
+
+    if (rangeCoder == NULL || dictionary >= ENET_RANGE_CODER_DICTIONARIES || dataLength <= 0)
+      return -1;
+
+    scratch = (enet_uint8 *) enet_malloc (dataLength * 2 + 64);
+    if (scratch == NULL)
+      return -1;
+
+    buffer.data = (void *) data;
+    buffer.dataLength = dataLength;
+    written = enet_range_coder_encode (rangeCoder, ENET_RANGE_CODER_DICTIONARIES, & buffer, 1, dataLength, scratch, dataLength * 2 + 64, & symbolCount);
+    enet_free (scratch);
+
+    if (written <= 0 || symbolCount <= 0 || symbolCount > sizeof (rangeCoder -> symbols) / sizeof (ENetSymbol) / 2)
+      return -1;
+
+    if (rangeCoder -> dictionaries [dictionary] != NULL)
+      enet_free (rangeCoder -> dictionaries [dictionary]);
+    rangeCoder -> dictionaries [dictionary] = (ENetSymbol *) enet_malloc (symbolCount * sizeof (ENetSymbol));
+    if (rangeCoder -> dictionaries [dictionary] == NULL)
+    {
+        rangeCoder -> dictionarySymbols [dictionary] = 0;
+        return -1;
+    }
+    memcpy (rangeCoder -> dictionaries [dictionary], rangeCoder -> symbols, symbolCount * sizeof (ENetSymbol));
+    rangeCoder -> dictionarySymbols [dictionary] = symbolCount;
+    return 0;
+}
+
+/** Compresses a datagram with the dictionary primed for the channel of its first command.
+    The dictionary is written as the first byte so the other end can pick the same one.
+    Datagrams for channels without a primed dictionary are left uncompressed.
+*/
+size_t
+enet_range_coder_compress_primed (void * context, const ENetBuffer * inBuffers, size_t inBufferCount, size_t inLimit, enet_uint8 * outData, size_t outLimit)
+{
+    ENetRangeCoder * rangeCoder = (ENetRangeCoder *) context;
+    const ENetBuffer * commandBuffer = inBuffers, * commandEnd = inBuffers + inBufferCount;
+    size_t dictionary, compressedLength;
+
+    if (rangeCoder == NULL || inBufferCount <= 0 || inBuffers -> dataLength < sizeof (ENetProtocolCommandHeader) || outLimit <= 1)
+      return 0;
+
+    /* acknowledgements lead most datagrams and sit in their own buffers, so the model is chosen from the first command after them */
+    while (commandBuffer + 1 < commandEnd &&
+           commandBuffer -> dataLength == sizeof (ENetProtocolAcknowledge) &&
+           (((const ENetProtocolCommandHeader *) commandBuffer -> data) -> command & ENET_PROTOCOL_COMMAND_MASK) == ENET_PROTOCOL_COMMAND_ACKNOWLEDGE &&
+           commandBuffer [1].dataLength >= sizeof (ENetProtocolCommandHeader))
+      ++ commandBuffer;
+
+    dictionary = ((const ENetProtocolCommandHeader *) commandBuffer -> data) -> channelID;
+    if (dictionary >= ENET_RANGE_CODER_DICTIONARIES || rangeCoder -> dictionarySymbols [dictionary] <= 0)
+      return 0;
+
+    outData [0] = (enet_uint8) dictionary;
+    compressedLength = enet_range_coder_encode (rangeCoder, dictionary, inBuffers, inBufferCount, inLimit, outData + 1, outLimit - 1, NULL);
+    return compressedLength > 0 ? compressedLength + 1 : 0;
+}
+
+size_t
+enet_range_coder_decompress_primed (void * context, const enet_uint8 * inData, size_t inLimit, enet_uint8 * outData, size_t outLimit)
+{
+    ENetRangeCoder * rangeCoder = (ENetRangeCoder *) context;
+    size_t dictionary;
+
+    if (rangeCoder == NULL || inLimit <= 1)
+      return 0;
+
+    dictionary = inData [0];
+    if (dictionary >= ENET_RANGE_CODER_DICTIONARIES || rangeCoder -> dictionarySymbols [dictionary] <= 0)
+      return 0;
+
+    return enet_range_coder_decode (rangeCoder, dictionary, inData + 1, inLimit - 1, outData, outLimit);
+}
+
 /** @defgroup host ENet host functions
     @{
 */
@@ -96,6 +96,12 @@ enet_host_create (const ENetAddress * address, size_t peerCount, size_t channelL
     host -> totalReceivedData = 0;
     host -> totalReceivedPackets = 0;
 
+    host -> sendBatchData = (enet_uint8 *) enet_malloc (ENET_HOST_BATCH_SIZE * ENET_PROTOCOL_MAXIMUM_MTU);
+    host -> sendBatchCount = 0;
+    host -> receiveBatchData = (enet_uint8 *) enet_malloc (ENET_HOST_BATCH_SIZE * ENET_PROTOCOL_MAXIMUM_MTU);
+    host -> receiveBatchCount = 0;
+    host -> receiveBatchIndex = 0;
+
     host -> compressor.context = NULL;
     host -> compressor.compress = NULL;
     host -> compressor.decompress = NULL;
@@ -145,6 +151,8 @@ enet_host_destroy (ENetHost * host)
     if (host -> compressor.context != NULL && host -> compressor.destroy)
       (* host -> compressor.destroy) (host -> compressor.context);
 
+    enet_free (host -> sendBatchData);
+    enet_free (host -> receiveBatchData);
     enet_free (host -> peers);
     enet_free (host);
 }
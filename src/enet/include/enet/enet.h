@@ -128,6 +128,7 @@ typedef struct _ENetPacket
    enet_uint8 *             data;            /**< allocated data for packet */
    size_t                   dataLength;      /**< length of data */
    ENetPacketFreeCallback   freeCallback;    /**< function to be called when the packet is no longer in use */
+   void *                   userData;        /**< application private data, may be freely modified */
 } ENetPacket;
 
 typedef struct _ENetAcknowledgement
@@ -178,6 +179,13 @@ typedef enum _ENetPeerState
    ENET_PEER_STATE_ZOMBIE                      = 9 
 } ENetPeerState;
 
+typedef enum _ENetPeerCompress
+{
+   ENET_PEER_COMPRESS_OFF                      = 0,
+   ENET_PEER_COMPRESS_ON                       = 1,
+   ENET_PEER_COMPRESS_PENDING                  = 2  /**< turns on once the peer sends a compressed datagram */
+} ENetPeerCompress;
+
 #ifndef ENET_BUFFER_MAXIMUM
 #define ENET_BUFFER_MAXIMUM (1 + 2 * ENET_PROTOCOL_MAXIMUM_PACKET_COMMANDS)
 #endif
@@ -188,6 +196,8 @@ enum
    ENET_HOST_SEND_BUFFER_SIZE             = 256 * 1024,
    ENET_HOST_BANDWIDTH_THROTTLE_INTERVAL  = 1000,
    ENET_HOST_DEFAULT_MTU                  = 1400,
+   ENET_HOST_BATCH_SIZE                   = 32,
+   ENET_RANGE_CODER_DICTIONARIES          = 4,
 
    ENET_PEER_DEFAULT_ROUND_TRIP_TIME      = 500,
    ENET_PEER_DEFAULT_PACKET_THROTTLE      = 32,
@@ -284,6 +294,7 @@ typedef struct _ENetPeer
    enet_uint16   outgoingUnsequencedGroup;
    enet_uint32   unsequencedWindow [ENET_PEER_UNSEQUENCED_WINDOW_SIZE / 32]; 
    enet_uint32   eventData;
+   int           compress;                 /**< whether datagrams to this peer are run through the host's compressor, see ENetPeerCompress */
 } ENetPeer;
 
 /** An ENet packet compressor for compressing UDP packets before socket sends or receives.
@@ -351,6 +362,15 @@ typedef struct _ENetHost
    enet_uint32          totalSentPackets;            /**< total UDP packets sent, user should reset to 0 as needed to prevent overflow */
    enet_uint32          totalReceivedData;           /**< total data received, user should reset to 0 as needed to prevent overflow */
    enet_uint32          totalReceivedPackets;        /**< total UDP packets received, user should reset to 0 as needed to prevent overflow */
+   enet_uint8 *         sendBatchData;               /**< outgoing datagrams of one flush, copied out so they can go out in one batched send */
+   ENetAddress          sendBatchAddresses [ENET_HOST_BATCH_SIZE];
+   ENetBuffer           sendBatchBuffers [ENET_HOST_BATCH_SIZE];
+   size_t               sendBatchCount;
+   enet_uint8 *         receiveBatchData;            /**< incoming datagrams drained in one batched receive, handled one at a time */
+   ENetAddress          receiveBatchAddresses [ENET_HOST_BATCH_SIZE];
+   ENetBuffer           receiveBatchBuffers [ENET_HOST_BATCH_SIZE];
+   size_t               receiveBatchCount;
+   size_t               receiveBatchIndex;
 } ENetHost;
 
 /**
@@ -448,6 +468,8 @@ ENET_API ENetSocket enet_socket_accept (ENetSocket, ENetAddress *);
 ENET_API int        enet_socket_connect (ENetSocket, const ENetAddress *);
 ENET_API int        enet_socket_send (ENetSocket, const ENetAddress *, const ENetBuffer *, size_t);
 ENET_API int        enet_socket_receive (ENetSocket, ENetAddress *, ENetBuffer *, size_t);
+ENET_API int        enet_socket_send_batch (ENetSocket, const ENetAddress *, const ENetBuffer *, size_t);
+ENET_API int        enet_socket_receive_batch (ENetSocket, ENetAddress *, ENetBuffer *, size_t);
 ENET_API int        enet_socket_wait (ENetSocket, enet_uint32 *, enet_uint32);
 ENET_API int        enet_socket_set_option (ENetSocket, ENetSocketOption, int);
 ENET_API void       enet_socket_destroy (ENetSocket);
@@ -529,6 +551,9 @@ ENET_API void * enet_range_coder_create (void);
 ENET_API void   enet_range_coder_destroy (void *);
 ENET_API size_t enet_range_coder_compress (void *, const ENetBuffer *, size_t, size_t, enet_uint8 *, size_t);
 ENET_API size_t enet_range_coder_decompress (void *, const enet_uint8 *, size_t, enet_uint8 *, size_t);
+ENET_API int    enet_range_coder_prime (void *, size_t, const enet_uint8 *, size_t);
+ENET_API size_t enet_range_coder_compress_primed (void *, const ENetBuffer *, size_t, size_t, enet_uint8 *, size_t);
+ENET_API size_t enet_range_coder_decompress_primed (void *, const enet_uint8 *, size_t, enet_uint8 *, size_t);
    
 extern size_t enet_protocol_command_size (enet_uint8);
 
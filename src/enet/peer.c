@@ -366,6 +366,7 @@ enet_peer_reset (ENetPeer * peer)
     peer -> incomingUnsequencedGroup = 0;
     peer -> outgoingUnsequencedGroup = 0;
     peer -> eventData = 0;
+    peer -> compress = ENET_PEER_COMPRESS_OFF;
 
     memset (peer -> unsequencedWindow, 0, sizeof (peer -> unsequencedWindow));
     
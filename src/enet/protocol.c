@@ -876,6 +876,9 @@ enet_protocol_handle_incoming_commands (ENetHost * host, ENetEvent * event)
         memcpy (host -> packetData [1], header, headerSize);
         host -> receivedData = host -> packetData [1];
         host -> receivedDataLength = headerSize + originalSize;
+
+        if (peer != NULL && peer -> compress == ENET_PEER_COMPRESS_PENDING)
+          peer -> compress = ENET_PEER_COMPRESS_ON;
     }
 
     if (host -> checksum != NULL)
@@ -1029,27 +1032,47 @@ enet_protocol_receive_incoming_commands (ENetHost * host, ENetEvent * event)
 {
     for (;;)
     {
-       int receivedLength;
-       ENetBuffer buffer;
+       ENetBuffer * buffer;
 
-       buffer.data = host -> packetData [0];
-       buffer.dataLength = sizeof (host -> packetData [0]);
+       if (host -> receiveBatchIndex >= host -> receiveBatchCount)
+       {
+          int receivedCount;
+          size_t i;
 
-       receivedLength = enet_socket_receive (host -> socket,
-                                             & host -> receivedAddress,
-                                             & buffer,
-                                             1);
+          for (i = 0; i < ENET_HOST_BATCH_SIZE; ++ i)
+          {
+             host -> receiveBatchBuffers [i].data = host -> receiveBatchData + i * ENET_PROTOCOL_MAXIMUM_MTU;
+             host -> receiveBatchBuffers [i].dataLength = ENET_PROTOCOL_MAXIMUM_MTU;
+          }
 
-       if (receivedLength < 0)
-         return -1;
+          host -> receiveBatchCount = host -> receiveBatchIndex = 0;
 
-       if (receivedLength == 0)
-         return 0;
+          receivedCount = enet_socket_receive_batch (host -> socket,
+                                                     host -> receiveBatchAddresses,
+                                                     host -> receiveBatchBuffers,
+                                                     ENET_HOST_BATCH_SIZE);
+
+          if (receivedCount < 0)
+            return -1;
+
+          if (receivedCount == 0)
+            return 0;
+
+          host -> receiveBatchCount = receivedCount;
+       }
 
-       host -> receivedData = host -> packetData [0];
-       host -> receivedDataLength = receivedLength;
+       /* datagrams left over from the batch are handled on the next call if this one produces an event */
+       buffer = & host -> receiveBatchBuffers [host -> receiveBatchIndex];
+       host -> receivedAddress = host -> receiveBatchAddresses [host -> receiveBatchIndex];
+       ++ host -> receiveBatchIndex;
+
+       if (buffer -> dataLength == 0)
+         continue;
+
+       host -> receivedData = (enet_uint8 *) buffer -> data;
+       host -> receivedDataLength = buffer -> dataLength;
       
-       host -> totalReceivedData += receivedLength;
+       host -> totalReceivedData += buffer -> dataLength;
        host -> totalReceivedPackets ++;
  
        switch (enet_protocol_handle_incoming_commands (host, event))
@@ -1380,6 +1403,50 @@ enet_protocol_send_reliable_outgoing_commands (ENetHost * host, ENetPeer * peer)
     return canPing;
 }
 
+static int
+enet_protocol_flush_send_batch (ENetHost * host)
+{
+    int sentCount;
+
+    if (host -> sendBatchCount == 0)
+      return 0;
+
+    sentCount = enet_socket_send_batch (host -> socket, host -> sendBatchAddresses, host -> sendBatchBuffers, host -> sendBatchCount);
+
+    host -> sendBatchCount = 0;
+
+    return sentCount < 0 ? -1 : 0;
+}
+
+static int
+enet_protocol_queue_send_batch (ENetHost * host, const ENetAddress * address)
+{
+    enet_uint8 * data = host -> sendBatchData + host -> sendBatchCount * ENET_PROTOCOL_MAXIMUM_MTU;
+    size_t length = 0, i;
+
+    /* the buffers point at command and packet data that is reused or freed once this peer is done, so copy them out */
+    for (i = 0; i < host -> bufferCount; ++ i)
+    {
+       const ENetBuffer * buffer = & host -> buffers [i];
+
+       if (length + buffer -> dataLength > ENET_PROTOCOL_MAXIMUM_MTU)
+         return -1;
+
+       memcpy (data + length, buffer -> data, buffer -> dataLength);
+       length += buffer -> dataLength;
+    }
+
+    host -> sendBatchAddresses [host -> sendBatchCount] = * address;
+    host -> sendBatchBuffers [host -> sendBatchCount].data = data;
+    host -> sendBatchBuffers [host -> sendBatchCount].dataLength = length;
+    ++ host -> sendBatchCount;
+
+    if (host -> sendBatchCount >= ENET_HOST_BATCH_SIZE && enet_protocol_flush_send_batch (host) < 0)
+      return -1;
+
+    return (int) length;
+}
+
 static int
 enet_protocol_send_outgoing_commands (ENetHost * host, ENetEvent * event, int checkForTimeouts)
 {
@@ -1413,7 +1480,11 @@ enet_protocol_send_outgoing_commands (ENetHost * host, ENetEvent * event, int ch
             ! enet_list_empty (& currentPeer -> sentReliableCommands) &&
             ENET_TIME_GREATER_EQUAL (host -> serviceTime, currentPeer -> nextTimeout) &&
             enet_protocol_check_timeouts (host, currentPeer, event) == 1)
-          return 1;
+        {
+            enet_protocol_flush_send_batch (host);
+
+            return 1;
+        }
 
         if ((enet_list_empty (& currentPeer -> outgoingReliableCommands) ||
               enet_protocol_send_reliable_outgoing_commands (host, currentPeer)) &&
@@ -1477,7 +1548,7 @@ enet_protocol_send_outgoing_commands (ENetHost * host, ENetEvent * event, int ch
           host -> buffers -> dataLength = (size_t) & ((ENetProtocolHeader *) 0) -> sentTime;
 
         shouldCompress = 0;
-        if (host -> compressor.context != NULL && host -> compressor.compress != NULL)
+        if (currentPeer -> compress == ENET_PEER_COMPRESS_ON && host -> compressor.context != NULL && host -> compressor.compress != NULL)
         {
             size_t originalSize = host -> packetSize - sizeof(ENetProtocolHeader),
                    compressedSize = host -> compressor.compress (host -> compressor.context,
@@ -1520,7 +1591,7 @@ enet_protocol_send_outgoing_commands (ENetHost * host, ENetEvent * event, int ch
 
         currentPeer -> lastSendTime = host -> serviceTime;
 
-        sentLength = enet_socket_send (host -> socket, & currentPeer -> address, host -> buffers, host -> bufferCount);
+        sentLength = enet_protocol_queue_send_batch (host, & currentPeer -> address);
 
         enet_protocol_remove_sent_unreliable_commands (currentPeer);
 
@@ -1531,7 +1602,7 @@ enet_protocol_send_outgoing_commands (ENetHost * host, ENetEvent * event, int ch
         host -> totalSentPackets ++;
     }
    
-    return 0;
+    return enet_protocol_flush_send_batch (host);
 }
 
 /** Sends any queued packets on the host specified to its designated peers.
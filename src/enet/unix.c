@@ -4,6 +4,10 @@
 */
 #ifndef WIN32
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
@@ -38,6 +42,11 @@ typedef int socklen_t;
 #define MSG_NOSIGNAL 0
 #endif
 
+#if defined(__linux__) && defined(MSG_WAITFORONE)
+#define HAS_MMSG 1
+static int mmsgUnsupported = 0;
+#endif
+
 static enet_uint32 timeBase = 0;
 
 int
@@ -353,6 +362,156 @@ enet_socket_receive (ENetSocket socket,
     return recvLength;
 }
 
+static void
+enet_address_to_sin (const ENetAddress * address, struct sockaddr_in * sin)
+{
+    memset (sin, 0, sizeof (struct sockaddr_in));
+
+    sin -> sin_family = AF_INET;
+    sin -> sin_port = ENET_HOST_TO_NET_16 (address -> port);
+    sin -> sin_addr.s_addr = address -> host;
+}
+
+int
+enet_socket_send_batch (ENetSocket socket,
+                        const ENetAddress * addresses,
+                        const ENetBuffer * buffers,
+                        size_t count)
+{
+    size_t sent = 0;
+
+#ifdef HAS_MMSG
+    if (! mmsgUnsupported)
+    {
+       struct mmsghdr msgs [ENET_HOST_BATCH_SIZE];
+       struct sockaddr_in sins [ENET_HOST_BATCH_SIZE];
+       size_t i;
+
+       if (count > ENET_HOST_BATCH_SIZE)
+         count = ENET_HOST_BATCH_SIZE;
+
+       memset (msgs, 0, count * sizeof (struct mmsghdr));
+
+       for (i = 0; i < count; ++ i)
+       {
+          enet_address_to_sin (& addresses [i], & sins [i]);
+
+          msgs [i].msg_hdr.msg_name = & sins [i];
+          msgs [i].msg_hdr.msg_namelen = sizeof (struct sockaddr_in);
+          msgs [i].msg_hdr.msg_iov = (struct iovec *) & buffers [i];
+          msgs [i].msg_hdr.msg_iovlen = 1;
+       }
+
+       while (sent < count)
+       {
+          int result = sendmmsg (socket, & msgs [sent], count - sent, MSG_NOSIGNAL);
+
+          if (result == -1)
+          {
+             if (errno == EWOULDBLOCK)
+               return sent;
+
+             if (errno == ENOSYS && sent == 0)
+             {
+                mmsgUnsupported = 1;
+                break;
+             }
+
+             return sent > 0 ? (int) sent : -1;
+          }
+
+          sent += result;
+       }
+
+       if (! mmsgUnsupported)
+         return sent;
+    }
+#endif
+
+    for (; sent < count; ++ sent)
+    {
+       int result = enet_socket_send (socket, & addresses [sent], & buffers [sent], 1);
+
+       if (result < 0)
+         return sent > 0 ? (int) sent : -1;
+    }
+
+    return sent;
+}
+
+int
+enet_socket_receive_batch (ENetSocket socket,
+                           ENetAddress * addresses,
+                           ENetBuffer * buffers,
+                           size_t count)
+{
+    size_t received = 0;
+
+#ifdef HAS_MMSG
+    if (! mmsgUnsupported)
+    {
+       struct mmsghdr msgs [ENET_HOST_BATCH_SIZE];
+       struct sockaddr_in sins [ENET_HOST_BATCH_SIZE];
+       int result;
+       size_t i;
+
+       if (count > ENET_HOST_BATCH_SIZE)
+         count = ENET_HOST_BATCH_SIZE;
+
+       memset (msgs, 0, count * sizeof (struct mmsghdr));
+
+       for (i = 0; i < count; ++ i)
+       {
+          msgs [i].msg_hdr.msg_name = & sins [i];
+          msgs [i].msg_hdr.msg_namelen = sizeof (struct sockaddr_in);
+          msgs [i].msg_hdr.msg_iov = (struct iovec *) & buffers [i];
+          msgs [i].msg_hdr.msg_iovlen = 1;
+       }
+
+       result = recvmmsg (socket, msgs, count, MSG_NOSIGNAL, NULL);
+
+       if (result == -1)
+       {
+          if (errno == EWOULDBLOCK)
+            return 0;
+
+          if (errno != ENOSYS)
+            return -1;
+
+          mmsgUnsupported = 1;
+       }
+       else
+       {
+          for (i = 0; i < (size_t) result; ++ i)
+          {
+             addresses [i].host = (enet_uint32) sins [i].sin_addr.s_addr;
+             addresses [i].port = ENET_NET_TO_HOST_16 (sins [i].sin_port);
+
+             /* truncated datagrams are left empty so the caller skips them */
+             buffers [i].dataLength = msgs [i].msg_hdr.msg_flags & MSG_TRUNC ? 0 : msgs [i].msg_len;
+          }
+
+          return result;
+       }
+    }
+#endif
+
+    for (; received < count; ++ received)
+    {
+       int result = enet_socket_receive (socket, & addresses [received], & buffers [received], 1);
+
+       if (result < 0)
+         return received > 0 ? (int) received : -1;
+
+       if (result == 0)
+         break;
+
+       buffers [received].dataLength = result;
+    }
+
+    return received;
+}
+
 int
 enet_socketset_select (ENetSocket maxSocket, ENetSocketSet * readSet, ENetSocketSet * writeSet, enet_uint32 timeout)
 {
@@ -295,6 +295,49 @@ enet_socket_receive (ENetSocket socket,
     return (int) recvLength;
 }
 
+int
+enet_socket_send_batch (ENetSocket socket,
+                        const ENetAddress * addresses,
+                        const ENetBuffer * buffers,
+                        size_t count)
+{
+    size_t sent;
+
+    for (sent = 0; sent < count; ++ sent)
+    {
+       int result = enet_socket_send (socket, & addresses [sent], & buffers [sent], 1);
+
+       if (result < 0)
+         return sent > 0 ? (int) sent : -1;
+    }
+
+    return (int) sent;
+}
+
+int
+enet_socket_receive_batch (ENetSocket socket,
+                           ENetAddress * addresses,
+                           ENetBuffer * buffers,
+                           size_t count)
+{
+    size_t received;
+
+    for (received = 0; received < count; ++ received)
+    {
+       int result = enet_socket_receive (socket, & addresses [received], & buffers [received], 1);
+
+       if (result < 0)
+         return received > 0 ? (int) received : -1;
+
+       if (result == 0)
+         break;
+
+       buffers [received].dataLength = result;
+    }
+
+    return (int) received;
+}
+
 int
 enet_socketset_select (ENetSocket maxSocket, ENetSocketSet * readSet, ENetSocketSet * writeSet, enet_uint32 timeout)
 {
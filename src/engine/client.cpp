@@ -26,6 +26,7 @@ void throttle();
 VARF(throttle_interval, 0, 5, 30, throttle());
 VARF(throttle_accel,    0, 2, 32, throttle());
 VARF(throttle_decel,    0, 2, 32, throttle());
+VARP(netcompress, 0, 1, 1);
 
 void throttle()
 {
@@ -107,11 +108,18 @@ void connectserv(const char *servername, int serverport, const char *serverpassw
     }
 
     if(!clienthost) 
+    {
         clienthost = enet_host_create(NULL, 2, server::numchannels(), rate, rate);
+        if(clienthost && netcompress && !setupcompression(clienthost)) conoutf(CON_WARN, "WARNING: could not set up transport compression");
+    }
 
     if(clienthost)
     {
-        connpeer = enet_host_connect(clienthost, &address, server::numchannels(), 0); 
+        // ask for compression in the connect data, but only compress once the server's first compressed datagram
+        // shows it agreed; a server that never compresses keeps getting plain datagrams
+        bool compress = clienthost->compressor.context != NULL;
+        connpeer = enet_host_connect(clienthost, &address, server::numchannels(), compress ? 1 : 0); 
+        if(connpeer) connpeer->compress = compress ? ENET_PEER_COMPRESS_PENDING : ENET_PEER_COMPRESS_OFF;
         enet_host_flush(clienthost);
         connmillis = totalmillis;
         connattempts = 0;
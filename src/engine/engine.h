@@ -402,6 +402,8 @@ extern void cleanupserver();
 extern void serverslice(bool dedicated, uint timeout);
 
 extern ENetSocket connectmaster();
+extern int initnetwork();
+extern bool setupcompression(ENetHost *host);
 extern void localclienttoserver(int chan, ENetPacket *);
 extern void localconnect();
 extern bool serveroption(char *opt);
@@ -490,6 +492,8 @@ extern ShadowRayCache *newshadowraycache();
 extern void freeshadowraycache(ShadowRayCache *&cache);
 extern void resetshadowraycache(ShadowRayCache *cache);
 extern float shadowray(ShadowRayCache *cache, const vec &o, const vec &ray, float radius, int mode, extentity *t = NULL);
+#define RAYPACKETSIZE 4
+extern void shadowrays(ShadowRayCache *cache, int n, const vec *o, const vec *ray, const float *radius, int mode, float *dists, extentity *t = NULL);
 
 // world
 
@@ -1,13 +1,25 @@
 #include "engine.h"
 
 #define MAXLIGHTMAPTASKS 4096
+#define LIGHTMAPTASKCHUNK 32
 #define LIGHTMAPBUFSIZE (2*1024*1024)
+#define MAXLIGHTTHREADS 256
 
 struct lightmapinfo;
 struct lightmaptask;
 
+struct lightmaptaskrange
+{
+    int start, end;
+};
+
 struct lightmapworker
 {
+    int index;
+    vector<lightmaptaskrange> queue;
+    int queuehead, lasttask, numtasks;
+    SDL_mutex *queuelock;
+    uint idletime, stalltime;
     uchar *buf;
     int bufstart, bufused;
     lightmapinfo *firstlightmap, *lastlightmap, *curlightmaps;
@@ -55,10 +67,24 @@ struct lightmaptask
     lightmapworker *worker;
 };
 
+/* Tasks are created in octree order by the main thread into a ring of MAXLIGHTMAPTASKS and
+ * handed out in runs of LIGHTMAPTASKCHUNK to the workers' own queues, round robin. A worker
+ * takes tasks from the front of its own queue and, once that runs dry, steals the back half
+ * of the last run in another worker's queue. A worker never takes a task older than one it
+ * has already done, so its lightmap buffer only ever holds finished tasks that are waiting
+ * on older ones, and it can not end up waiting on itself for space.
+ *
+ * Lightmaps must still be packed in task order to come out the same regardless of the
+ * number of threads. Whichever thread finishes a task packs every finished task in order
+ * from packidx, unless another thread is already packing, in which case it just leaves its
+ * task for that one to pick up; tasklock is only held to hand tasks over, not while packing.
+ */
 static vector<lightmapworker *> lightmapworkers;
-static vector<lightmaptask> lightmaptasks[2];
-static int packidx = 0, allocidx = 0;
-static SDL_mutex *lightlock = NULL, *tasklock = NULL;
+static lightmaptask lightmaptasks[MAXLIGHTMAPTASKS];
+static int numworkers = 0, numtasks = 0, queuedtasks = 0, packidx = 0, nextqueue = 0;
+static bool packing = false;
+static uint taskgeneration = 0, packtime = 0;
+static SDL_mutex *lightlock = NULL, *tasklock = NULL, *packlock = NULL;
 static SDL_cond *fullcond = NULL, *emptycond = NULL;
 
 int lightmapping = 0;
@@ -157,11 +183,11 @@ void show_calclight_progress()
     // only update once a sec (4 * 250 ms ticks) to not kill performance
     if(progresstex && !calclight_canceled && progresslightmap >= 0 && !(progresstexticks++ % 4)) 
     {
-        if(tasklock) SDL_LockMutex(tasklock);
+        if(packlock) SDL_LockMutex(packlock);
         LightMap &lm = lightmaps[progresslightmap];
         uchar *data = lm.data;
         int bpp = lm.bpp;
-        if(tasklock) SDL_UnlockMutex(tasklock);
+        if(packlock) SDL_UnlockMutex(packlock);
         glBindTexture(GL_TEXTURE_2D, progresstex);
         glPixelStorei(GL_UNPACK_ALIGNMENT, texalign(data, LM_PACKW, bpp));
         glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, LM_PACKW, LM_PACKH, bpp > 3 ? GL_RGBA : GL_RGB, GL_UNSIGNED_BYTE, data);
@@ -208,15 +234,53 @@ bool PackNode::insert(ushort &tx, ushort &ty, ushort tw, ushort th)
     return inserted;
 }
 
+// places a lightmap in the smallest space left behind by released lightmaps that fits it
+bool LightMap::reuse(ushort &tx, ushort &ty, ushort tw, ushort th)
+{
+    int best = -1;
+    loopv(freerects)
+    {
+        const LightMapRect &r = freerects[i];
+        if(r.w >= tw && r.h >= th && (best < 0 || r.w*r.h < freerects[best].w*freerects[best].h)) best = i;
+    }
+    if(best < 0) return false;
+    LightMapRect r = freerects.removeunordered(best);
+    tx = r.x;
+    ty = r.y;
+    LightMapRect right = { ushort(r.x + tw), r.y, ushort(r.w - tw), r.h }, below = { r.x, ushort(r.y + th), tw, ushort(r.h - th) };
+    if(r.w - tw <= r.h - th)
+    {
+        right.h = th;
+        below.w = r.w;
+    }
+    if(right.w && right.h) freerects.add(right);
+    if(below.w && below.h) freerects.add(below);
+    return true;
+}
+
 bool LightMap::insert(ushort &tx, ushort &ty, uchar *src, ushort tw, ushort th)
 {
-    if((type&LM_TYPE) != LM_BUMPMAP1 && !packroot.insert(tx, ty, tw, th))
+    if((type&LM_TYPE) != LM_BUMPMAP1 && !reuse(tx, ty, tw, th) && !packroot.insert(tx, ty, tw, th))
         return false;
 
     copy(tx, ty, src, tw, th);
     return true;
 }
 
+void LightMap::release(ushort tx, ushort ty, ushort tw, ushort th)
+{
+    if((type&LM_TYPE) != LM_BUMPMAP1)
+    {
+        LightMapRect &r = freerects.add();
+        r.x = tx;
+        r.y = ty;
+        r.w = tw;
+        r.h = th;
+    }
+    --lightmaps;
+    lumels -= tw * th;
+}
+
 void LightMap::copy(ushort tx, ushort ty, uchar *src, ushort tw, ushort th)
 {
     uchar *dst = data + bpp * tx + ty * bpp * LM_PACKW;
@@ -349,7 +413,9 @@ static inline uint hthash(const compresskey &k)
 
 static hashset<compressval> compressed;
 
-VAR(lightcompress, 0, 3, 6);
+#define MAXLIGHTCOMPRESS 6
+
+VAR(lightcompress, 0, 3, MAXLIGHTCOMPRESS);
 
 static bool packlightmap(lightmapinfo &l, surfaceinfo &surface) 
 {
@@ -423,100 +489,152 @@ static void updatelightmap(const surfaceinfo &surface)
 }
  
         
-static uint generatelumel(lightmapworker *w, const float tolerance, uint lightmask, const vector<const extentity *> &lights, const vec &target, const vec &normal, vec &sample, int x, int y)
+struct lumel
+{
+    vec target, normal;
+    float tolerance;
+    vec *sample;
+    int x, y;
+};
+
+// lights up to RAYPACKETSIZE lumels at once, so that their shadow rays can be traced as packets
+static uint generatelumels(lightmapworker *w, uint lightmask, const vector<const extentity *> &lights, lumel *lumels, int n)
 {
-    vec avgray(0, 0, 0);
-    float r = 0, g = 0, b = 0;
+    vec avgray[RAYPACKETSIZE], color[RAYPACKETSIZE], origins[RAYPACKETSIZE], rays[RAYPACKETSIZE];
+    float radii[RAYPACKETSIZE], dists[RAYPACKETSIZE], attenuations[RAYPACKETSIZE], angles[RAYPACKETSIZE];
+    int ids[RAYPACKETSIZE];
+    loopj(n) { avgray[j] = vec(0, 0, 0); color[j] = vec(0, 0, 0); }
     uint lightused = 0;
     loopv(lights)
     {
         if(lightmask&(1<<i)) continue;
         const extentity &light = *lights[i];
-        vec ray = target;
-        ray.sub(light.o);
-        float mag = ray.magnitude();
-        if(!mag) continue;
-        float attenuation = 1;
-        if(light.attr1)
+        int numrays = 0;
+        loopj(n)
         {
-            attenuation -= mag / float(light.attr1);
-            if(attenuation <= 0) continue;
-        }
-        ray.mul(1.0f / mag);
-        float angle = -ray.dot(normal);
-        if(angle <= 0) continue;
-        if(light.attached && light.attached->type==ET_SPOTLIGHT)
-        {
-            vec spot(vec(light.attached->o).sub(light.o).normalize());
-            float maxatten = 1-cosf(max(1, min(90, int(light.attached->attr1)))*RAD);
-            float spotatten = 1-(1-ray.dot(spot))/maxatten;
-            if(spotatten <= 0) continue;
-            attenuation *= spotatten;
-        }
-        if(lmshadows && mag)
-        {
-            float dist = shadowray(w->shadowraycache, light.o, ray, mag - tolerance, RAY_SHADOW | (lmshadows > 1 ? RAY_ALPHAPOLY : 0));
-            if(dist < mag - tolerance) continue;
+            const lumel &l = lumels[j];
+            vec ray = l.target;
+            ray.sub(light.o);
+            float mag = ray.magnitude();
+            if(!mag) continue;
+            float attenuation = 1;
+            if(light.attr1)
+            {
+                attenuation -= mag / float(light.attr1);
+                if(attenuation <= 0) continue;
+            }
+            ray.mul(1.0f / mag);
+            float angle = -ray.dot(l.normal);
+            if(angle <= 0) continue;
+            if(light.attached && light.attached->type==ET_SPOTLIGHT)
+            {
+                vec spot(vec(light.attached->o).sub(light.o).normalize());
+                float maxatten = 1-cosf(max(1, min(90, int(light.attached->attr1)))*RAD);
+                float spotatten = 1-(1-ray.dot(spot))/maxatten;
+                if(spotatten <= 0) continue;
+                attenuation *= spotatten;
+            }
+            origins[numrays] = light.o;
+            rays[numrays] = ray;
+            radii[numrays] = mag - l.tolerance;
+            attenuations[numrays] = attenuation;
+            angles[numrays] = angle;
+            ids[numrays++] = j;
         }
-        lightused |= 1<<i;
-        float intensity;
-        switch(w->type&LM_TYPE)
+        if(!numrays) continue;
+        if(lmshadows) shadowrays(w->shadowraycache, numrays, origins, rays, radii, RAY_SHADOW | (lmshadows > 1 ? RAY_ALPHAPOLY : 0), dists);
+        loopj(numrays)
         {
-            case LM_BUMPMAP0: 
-                intensity = attenuation; 
-                avgray.add(ray.mul(-attenuation));
-                break;
-            default:
-                intensity = angle * attenuation;
-                break;
+            if(lmshadows && dists[j] < radii[j]) continue;
+            lightused |= 1<<i;
+            int id = ids[j];
+            float intensity;
+            switch(w->type&LM_TYPE)
+            {
+                case LM_BUMPMAP0: 
+                    intensity = attenuations[j]; 
+                    avgray[id].add(rays[j].mul(-attenuations[j]));
+                    break;
+                default:
+                    intensity = angles[j] * attenuations[j];
+                    break;
+            }
+            color[id].x += intensity * float(light.attr2);
+            color[id].y += intensity * float(light.attr3);
+            color[id].z += intensity * float(light.attr4);
         }
-        r += intensity * float(light.attr2);
-        g += intensity * float(light.attr3);
-        b += intensity * float(light.attr4);
     }
     if(sunlight)
     {
-        float angle = sunlightdir.dot(normal);
-        if(angle > 0 &&
-           (!lmshadows ||
-            shadowray(w->shadowraycache, vec(sunlightdir).mul(tolerance).add(target), sunlightdir, 1e16f, RAY_SHADOW | (lmshadows > 1 ? RAY_ALPHAPOLY : 0) | (skytexturelight ? RAY_SKIPSKY : 0)) > 1e15f))
+        int numrays = 0;
+        loopj(n)
+        {
+            angles[j] = sunlightdir.dot(lumels[j].normal);
+            if(angles[j] <= 0) continue;
+            origins[numrays] = vec(sunlightdir).mul(lumels[j].tolerance).add(lumels[j].target);
+            rays[numrays] = sunlightdir;
+            radii[numrays] = 1e16f;
+            ids[numrays++] = j;
+        }
+        if(lmshadows && numrays) shadowrays(w->shadowraycache, numrays, origins, rays, radii, RAY_SHADOW | (lmshadows > 1 ? RAY_ALPHAPOLY : 0) | (skytexturelight ? RAY_SKIPSKY : 0), dists);
+        loopj(numrays)
         {
+            if(lmshadows && dists[j] <= 1e15f) continue;
+            int id = ids[j];
             float intensity;
             switch(w->type&LM_TYPE)
             {
                 case LM_BUMPMAP0:
                     intensity = 1;
-                    avgray.add(sunlightdir);
+                    avgray[id].add(sunlightdir);
                     break;
                 default:
-                    intensity = angle;
+                    intensity = angles[id];
                     break;
             }
-            r += intensity * (sunlightcolor.x*sunlightscale);
-            g += intensity * (sunlightcolor.y*sunlightscale);
-            b += intensity * (sunlightcolor.z*sunlightscale);
-        }
-    }
-    switch(w->type&LM_TYPE)
-    {
-        case LM_BUMPMAP0:
-            if(avgray.iszero()) break;
-            // transform to tangent space
-            extern vec orientation_tangent[6][3];
-            extern vec orientation_binormal[6][3];            
-            vec S(orientation_tangent[w->rotate][dimension(w->orient)]),
-                T(orientation_binormal[w->rotate][dimension(w->orient)]);
-            normal.orthonormalize(S, T);
-            avgray.normalize();
-            w->raydata[y*w->w+x].add(vec(S.dot(avgray)/S.magnitude(), T.dot(avgray)/T.magnitude(), normal.dot(avgray)));
-            break;
+            color[id].x += intensity * (sunlightcolor.x*sunlightscale);
+            color[id].y += intensity * (sunlightcolor.y*sunlightscale);
+            color[id].z += intensity * (sunlightcolor.z*sunlightscale);
+        }
+    }
+    loopj(n)
+    {
+        const lumel &l = lumels[j];
+        switch(w->type&LM_TYPE)
+        {
+            case LM_BUMPMAP0:
+            {
+                if(avgray[j].iszero()) break;
+                // transform to tangent space
+                extern vec orientation_tangent[6][3];
+                extern vec orientation_binormal[6][3];            
+                vec S(orientation_tangent[w->rotate][dimension(w->orient)]),
+                    T(orientation_binormal[w->rotate][dimension(w->orient)]);
+                l.normal.orthonormalize(S, T);
+                avgray[j].normalize();
+                w->raydata[l.y*w->w+l.x].add(vec(S.dot(avgray[j])/S.magnitude(), T.dot(avgray[j])/T.magnitude(), l.normal.dot(avgray[j])));
+                break;
+            }
+        }
+        l.sample->x = min(255.0f, max(color[j].x, float(ambientcolor[0])));
+        l.sample->y = min(255.0f, max(color[j].y, float(ambientcolor[1])));
+        l.sample->z = min(255.0f, max(color[j].z, float(ambientcolor[2])));
     }
-    sample.x = min(255.0f, max(r, float(ambientcolor[0])));
-    sample.y = min(255.0f, max(g, float(ambientcolor[1])));
-    sample.z = min(255.0f, max(b, float(ambientcolor[2])));
     return lightused;
 }
 
+static uint generatelumel(lightmapworker *w, const float tolerance, uint lightmask, const vector<const extentity *> &lights, const vec &target, const vec &normal, vec &sample, int x, int y)
+{
+    lumel l;
+    l.target = target;
+    l.normal = normal;
+    l.tolerance = tolerance;
+    l.sample = &sample;
+    l.x = x;
+    l.y = y;
+    return generatelumels(w, lightmask, lights, &l, 1);
+}
+
 static bool lumelsample(const vec &sample, int aasample, int stride)
 {
     if(sample.x >= int(ambientcolor[0])+1 || sample.y >= int(ambientcolor[1])+1 || sample.z >= int(ambientcolor[2])+1) return true;
@@ -663,19 +781,38 @@ static bool generatelightmap(lightmapworker *w, float lpu, const lerpvert *lv, i
         vec normal, nstep;
         lerpnormal(y, lv, numv, start, end, normal, nstep);
         
-        for(int x = 0; x < w->w; ++x, normal.add(nstep), skylight += w->bpp) 
+        for(int x = 0; x < w->w; x += RAYPACKETSIZE) 
         {
-            vec u = x < sidex ? vec(xstep1).mul(x).add(vec(ystep1).mul(y)).add(origin1) : vec(xstep2).mul(x).add(vec(ystep2).mul(y)).add(origin2);
-            lightused |= generatelumel(w, tolerance, 0, w->lights, u, vec(normal).normalize(), *sample, x, y);
-            if(hasskylight())
+            lumel lumels[RAYPACKETSIZE];
+            vec normals[RAYPACKETSIZE];
+            int numlumels = min(w->w - x, RAYPACKETSIZE);
+            loopi(numlumels)
             {
-                if((w->type&LM_TYPE)==LM_BUMPMAP0 || !adaptivesample || sample->x<skylightcolor[0] || sample->y<skylightcolor[1] || sample->z<skylightcolor[2])
-                    calcskylight(w, u, normal, tolerance, skylight, lmshadows > 1 ? RAY_ALPHAPOLY : 0);
-                else loopk(3) skylight[k] = max(skylightcolor[k], ambientcolor[k]);
+                lumel &l = lumels[i];
+                l.target = x+i < sidex ? vec(xstep1).mul(x+i).add(vec(ystep1).mul(y)).add(origin1) : vec(xstep2).mul(x+i).add(vec(ystep2).mul(y)).add(origin2);
+                l.normal = vec(normal).normalize();
+                l.tolerance = tolerance;
+                l.sample = &sample[i*aasample];
+                l.x = x+i;
+                l.y = y;
+                normals[i] = normal;
+                normal.add(nstep);
+            }
+            lightused |= generatelumels(w, 0, w->lights, lumels, numlumels);
+            loopi(numlumels)
+            {
+                const vec &u = lumels[i].target;
+                if(hasskylight())
+                {
+                    if((w->type&LM_TYPE)==LM_BUMPMAP0 || !adaptivesample || sample->x<skylightcolor[0] || sample->y<skylightcolor[1] || sample->z<skylightcolor[2])
+                        calcskylight(w, u, normals[i], tolerance, skylight, lmshadows > 1 ? RAY_ALPHAPOLY : 0);
+                    else loopk(3) skylight[k] = max(skylightcolor[k], ambientcolor[k]);
+                }
+                else loopk(3) skylight[k] = ambientcolor[k];
+                if(w->type&LM_ALPHA) generatealpha(w, tolerance, u, skylight[3]);
+                skylight += w->bpp;
+                sample += aasample;
             }
-            else loopk(3) skylight[k] = ambientcolor[k];
-            if(w->type&LM_ALPHA) generatealpha(w, tolerance, u, skylight[3]);
-            sample += aasample;
         }
         sample += aasample;
     }
@@ -704,16 +841,33 @@ static bool generatelightmap(lightmapworker *w, float lpu, const lerpvert *lv, i
                 vec u = x < sidex ? vec(xstep1).mul(x).add(vec(ystep1).mul(y)).add(origin1) : vec(xstep2).mul(x).add(vec(ystep2).mul(y)).add(origin2);
                 const vec *offsets = x < sidex ? offsets1 : offsets2;
                 vec n = vec(normal).normalize();
+                lumel lumels[RAYPACKETSIZE];
                 loopi(aasample-1)
-                    generatelumel(w, EDGE_TOLERANCE(i+1) * tolerance, lightmask, w->lights, vec(u).add(offsets[i+1]), n, *sample++, x, y);
+                {
+                    lumel &l = lumels[i];
+                    l.target = vec(u).add(offsets[i+1]);
+                    l.normal = n;
+                    l.tolerance = EDGE_TOLERANCE(i+1) * tolerance;
+                    l.sample = sample++;
+                    l.x = x;
+                    l.y = y;
+                }
+                generatelumels(w, lightmask, w->lights, lumels, aasample-1);
                 if(lmaa == 3) 
                 {
+                    vec s[4];
                     loopi(4)
                     {
-                        vec s;
-                        generatelumel(w, EDGE_TOLERANCE(i+4) * tolerance, lightmask, w->lights, vec(u).add(offsets[i+4]), n, s, x, y);
-                        center.add(s);
+                        lumel &l = lumels[i];
+                        l.target = vec(u).add(offsets[i+4]);
+                        l.normal = n;
+                        l.tolerance = EDGE_TOLERANCE(i+4) * tolerance;
+                        l.sample = &s[i];
+                        l.x = x;
+                        l.y = y;
                     }
+                    generatelumels(w, lightmask, w->lights, lumels, 4);
+                    loopi(4) center.add(s[i]);
                     center.div(5);
                 }
             }
@@ -945,6 +1099,100 @@ void clearlightcache(int e)
     }
 }
 
+/* Edits to lights mark the box they reach, before and after the edit, as needing to be relit,
+ * so that relight only has to redo the surfaces inside those boxes. Lights without a radius
+ * reach everything, in which case the whole map has to be recalculated.
+ */
+struct lightregion
+{
+    ivec o, s;
+};
+
+#define MAXLIGHTREGIONS 64
+
+static vector<lightregion> lightregions;
+static bool relightall = false, relighting = false;
+
+static void clearlightregions()
+{
+    lightregions.setsize(0);
+    relightall = false;
+}
+
+static void addlightregion(const ivec &o, const ivec &s)
+{
+    loopv(lightregions)
+    {
+        lightregion &r = lightregions[i];
+        if(o.x >= r.o.x && o.y >= r.o.y && o.z >= r.o.z && o.x+s.x <= r.o.x+r.s.x && o.y+s.y <= r.o.y+r.s.y && o.z+s.z <= r.o.z+r.s.z) return;
+        if(r.o.x >= o.x && r.o.y >= o.y && r.o.z >= o.z && r.o.x+r.s.x <= o.x+s.x && r.o.y+r.s.y <= o.y+s.y && r.o.z+r.s.z <= o.z+s.z) lightregions.removeunordered(i--);
+    }
+    if(lightregions.length() >= MAXLIGHTREGIONS)
+    {
+        // too many separate edits, so just relight everything they could have reached
+        ivec bbmin(o), bbmax = ivec(o).add(s);
+        loopv(lightregions)
+        {
+            lightregion &r = lightregions[i];
+            bbmin.min(r.o);
+            bbmax.max(ivec(r.o).add(r.s));
+        }
+        lightregions.setsize(0);
+        lightregion &r = lightregions.add();
+        r.o = bbmin;
+        r.s = bbmax.sub(bbmin);
+        return;
+    }
+    lightregion &r = lightregions.add();
+    r.o = o;
+    r.s = s;
+}
+
+void changedlight(const extentity &e)
+{
+    if(e.type == ET_SPOTLIGHT)
+    {
+        const vector<extentity *> &ents = entities::getents();
+        loopv(ents) if(ents[i]->type == ET_LIGHT && ents[i]->attached == &e) changedlight(*ents[i]);
+        return;
+    }
+    if(e.type != ET_LIGHT || relightall) return;
+    if(!e.attr1) { relightall = true; lightregions.setsize(0); return; }
+    ivec bbmin(vec(e.o).sub(e.attr1)), bbmax(vec(e.o).add(e.attr1 + 1));
+    bbmin.max(0);
+    bbmax.min(worldsize);
+    if(bbmin.x >= bbmax.x || bbmin.y >= bbmax.y || bbmin.z >= bbmax.z) return;
+    addlightregion(bbmin, bbmax.sub(bbmin));
+}
+
+static bool inlightregion(const ivec &o, int size)
+{
+    loopv(lightregions)
+    {
+        const lightregion &r = lightregions[i];
+        if(o.x < r.o.x+r.s.x && o.x+size > r.o.x &&
+           o.y < r.o.y+r.s.y && o.y+size > r.o.y &&
+           o.z < r.o.z+r.s.z && o.z+size > r.o.z)
+            return true;
+    }
+    return false;
+}
+
+// merged faces are lit from their origin cube, and faces only merge within the same 1<<maxmerge block,
+// so widening the regions to that grid makes sure the origin of every merged face they touch gets relit
+static void alignlightregions()
+{
+    extern int maxmerge;
+    int mask = min(1<<maxmerge, worldsize) - 1;
+    loopv(lightregions)
+    {
+        lightregion &r = lightregions[i];
+        ivec end = ivec(r.o).add(r.s).add(mask).mask(~mask);
+        r.o.mask(~mask);
+        r.s = end.sub(r.o);
+    }
+}
+
 const vector<int> &checklightcache(int x, int y)
 {
     x >>= lightcachesize;
@@ -1036,43 +1284,53 @@ static bool findlights(lightmapworker *w, int cx, int cy, int cz, int size, cons
     return w->lights.length() || hasskylight() || sunlight;
 }
 
-static int packlightmaps(lightmapworker *w = NULL)
+#define LIGHTMAPTASK(i) lightmaptasks[(i)&(MAXLIGHTMAPTASKS-1)]
+
+// called with tasklock held, which is dropped while the finished tasks are actually packed
+static int packlightmaps(lightmapworker *w)
 {
+    if(packing) return 0;
+    packing = true;
     int numpacked = 0;
-    for(; packidx < lightmaptasks[0].length(); packidx++, numpacked++)
-    {
-        lightmaptask &t = lightmaptasks[0][packidx];
-        if(!t.lightmaps) break;
-        progress = t.progress;
-        lightmapinfo *l = t.lightmaps;
-        if(l == (lightmapinfo *)-1) continue;
-        int space = 0; 
-        for(; l && l->c == t.c; l = l->next)
-        {
-            l->packed = true;
-            space += l->bufsize;
-            if(l->surface1 < 0 || !t.c->ext || !t.c->ext->surfaces) continue; 
-            surfaceinfo &s = t.c->ext->surfaces[l->surface1];
-            packlightmap(*l, s);
-            if(l->surface2 < 0) continue;
-            surfaceinfo &s2 = t.c->ext->surfaces[l->surface2];
-            s2.x = s.x;
-            s2.y = s.y;
-            s2.lmid = s.lmid;
-        }
-        if(t.worker == w)
-        {
-            w->bufused -= space;
-            w->bufstart = (w->bufstart + space)%LIGHTMAPBUFSIZE;
-            w->firstlightmap = l;
-            if(!l) 
+    for(;;)
+    {
+        int end = packidx;
+        while(end < queuedtasks && LIGHTMAPTASK(end).lightmaps) end++;
+        if(end <= packidx) break;
+        if(tasklock) SDL_UnlockMutex(tasklock);
+        Uint32 start = SDL_GetTicks();
+        if(packlock) SDL_LockMutex(packlock);
+        for(int i = packidx; i < end; i++)
+        {
+            lightmaptask &t = LIGHTMAPTASK(i);
+            progress = t.progress;
+            if(t.lightmaps == (lightmapinfo *)-1) continue;
+            for(lightmapinfo *l = t.lightmaps; l && l->c == t.c; l = l->next)
             {
-                w->lastlightmap = NULL;
-                w->bufstart = w->bufused = 0;
+                if(l->surface1 < 0 || !t.c->ext || !t.c->ext->surfaces) continue;
+                surfaceinfo &s = t.c->ext->surfaces[l->surface1];
+                packlightmap(*l, s);
+                if(l->surface2 < 0) continue;
+                surfaceinfo &s2 = t.c->ext->surfaces[l->surface2];
+                s2.x = s.x;
+                s2.y = s.y;
+                s2.lmid = s.lmid;
             }
         }
-        if(t.worker->needspace) SDL_CondSignal(t.worker->spacecond);
+        if(packlock) SDL_UnlockMutex(packlock);
+        packtime += SDL_GetTicks() - start;
+        if(tasklock) SDL_LockMutex(tasklock);
+        // the space used by the lightmaps may only be reused once tasklock is released again
+        for(; packidx < end; packidx++, numpacked++)
+        {
+            lightmaptask &t = LIGHTMAPTASK(packidx);
+            if(t.lightmaps == (lightmapinfo *)-1) continue;
+            for(lightmapinfo *l = t.lightmaps; l && l->c == t.c; l = l->next) l->packed = true;
+            if(t.worker != w && t.worker->needspace) SDL_CondSignal(t.worker->spacecond);
+        }
+        if(emptycond) SDL_CondSignal(emptycond);
     }
+    packing = false;
     return numpacked;
 }
 
@@ -1109,9 +1367,11 @@ static lightmapinfo *alloclightmap(lightmapworker *w)
             if(availspace >= needspace && (max(availspace1, availspace2) >= needspace || (availspace1 >= needspace1 && availspace2 >= needspace2))) break;
             if(packlightmaps(w)) continue;
             if(!w->spacecond || !tasklock) break;
+            Uint32 start = SDL_GetTicks();
             w->needspace = true;
             SDL_CondWait(w->spacecond, tasklock);
             w->needspace = false;
+            w->stalltime += SDL_GetTicks() - start;
         }
         if(tasklock) SDL_UnlockMutex(tasklock);
     }
@@ -1165,8 +1425,11 @@ static void freelightmap(lightmapworker *w)
     }
     else
     {
-        w->bufused -= l->bufsize - sizeof(lightmapinfo);
-        l->bufsize = sizeof(lightmapinfo);
+        // keep any padding skipped at the end of the buffer if the lightmap wrapped around
+        int used = (uchar *)l + sizeof(lightmapinfo) - &w->buf[w->bufstart];
+        if(used <= 0) used += LIGHTMAPBUFSIZE;
+        l->bufsize -= w->bufused - used;
+        w->bufused = used;
         l->packed = true;
     }
     if(w->curlightmaps == l) w->curlightmaps = NULL;
@@ -1463,26 +1726,87 @@ static lightmapinfo *setupsurfaces(lightmapworker *w, lightmaptask &task)
     return w->curlightmaps ? w->curlightmaps : (lightmapinfo *)-1;
 }
 
+static int taketask(lightmapworker *w)
+{
+    for(;;)
+    {
+        SDL_LockMutex(w->queuelock);
+        while(w->queuehead < w->queue.length())
+        {
+            lightmaptaskrange &r = w->queue[w->queuehead];
+            if(r.start < r.end)
+            {
+                int task = r.start++;
+                SDL_UnlockMutex(w->queuelock);
+                return task;
+            }
+            w->queuehead++;
+        }
+        w->queue.setsize(0);
+        w->queuehead = 0;
+        SDL_UnlockMutex(w->queuelock);
+
+        // steal the back half of the newest run another worker has left, but only tasks newer than any this worker has done
+        lightmaptaskrange stolen = { 0, 0 };
+        loopi(numworkers-1)
+        {
+            lightmapworker *v = lightmapworkers[(w->index + 1 + i) % numworkers];
+            SDL_LockMutex(v->queuelock);
+            for(int j = v->queue.length()-1; j >= v->queuehead; j--)
+            {
+                lightmaptaskrange &r = v->queue[j];
+                if(r.start >= r.end) continue;
+                int mid = max(r.start + (r.end - r.start)/2, w->lasttask + 1);
+                if(mid < r.end)
+                {
+                    stolen.start = mid;
+                    stolen.end = r.end;
+                    r.end = mid;
+                }
+                break;
+            }
+            SDL_UnlockMutex(v->queuelock);
+            if(stolen.start < stolen.end) break;
+        }
+        if(stolen.start >= stolen.end) return -1;
+
+        // newer runs may have been queued for this worker meanwhile, so keep its queue in order
+        SDL_LockMutex(w->queuelock);
+        int pos = w->queuehead;
+        while(pos < w->queue.length() && w->queue[pos].start < stolen.start) pos++;
+        w->queue.insert(pos, stolen);
+        SDL_UnlockMutex(w->queuelock);
+    }
+}
+
 int lightmapworker::work(void *data)
 {
     lightmapworker *w = (lightmapworker *)data;
     SDL_LockMutex(tasklock);
+    // the other workers may still be starting up until the first tasks are queued
+    while(!taskgeneration && !w->doneworking) SDL_CondWait(fullcond, tasklock);
     while(!w->doneworking)
     {
-        if(allocidx < lightmaptasks[0].length())
+        uint generation = taskgeneration;
+        SDL_UnlockMutex(tasklock);
+        int task = taketask(w);
+        if(task >= 0)
         {
-            lightmaptask &t = lightmaptasks[0][allocidx++];
+            lightmaptask &t = LIGHTMAPTASK(task);
             t.worker = w;
-            SDL_UnlockMutex(tasklock);
+            w->lasttask = task;
+            w->numtasks++;
             lightmapinfo *l = setupsurfaces(w, t);
             SDL_LockMutex(tasklock);
             t.lightmaps = l;
             packlightmaps(w);
         }
-        else 
+        else
         {
-            if(packidx >= lightmaptasks[0].length()) SDL_CondSignal(emptycond);   
-            SDL_CondWait(fullcond, tasklock);
+            Uint32 start = SDL_GetTicks();
+            SDL_LockMutex(tasklock);
+            if(generation == taskgeneration && !w->doneworking) SDL_CondWait(fullcond, tasklock);
+            w->idletime += SDL_GetTicks() - start;
         }
     }
     SDL_UnlockMutex(tasklock);
@@ -1492,31 +1816,37 @@ int lightmapworker::work(void *data)
 static bool processtasks(bool finish = false)
 {
     if(tasklock) SDL_LockMutex(tasklock);
-    while(finish || lightmaptasks[1].length())
+    if(queuedtasks < numtasks && lightmapping > 1)
     {
-        if(packidx >= lightmaptasks[0].length())
+        for(int i = queuedtasks; i < numtasks; i += LIGHTMAPTASKCHUNK)
         {
-            if(lightmaptasks[1].empty()) break;
-            lightmaptasks[0].setsize(0);
-            lightmaptasks[0].move(lightmaptasks[1]);
-            packidx = allocidx = 0;
-            if(fullcond) SDL_CondBroadcast(fullcond);
+            lightmapworker *w = lightmapworkers[nextqueue++ % numworkers];
+            lightmaptaskrange r = { i, min(i + LIGHTMAPTASKCHUNK, numtasks) };
+            SDL_LockMutex(w->queuelock);
+            w->queue.add(r);
+            SDL_UnlockMutex(w->queuelock);
         }
-        else if(lightmapping > 1)
+        taskgeneration++;
+        SDL_CondBroadcast(fullcond);
+    }
+    queuedtasks = numtasks;
+    // threads only need to leave room for the next run of tasks, unless finishing
+    while((lightmapping > 1 && !finish) ? numtasks + LIGHTMAPTASKCHUNK - packidx > MAXLIGHTMAPTASKS : packidx < numtasks)
+    {
+        if(lightmapping > 1)
         {
             SDL_CondWaitTimeout(emptycond, tasklock, 250);
             CHECK_PROGRESS_LOCKED({ SDL_UnlockMutex(tasklock); return false; }, SDL_UnlockMutex(tasklock), SDL_LockMutex(tasklock));
         }
-        else 
+        else
         {
-            while(allocidx < lightmaptasks[0].length())
-            {
-                lightmaptask &t = lightmaptasks[0][allocidx++];
-                t.worker = lightmapworkers[0];
-                t.lightmaps = setupsurfaces(lightmapworkers[0], t);
-                packlightmaps(lightmapworkers[0]);
-                CHECK_PROGRESS(return false);
-            }
+            lightmapworker *w = lightmapworkers[0];
+            lightmaptask &t = LIGHTMAPTASK(packidx);
+            t.worker = w;
+            w->numtasks++;
+            t.lightmaps = setupsurfaces(w, t);
+            packlightmaps(w);
+            CHECK_PROGRESS(return false);
         }
     }
     if(tasklock) SDL_UnlockMutex(tasklock);
@@ -1532,6 +1862,7 @@ static void generatelightmaps(cube *c, int cx, int cy, int cz, int size)
     loopi(8)
     {
         ivec o(i, cx, cy, cz, size);
+        if(relighting && !inlightregion(o, size)) continue;
         if(c[i].children)
             generatelightmaps(c[i].children, o.x, o.y, o.z, size >> 1);
         else if(!isempty(c[i]))
@@ -1554,7 +1885,7 @@ static void generatelightmaps(cube *c, int cx, int cy, int cz, int size)
             }
             if(usefacemask)
             {
-                lightmaptask &t = lightmaptasks[1].add();
+                lightmaptask &t = LIGHTMAPTASK(numtasks++);
                 t.o = o;
                 t.size = size;
                 t.vertused = vertused; 
@@ -1562,7 +1893,8 @@ static void generatelightmaps(cube *c, int cx, int cy, int cz, int size)
                 t.c = &c[i]; 
                 t.lightmaps = NULL;
                 t.progress = taskprogress;
-                if(lightmaptasks[1].length() >= MAXLIGHTMAPTASKS && !processtasks()) return;
+                t.worker = NULL;
+                if(numtasks - queuedtasks >= LIGHTMAPTASKCHUNK && !processtasks()) return;
             }
         }
     nextcube:;
@@ -1768,6 +2100,7 @@ void resetlightmaps(bool fullclean)
     lightmaps.shrink(0);
     compressed.clear();
     clearlightcache();
+    clearlightregions();
     if(fullclean) while(lightmapworkers.length()) delete lightmapworkers.pop();
 }
 
@@ -1783,6 +2116,11 @@ lightmapworker::lightmapworker()
     shadowraycache = newshadowraycache();
     blendmapcache = newblendmapcache();
     needspace = doneworking = false;
+    index = 0;
+    queuehead = numtasks = 0;
+    lasttask = -1;
+    idletime = stalltime = 0;
+    queuelock = NULL;
     spacecond = NULL;
     thread = NULL;
 }
@@ -1802,6 +2140,7 @@ lightmapworker::~lightmapworker()
 void lightmapworker::cleanupthread()
 {
     if(spacecond) { SDL_DestroyCond(spacecond); spacecond = NULL; }
+    if(queuelock) { SDL_DestroyMutex(queuelock); queuelock = NULL; }
     thread = NULL;
 }
 
@@ -1810,6 +2149,10 @@ void lightmapworker::reset()
     bufstart = bufused = 0;
     firstlightmap = lastlightmap = curlightmaps = NULL;
     needspace = doneworking = false;
+    queue.setsize(0);
+    queuehead = numtasks = 0;
+    lasttask = -1;
+    idletime = stalltime = 0;
     resetshadowraycache(shadowraycache);
 }
 
@@ -1817,6 +2160,8 @@ bool lightmapworker::setupthread()
 {
     if(!spacecond) spacecond = SDL_CreateCond();
     if(!spacecond) return false;
+    if(!queuelock) queuelock = SDL_CreateMutex();
+    if(!queuelock) return false;
     thread = SDL_CreateThread(work, this);
     return thread!=NULL;
 }
@@ -1839,7 +2184,12 @@ bool setlightmapquality(int quality)
     return true;
 }
 
-VARP(lightthreads, 1, 1, 16);
+VARP(lightthreads, 0, 0, MAXLIGHTTHREADS);
+
+static int numlightthreads()
+{
+    return clamp(lightthreads ? lightthreads : numcpus(), 1, MAXLIGHTTHREADS);
+}
 
 #define ALLOCLOCK(name, init) { if(lightmapping > 1) name = init(); if(!name) lightmapping = 1; }
 #define FREELOCK(name, destroy) { if(name) { destroy(name); name = NULL; } }
@@ -1848,19 +2198,22 @@ static void cleanuplocks()
 {
     FREELOCK(lightlock, SDL_DestroyMutex);
     FREELOCK(tasklock, SDL_DestroyMutex);
+    FREELOCK(packlock, SDL_DestroyMutex);
     FREELOCK(fullcond, SDL_DestroyCond);
     FREELOCK(emptycond, SDL_DestroyCond);
 }
 
 static void setupthreads()
 {
-    loopi(2) lightmaptasks[i].setsize(0);
-    packidx = allocidx = 0;
-    lightmapping = lightthreads;
+    numtasks = queuedtasks = packidx = nextqueue = 0;
+    packing = false;
+    taskgeneration = packtime = 0;
+    lightmapping = numworkers = numlightthreads();
     if(lightmapping > 1)
     {
         ALLOCLOCK(lightlock, SDL_CreateMutex);
         ALLOCLOCK(tasklock, SDL_CreateMutex);
+        ALLOCLOCK(packlock, SDL_CreateMutex);
         ALLOCLOCK(fullcond, SDL_CreateCond);
         ALLOCLOCK(emptycond, SDL_CreateCond);
     }
@@ -1869,8 +2222,10 @@ static void setupthreads()
     {
         lightmapworker *w = lightmapworkers[i];
         w->reset();
+        w->index = i;
         if(lightmapping <= 1 || w->setupthread()) continue;
         w->cleanupthread();
+        numworkers = i;
         lightmapping = i >= 1 ? max(i, 2) : 1;
         break;
     }
@@ -1913,9 +2268,10 @@ void calclight(int *quality)
     mpremip(true);
     optimizeblendmap();
     loadlayermasks();
-    if(lightthreads > 1) preloadusedmapmodels(false, true);
+    if(numlightthreads() > 1) preloadusedmapmodels(false, true);
     resetlightmaps(false);
     clearsurfaces(worldroot);
+    clearlightregions();
     taskprogress = progress = 0;
     progresstexticks = 0;
     progresslightmap = -1;
@@ -1924,10 +2280,12 @@ void calclight(int *quality)
     SDL_TimerID timer = SDL_AddTimer(250, calclighttimer, NULL);
     Uint32 start = SDL_GetTicks();
     calcnormals();
+    Uint32 normalsdone = SDL_GetTicks();
     show_calclight_progress();
     setupthreads();
     generatelightmaps(worldroot, 0, 0, 0, worldsize >> 1);
     cleanupthreads();
+    Uint32 lightingdone = SDL_GetTicks();
     clearnormals();
     Uint32 end = SDL_GetTicks();
     if(timer) SDL_RemoveTimer(timer);
@@ -1940,21 +2298,87 @@ void calclight(int *quality)
         lumels += lightmaps[i].lumels;
     }
     if(!editmode) compressed.clear();
+    Uint32 finalizedone = SDL_GetTicks();
     initlights();
+    Uint32 uploaddone = SDL_GetTicks();
     renderbackground("lighting done...");
     allchanged();
     if(calclight_canceled)
         conoutf("calclight aborted");
     else
+    {
         conoutf("generated %d lightmaps using %d%% of %d textures (%.1f seconds)",
             total,
             lightmaps.length() ? lumels * 100 / (lightmaps.length() * LM_PACKW * LM_PACKH) : 0,
             lightmaps.length(),
             (end - start) / 1000.0f);
+        uint idle = 0, stall = 0, available = max(lightingdone - normalsdone, Uint32(1))*numworkers;
+        loopi(numworkers) { idle += lightmapworkers[i]->idletime; stall += lightmapworkers[i]->stalltime; }
+        conoutf("normals %.1fs, lighting %.1fs on %d threads (%d%% busy, %d%% stalled), packing %.1fs, finalize %.1fs, upload %.1fs",
+            (normalsdone - start) / 1000.0f,
+            (lightingdone - normalsdone) / 1000.0f, numworkers,
+            int(100 - min(idle + stall, available)*100ULL/available), int(min(stall, available)*100ULL/available),
+            packtime / 1000.0f,
+            (finalizedone - end) / 1000.0f,
+            (uploaddone - finalizedone) / 1000.0f);
+    }
 }
 
 COMMAND(calclight, "i");
 
+void shadowraybench(int *numpackets)
+{
+    const vector<extentity *> &ents = entities::getents();
+    vector<const extentity *> lights;
+    loopv(ents) if(ents[i]->type==ET_LIGHT) lights.add(ents[i]);
+    if(lights.empty()) { conoutf(CON_ERROR, "no lights to trace shadow rays from"); return; }
+    int packets = *numpackets > 0 ? *numpackets : 10000, mode = RAY_SHADOW | RAY_ALPHAPOLY;
+    vector<vec> origins, rays;
+    vector<float> radii;
+    // aim packets at surfaces lit by a random light, spreading the rays of a packet over neighbouring lumels
+    for(int tries = 0; rays.length() < packets*RAYPACKETSIZE && tries < packets*16; tries++)
+    {
+        const extentity &light = *lights[rnd(lights.length())];
+        vec dir(rndscale(2)-1, rndscale(2)-1, rndscale(2)-1);
+        if(dir.iszero()) continue;
+        dir.normalize();
+        float radius = light.attr1 ? light.attr1 : worldsize, hit = raycube(light.o, dir, radius, RAY_SHADOW);
+        if(hit <= 0 || hit >= radius) continue;
+        vec target = vec(dir).mul(hit).add(light.o), s, t;
+        s.orthogonal(dir);
+        s.normalize();
+        t.cross(dir, s);
+        loopi(RAYPACKETSIZE)
+        {
+            vec ray = vec(s).mul(2*(i&1)).add(vec(t).mul(2*((i>>1)&1))).add(target).sub(light.o);
+            float mag = ray.magnitude();
+            origins.add(light.o);
+            rays.add(ray.div(mag));
+            radii.add(mag - 0.5f);
+        }
+    }
+    int n = rays.length(), mismatches = 0;
+    if(!n) { conoutf(CON_ERROR, "no lit surfaces to trace shadow rays to"); return; }
+    float *scalar = new float[n], *packet = new float[n];
+    ShadowRayCache *cache = newshadowraycache();
+    Uint32 start = SDL_GetTicks();
+    loopi(n) scalar[i] = shadowray(cache, origins[i], rays[i], radii[i], mode);
+    Uint32 mid = SDL_GetTicks();
+    resetshadowraycache(cache);
+    for(int i = 0; i < n; i += RAYPACKETSIZE) shadowrays(cache, min(n-i, RAYPACKETSIZE), &origins[i], &rays[i], &radii[i], mode, &packet[i]);
+    Uint32 end = SDL_GetTicks();
+    freeshadowraycache(cache);
+    loopi(n) if(scalar[i] != packet[i]) mismatches++;
+    delete[] scalar;
+    delete[] packet;
+    defformatstring(mismatched)(", %d mismatches", mismatches);
+    conoutf("shadowraybench: %d rays, scalar %.0f rays/sec, %d-ray packets %.0f rays/sec%s",
+        n, n*1000.0f/max(mid-start, Uint32(1)), RAYPACKETSIZE, n*1000.0f/max(end-mid, Uint32(1)),
+        mismatches ? mismatched : "");
+}
+
+COMMAND(shadowraybench, "i");
+
 VAR(patchnormals, 0, 0, 1);
 
 void patchlight(int *quality)
@@ -1967,7 +2391,7 @@ void patchlight(int *quality)
     }
     renderbackground("patching lightmaps... (esc to abort)");
     loadlayermasks();
-    if(lightthreads > 1) preloadusedmapmodels(false, true);
+    if(numlightthreads() > 1) preloadusedmapmodels(false, true);
     cleanuplightmaps();
     taskprogress = progress = 0;
     progresstexticks = 0;
@@ -2012,6 +2436,123 @@ void patchlight(int *quality)
 
 COMMAND(patchlight, "i");
 
+// frees the surfaces of cubes a changed light reaches, so that generatelightmaps lights them again
+static int releaselightmaps(cube *c, const ivec &co, int size, const ivec &bo, const ivec &bs)
+{
+    int released = 0;
+    loopoctabox(co, size, bo, bs)
+    {
+        ivec o(i, co.x, co.y, co.z, size);
+        if(c[i].children) { released += releaselightmaps(c[i].children, o, size >> 1, bo, bs); continue; }
+        if(!c[i].ext || !c[i].ext->surfaces) continue;
+        surfaceinfo *surfaces = c[i].ext->surfaces;
+        bool lit = false;
+        loopj(6)
+        {
+            surfaceinfo &surface = surfaces[j];
+            if(surface.lmid < LMID_RESERVED || !lightmaps.inrange(surface.lmid-LMID_RESERVED)) continue;
+            lit = true;
+            // small lightmaps may be shared with other surfaces through lightcompress, so leave them be
+            if(surface.w <= MAXLIGHTCOMPRESS && surface.h <= MAXLIGHTCOMPRESS) continue;
+            bool shared = false;
+            loopk(j) if(surfaces[k].lmid == surface.lmid && surfaces[k].x == surface.x && surfaces[k].y == surface.y) { shared = true; break; }
+            if(shared) continue;
+            LightMap &lm = lightmaps[surface.lmid-LMID_RESERVED];
+            lm.release(surface.x, surface.y, surface.w, surface.h);
+            if((lm.type&LM_TYPE) == LM_BUMPMAP0 && lightmaps.inrange(surface.lmid+1-LMID_RESERVED))
+                lightmaps[surface.lmid+1-LMID_RESERVED].release(surface.x, surface.y, surface.w, surface.h);
+        }
+        freesurfaces(c[i]);
+        freenormals(c[i]);
+        if(lit) released++;
+    }
+    return released;
+}
+
+// uploads the relit lightmaps and rebuilds the geometry that refers to them
+static void updaterelit(cube *c, const ivec &co, int size, const ivec &bo, const ivec &bs)
+{
+    loopoctabox(co, size, bo, bs)
+    {
+        ivec o(i, co.x, co.y, co.z, size);
+        cubeext *ext = c[i].ext;
+        if(c[i].children) updaterelit(c[i].children, o, size >> 1, bo, bs);
+        else if(ext && ext->surfaces && ext->surfaces != brightsurfaces)
+        {
+            loopj(6) if(lightmaps.inrange(ext->surfaces[j].lmid-LMID_RESERVED)) updatelightmap(ext->surfaces[j]);
+        }
+        if(ext && ext->va)
+        {
+            int hasmerges = ext->va->hasmerges;
+            destroyva(ext->va);
+            ext->va = NULL;
+            if(hasmerges) invalidatemerges(c[i], true);
+        }
+    }
+}
+
+void relight(int *quality)
+{
+    if(noedit(true)) return;
+    if(!setlightmapquality(*quality))
+    {
+        conoutf(CON_ERROR, "valid range for relight quality is -1..1");
+        return;
+    }
+    if(relightall)
+    {
+        conoutf("a changed light has no radius, recalculating all lightmaps");
+        calclight(quality);
+        return;
+    }
+    if(lightregions.empty())
+    {
+        conoutf("no lights changed since the lightmaps were calculated");
+        return;
+    }
+    renderbackground("relighting changed lights... (esc to abort)");
+    loadlayermasks();
+    if(numlightthreads() > 1) preloadusedmapmodels(false, true);
+    taskprogress = progress = 0;
+    progresstexticks = 0;
+    progresslightmap = -1;
+    loopv(lightmaps) if((lightmaps[i].type&LM_TYPE) != LM_BUMPMAP1) progresslightmap = i;
+    int numlightmaps = lightmaps.length();
+    calclight_canceled = false;
+    check_calclight_progress = false;
+    SDL_TimerID timer = SDL_AddTimer(250, calclighttimer, NULL);
+    if(patchnormals) renderprogress(0, "computing normals...");
+    Uint32 start = SDL_GetTicks();
+    alignlightregions();
+    int released = 0;
+    loopv(lightregions) released += releaselightmaps(worldroot, ivec(0, 0, 0), worldsize >> 1, lightregions[i].o, lightregions[i].s);
+    if(patchnormals) calcnormals();
+    show_calclight_progress();
+    setupthreads();
+    relighting = true;
+    generatelightmaps(worldroot, 0, 0, 0, worldsize >> 1);
+    relighting = false;
+    int relit = numtasks;
+    cleanupthreads();
+    if(patchnormals) clearnormals();
+    Uint32 end = SDL_GetTicks();
+    if(timer) SDL_RemoveTimer(timer);
+    renderbackground("lighting done...");
+    loopv(lightregions) updaterelit(worldroot, ivec(0, 0, 0), worldsize >> 1, lightregions[i].o, lightregions[i].s);
+    commitchanges(true);
+    if(calclight_canceled)
+        conoutf("relight aborted");
+    else
+    {
+        conoutf("relit %d cubes (%d previously lit) in %d regions, adding %d textures (%.1f seconds)",
+            relit, released, lightregions.length(), lightmaps.length() - numlightmaps,
+            (end - start) / 1000.0f);
+        clearlightregions();
+    }
+}
+
+COMMAND(relight, "i");
+
 void clearlightmaps()
 {
     if(noedit(true)) return;
@@ -39,10 +39,16 @@ enum
     LM_FLAGS = 0xF0 
 };
 
+struct LightMapRect
+{
+    ushort x, y, w, h;
+};
+
 struct LightMap
 {
     int type, bpp, tex, offsetx, offsety;
     PackNode packroot;
+    vector<LightMapRect> freerects;
     uint lightmaps, lumels;
     int unlitx, unlity; 
     uchar *data;
@@ -63,10 +69,13 @@ struct LightMap
     {
         packroot.clear();
         packroot.available = 0;
+        freerects.setsize(0);
     }
 
     void copy(ushort tx, ushort ty, uchar *src, ushort tw, ushort th);
+    bool reuse(ushort &tx, ushort &ty, ushort tw, ushort th);
     bool insert(ushort &tx, ushort &ty, uchar *src, ushort tw, ushort th);
+    void release(ushort tx, ushort ty, ushort tw, ushort th);
 };
 
 extern vector<LightMap> lightmaps;
@@ -91,6 +100,7 @@ extern bvec ambientcolor, skylightcolor;
 extern void clearlights();
 extern void initlights();
 extern void clearlightcache(int e = -1);
+extern void changedlight(const extentity &e);
 extern void resetlightmaps(bool fullclean = true);
 extern void newsurfaces(cube &c, const surfaceinfo *surfs, int numsurfs);
 extern void freesurfaces(cube &c);
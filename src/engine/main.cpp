@@ -1068,7 +1068,7 @@ int main(int argc, char **argv)
     }
 
     logoutf("init: net");
-    if(enet_initialize()<0) fatal("Unable to initialise network module");
+    if(initnetwork()<0) fatal("Unable to initialise network module");
     atexit(enet_deinitialize);
     enet_time_set(0);
 
@@ -1,6 +1,16 @@
 #include "cube.h"
 #include <signal.h>
 #include <enet/time.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+#ifdef WIN32
+#define inprogress() (WSAGetLastError() == WSAEWOULDBLOCK)
+#else
+#include <errno.h>
+#include <sys/resource.h>
+#define inprogress() (errno == EINPROGRESS)
+#endif
 
 #define INPUT_LIMIT 4096
 #define OUTPUT_LIMIT (64*1024)
@@ -14,6 +24,13 @@
 #define PING_RETRY 5
 #define KEEPALIVE_TIME (65*60*1000)
 #define SERVER_LIMIT (10*1024)
+#define EVENT_LIMIT 256
+#define ACCEPT_LIMIT 64
+#define SWEEP_TIME 1000
+#define CHECK_TIME 250
+#define PING_LIMIT 512
+#define CHANGE_LIMIT 4096
+#define DELTA_WINDOW 64
 
 FILE *logfile = NULL;
 
@@ -44,17 +61,80 @@ struct baninfo
 {
     enet_uint32 ip, mask;
 };
-vector<baninfo> bans, servbans, gbans;
+
+// bans are indexed in a binary trie over the address bits, so a lookup walks at most 32 nodes however many there are
+// masks with holes in them ("1.*.3") cannot be expressed as a prefix and are checked one by one instead
+struct banlist
+{
+    struct node
+    {
+        int child[2];
+        bool banned;
+    };
+
+    vector<baninfo> bans;
+    vector<baninfo> sparse;
+    vector<node> trie;
+
+    void clear()
+    {
+        bans.shrink(0);
+        sparse.shrink(0);
+        trie.shrink(0);
+    }
+
+    int newnode()
+    {
+        node &n = trie.add();
+        n.child[0] = n.child[1] = -1;
+        n.banned = false;
+        return trie.length()-1;
+    }
+
+    void add(const baninfo &ban)
+    {
+        bans.add(ban);
+        enet_uint32 ip = ENET_NET_TO_HOST_32(ban.ip), mask = ENET_NET_TO_HOST_32(ban.mask);
+        int bits = 0;
+        while(bits < 32 && mask&(0x80000000U>>bits)) bits++;
+        if(bits < 32 && mask<<bits) { sparse.add(ban); return; }
+        if(trie.empty()) newnode();
+        int cur = 0;
+        loopi(bits)
+        {
+            int bit = (ip>>(31-i))&1;
+            if(trie[cur].child[bit] < 0) { int n = newnode(); trie[cur].child[bit] = n; }
+            cur = trie[cur].child[bit];
+        }
+        trie[cur].banned = true;
+    }
+
+    bool check(enet_uint32 host)
+    {
+        if(trie.length())
+        {
+            enet_uint32 ip = ENET_NET_TO_HOST_32(host);
+            for(int cur = 0, i = 0;; i++)
+            {
+                if(trie[cur].banned) return true;
+                if(i >= 32 || (cur = trie[cur].child[(ip>>(31-i))&1]) < 0) break;
+            }
+        }
+        loopv(sparse) if((host & sparse[i].mask) == sparse[i].ip) return true;
+        return false;
+    }
+};
+banlist bans, servbans, gbans;
 
 void clearbans()
 {
-    bans.shrink(0);
-    servbans.shrink(0);
-    gbans.shrink(0);
+    bans.clear();
+    servbans.clear();
+    gbans.clear();
 }
 COMMAND(clearbans, "");
 
-void addban(vector<baninfo> &bans, const char *name)
+void addban(banlist &bans, const char *name)
 {
     union { uchar b[sizeof(enet_uint32)]; enet_uint32 i; } ip, mask;
     ip.i = 0;
@@ -68,9 +148,10 @@ void addban(vector<baninfo> &bans, const char *name)
         name = end;
         while(*name && *name++ != '.');
     }
-    baninfo &ban = bans.add();
+    baninfo ban;
     ban.ip = ip.i;
     ban.mask = mask.i;
+    bans.add(ban);
 }
 ICOMMAND(ban, "s", (char *name), addban(bans, name));
 ICOMMAND(servban, "s", (char *name), addban(servbans, name));
@@ -92,10 +173,9 @@ char *printban(const baninfo &ban, char *buf)
     return buf;
 }
 
-bool checkban(vector<baninfo> &bans, enet_uint32 host)
+bool checkban(banlist &bans, enet_uint32 host)
 {
-    loopv(bans) if((host & bans[i].mask) == bans[i].ip) return true;
-    return false;
+    return bans.check(host);
 }
 
 struct authreq
@@ -105,22 +185,41 @@ struct authreq
     void *answer;
 };
 
+struct client;
+
 struct gameserver
 {
     ENetAddress address;
     string ip;
     int port, numpings;
     enet_uint32 lastping, lastpong;
+    client *owner;
 };
 vector<gameserver *> gameservers;
 
+// game servers by the address they answer pings from
+struct serverkey
+{
+    enet_uint32 host;
+    enet_uint16 port;
+
+    serverkey() {}
+    serverkey(const ENetAddress &address) : host(address.host), port(address.port) {}
+};
+
+static inline uint hthash(const serverkey &k) { return k.host ^ (uint(k.port)*0x9E3779B1U); }
+static inline bool htcmp(const serverkey &x, const serverkey &y) { return x.host == y.host && x.port == y.port; }
+
+hashtable<serverkey, gameserver *> serveraddrs(1<<14);
+
 struct messagebuf
 {
     vector<messagebuf *> &owner;
     vector<char> buf;
     int refs;
+    int since, version;
 
-    messagebuf(vector<messagebuf *> &owner) : owner(owner), refs(0) {}
+    messagebuf(vector<messagebuf *> &owner) : owner(owner), refs(0), since(-1), version(-1) {}
 
     const char *getbuf() { return buf.getbuf(); }
     int length() { return buf.length(); }
@@ -145,6 +244,20 @@ struct messagebuf
 vector<messagebuf *> gameserverlists, gbanlists;
 bool updateserverlist = true;
 
+// every change to the listed servers bumps the list version and is logged, so browsers that remember the version they
+// last saw can ask for only what changed since; replies are cached per base version and shared by everyone asking
+struct serverchange
+{
+    int version;
+    bool added;
+    enet_uint32 host;
+    int port;
+};
+vector<serverchange> serverchanges;
+vector<messagebuf *> deltalists;
+uint listepoch = 0;
+int listversion = 0;
+
 struct client
 {
     ENetAddress address;
@@ -159,13 +272,114 @@ struct client
     vector<authreq> authreqs;
     bool shouldpurge;
     bool registeredserver;
+    int index, polling;
+    gameserver *server;
 
-    client() : message(NULL), inputpos(0), outputpos(0), servport(-1), lastauth(0), shouldpurge(false), registeredserver(false) {}
+    client() : message(NULL), inputpos(0), outputpos(0), servport(-1), lastauth(0), shouldpurge(false), registeredserver(false), index(-1), polling(0), server(NULL) {}
 };
-vector<client *> clients;
+vector<client *> clients, purgedclients;
+hashtable<int, int> hostclients;
 
 ENetSocket serversocket = ENET_SOCKET_NULL;
 
+// readiness notification: epoll where available, otherwise select over everything registered
+enum { POLL_READ = 1<<0, POLL_WRITE = 1<<1 };
+
+struct pollevent
+{
+    void *data;
+    int events;
+};
+
+#ifdef __linux__
+int pollfd = -1;
+
+void pollinit()
+{
+    pollfd = epoll_create(CLIENT_LIMIT);
+    if(pollfd < 0) fatal("failed to create epoll instance");
+}
+
+static void pollctl(int op, ENetSocket sock, void *data, int events)
+{
+    epoll_event ev;
+    ev.events = (events&POLL_READ ? EPOLLIN : 0) | (events&POLL_WRITE ? EPOLLOUT : 0);
+    ev.data.ptr = data;
+    epoll_ctl(pollfd, op, sock, &ev);
+}
+
+void polladd(ENetSocket sock, void *data, int events) { pollctl(EPOLL_CTL_ADD, sock, data, events); }
+void pollmodify(ENetSocket sock, void *data, int events) { pollctl(EPOLL_CTL_MOD, sock, data, events); }
+void pollremove(ENetSocket sock) { pollctl(EPOLL_CTL_DEL, sock, NULL, 0); }
+
+int pollwait(pollevent *events, int maxevents, int timeout)
+{
+    epoll_event ev[EVENT_LIMIT];
+    int n = epoll_wait(pollfd, ev, min(maxevents, int(EVENT_LIMIT)), timeout);
+    loopi(n)
+    {
+        events[i].data = ev[i].data.ptr;
+        events[i].events = (ev[i].events&(EPOLLIN|EPOLLHUP|EPOLLERR) ? POLL_READ : 0) | (ev[i].events&EPOLLOUT ? POLL_WRITE : 0);
+    }
+    return max(n, 0);
+}
+#else
+struct pollentry
+{
+    ENetSocket sock;
+    void *data;
+    int events;
+};
+vector<pollentry> pollentries;
+
+void pollinit() {}
+
+void polladd(ENetSocket sock, void *data, int events)
+{
+    pollentry &e = pollentries.add();
+    e.sock = sock;
+    e.data = data;
+    e.events = events;
+}
+
+void pollmodify(ENetSocket sock, void *data, int events)
+{
+    loopv(pollentries) if(pollentries[i].sock == sock) { pollentries[i].data = data; pollentries[i].events = events; break; }
+}
+
+void pollremove(ENetSocket sock)
+{
+    loopv(pollentries) if(pollentries[i].sock == sock) { pollentries.removeunordered(i); break; }
+}
+
+int pollwait(pollevent *events, int maxevents, int timeout)
+{
+    ENetSocketSet readset, writeset;
+    ENetSocket maxsock = ENET_SOCKET_NULL;
+    ENET_SOCKETSET_EMPTY(readset);
+    ENET_SOCKETSET_EMPTY(writeset);
+    loopv(pollentries)
+    {
+        pollentry &e = pollentries[i];
+        if(e.events&POLL_READ) ENET_SOCKETSET_ADD(readset, e.sock);
+        if(e.events&POLL_WRITE) ENET_SOCKETSET_ADD(writeset, e.sock);
+        if(maxsock == ENET_SOCKET_NULL || e.sock > maxsock) maxsock = e.sock;
+    }
+    if(maxsock == ENET_SOCKET_NULL || enet_socketset_select(maxsock, &readset, &writeset, timeout)<=0) return 0;
+    int n = 0;
+    loopv(pollentries)
+    {
+        pollentry &e = pollentries[i];
+        int ready = (ENET_SOCKETSET_CHECK(readset, e.sock) ? POLL_READ : 0) | (ENET_SOCKETSET_CHECK(writeset, e.sock) ? POLL_WRITE : 0);
+        if(!ready) continue;
+        events[n].data = e.data;
+        events[n].events = ready;
+        if(++n >= maxevents) break;
+    }
+    return n;
+}
+#endif
+
 time_t starttime;
 enet_uint32 servtime = 0;
 
@@ -201,19 +415,50 @@ void conoutf(int type, const char *fmt, ...)
     va_end(args);
 }
 
-void purgeclient(int n)
+// purged clients are kept until the end of the loop, as later events in the same batch may still refer to them
+void purgeclient(client &c)
 {
-    client &c = *clients[n];
-    if(c.message) c.message->purge();
+    if(c.socket == ENET_SOCKET_NULL) return;
+    if(c.message) { c.message->purge(); c.message = NULL; }
+    if(c.server && c.server->owner == &c) c.server->owner = NULL;
+    c.server = NULL;
+    int *dups = hostclients.access(int(c.address.host));
+    if(dups && --*dups <= 0) hostclients.remove(int(c.address.host));
+    pollremove(c.socket);
     enet_socket_destroy(c.socket);
-    delete clients[n];
-    clients.remove(n);
+    c.socket = ENET_SOCKET_NULL;
+    clients.removeunordered(c.index);
+    if(clients.inrange(c.index)) clients[c.index]->index = c.index;
+    purgedclients.add(&c);
+}
+
+void deletepurgedclients()
+{
+    purgedclients.deletecontents();
+}
+
+// clients either wait for input or drain their output, never both
+void updateclient(client &c)
+{
+    if(c.socket == ENET_SOCKET_NULL) return;
+    int polling = c.message || c.output.length() ? POLL_WRITE : POLL_READ;
+    if(polling == c.polling) return;
+    c.polling = polling;
+    pollmodify(c.socket, &c, polling);
+}
+
+void sendmessage(client &c, messagebuf *m)
+{
+    c.message = m;
+    c.message->refs++;
+    updateclient(c);
 }
 
 void output(client &c, const char *msg, int len = 0)
 {
     if(!len) len = strlen(msg);
     c.output.put(msg, len);
+    updateclient(c);
 }
 
 void outputf(client &c, const char *fmt, ...)
@@ -261,32 +506,98 @@ void setupserver(int port, const char *ip = NULL)
     if(!setuppingsocket(&address))
         fatal("failed to create ping socket");
 
+    pollinit();
+    polladd(serversocket, &serversocket, POLL_READ);
+    polladd(pingsocket, &pingsocket, POLL_READ);
+
     enet_time_set(0);
 
     starttime = time(NULL);
+    listepoch = uint(starttime);
     char *ct = ctime(&starttime);
     if(strchr(ct, '\n')) *strchr(ct, '\n') = '\0';
     conoutf("*** Starting master server on %s %d at %s ***", ip ? ip : "localhost", port, ct);
 }
 
-void genserverlist()
+void putserverlist(messagebuf &l)
 {
-    if(!updateserverlist) return;
-    while(gameserverlists.length() && gameserverlists.last()->refs<=0)
-        delete gameserverlists.pop();
-    messagebuf *l = new messagebuf(gameserverlists);
     loopv(gameservers)
     {
         gameserver &s = *gameservers[i];
         if(!s.lastpong) continue;
         defformatstring(cmd)("addserver %s %d\n", s.ip, s.port);
-        l->buf.put(cmd, strlen(cmd));
+        l.buf.put(cmd, strlen(cmd));
     }
+}
+
+void genserverlist()
+{
+    if(!updateserverlist) return;
+    while(gameserverlists.length() && gameserverlists.last()->refs<=0)
+        delete gameserverlists.pop();
+    messagebuf *l = new messagebuf(gameserverlists);
+    putserverlist(*l);
     l->buf.add('\0');
     gameserverlists.add(l);
     updateserverlist = false;
 }
 
+void logserverchange(const gameserver &s, bool added)
+{
+    if(serverchanges.length() >= CHANGE_LIMIT) serverchanges.remove(0, CHANGE_LIMIT/4);
+    serverchange &c = serverchanges.add();
+    c.version = ++listversion;
+    c.added = added;
+    c.host = s.address.host;
+    c.port = s.port;
+    updateserverlist = true;
+}
+
+// a full list, led by clearservers, goes to anyone whose version is from another run or more than DELTA_WINDOW changes
+// old, which also bounds how many deltas against the current version can be cached at once
+messagebuf *genserverdelta(uint epoch, int since)
+{
+    if(epoch != listepoch || since < 0 || since > listversion || since < listversion - DELTA_WINDOW || (since < listversion && since < serverchanges[0].version-1)) since = -1;
+    loopv(deltalists)
+    {
+        messagebuf *l = deltalists[i];
+        if(l->since == since && l->version == listversion) return l;
+    }
+    loopvrev(deltalists) if(deltalists[i]->refs <= 0 && deltalists[i]->version != listversion) delete deltalists.remove(i);
+
+    messagebuf *l = new messagebuf(deltalists);
+    l->since = since;
+    l->version = listversion;
+    if(since < 0)
+    {
+        const char *header = "clearservers\n";
+        l->buf.put(header, strlen(header));
+        putserverlist(*l);
+    }
+    else
+    {
+        int first = serverchanges.length();
+        while(first > 0 && serverchanges[first-1].version > since) first--;
+        for(int i = first; i < serverchanges.length(); i++)
+        {
+            serverchange &c = serverchanges[i];
+            ENetAddress address;
+            address.host = c.host;
+            address.port = c.port;
+            string ip;
+            if(enet_address_get_host_ip(&address, ip, sizeof(ip)) < 0) continue;
+            defformatstring(cmd)("%s %s %d\n", c.added ? "addserver" : "delserver", ip, c.port);
+            l->buf.put(cmd, strlen(cmd));
+        }
+    }
+    // the version comes last, so it is only taken once everything before it has been applied
+    defformatstring(footer)("serverlistversion %u %d\n", listepoch, listversion);
+    l->buf.put(footer, strlen(footer));
+    l->buf.add('\0');
+    deltalists.add(l);
+    return l;
+}
+
 void gengbanlist()
 {
     messagebuf *l = new messagebuf(gbanlists);
@@ -294,9 +605,9 @@ void gengbanlist()
     l->buf.put(header, strlen(header));
     string cmd = "addgban ";
     int cmdlen = strlen(cmd);
-    loopv(gbans)
+    loopv(gbans.bans)
     {
-        baninfo &b = gbans[i];
+        baninfo &b = gbans.bans[i];
         l->buf.put(cmd, printban(b, &cmd[cmdlen]) - cmd); 
         l->buf.add('\n');
     }
@@ -316,27 +627,26 @@ void gengbanlist()
     loopv(clients)
     {
         client &c = *clients[i];
-        if(c.servport >= 0 && !c.message) 
-        {
-            c.message = l;
-            c.message->refs++;
-        }
+        if(c.servport >= 0 && !c.message) sendmessage(c, l);
     }
 }
 
 void addgameserver(client &c)
 {
-    if(gameservers.length() >= SERVER_LIMIT) return;
-    loopv(gameservers)
+    ENetAddress pingaddr;
+    pingaddr.host = c.address.host;
+    pingaddr.port = c.servport+1;
+    gameserver **existing = serveraddrs.access(serverkey(pingaddr));
+    if(existing)
     {
-        gameserver &s = *gameservers[i];
-        if(s.address.host == c.address.host && s.port == c.servport)
-        {
-            s.lastping = 0;
-            s.numpings = 0;
-            return;
-        }
+        gameserver &s = **existing;
+        s.lastping = 0;
+        s.numpings = 0;
+        s.owner = &c;
+        c.server = &s;
+        return;
     }
+    if(gameservers.length() >= SERVER_LIMIT) return;
     string hostname;
     if(enet_address_get_host_ip(&c.address, hostname, sizeof(hostname)) < 0)
     {
@@ -350,17 +660,23 @@ void addgameserver(client &c)
     s.port = c.servport;
     s.numpings = 0;
     s.lastping = s.lastpong = 0;
+    s.owner = &c;
+    c.server = &s;
+    serveraddrs[serverkey(s.address)] = &s;
+}
+
+void removegameserver(int i)
+{
+    gameserver *s = gameservers.removeunordered(i);
+    serveraddrs.remove(serverkey(s->address));
+    if(s->owner && s->owner->server == s) s->owner->server = NULL;
+    if(s->lastpong) logserverchange(*s, false);
+    delete s;
 }
 
 client *findclient(gameserver &s)
 {
-    loopv(clients)
-    {
-        client &c = *clients[i];
-        if(s.address.host == c.address.host && s.port == c.servport)
-            return &c;
-    }
-    return NULL;
+    return s.owner;
 }
 
 void servermessage(gameserver &s, const char *msg)
@@ -371,90 +687,101 @@ void servermessage(gameserver &s, const char *msg)
 
 void checkserverpongs()
 {
-    ENetBuffer buf;
-    ENetAddress addr;
-    static uchar pong[MAXTRANS];
+    static ENetBuffer bufs[ENET_HOST_BATCH_SIZE];
+    static ENetAddress addrs[ENET_HOST_BATCH_SIZE];
+    static uchar pongs[ENET_HOST_BATCH_SIZE][MAXTRANS];
     for(;;)
     {
-        buf.data = pong;
-        buf.dataLength = sizeof(pong);
-        int len = enet_socket_receive(pingsocket, &addr, &buf, 1);
-        if(len <= 0) break;
-        loopv(gameservers)
+        loopi(ENET_HOST_BATCH_SIZE)
+        {
+            bufs[i].data = pongs[i];
+            bufs[i].dataLength = sizeof(pongs[i]);
+        }
+        int received = enet_socket_receive_batch(pingsocket, addrs, bufs, ENET_HOST_BATCH_SIZE);
+        loopk(received)
         {
-            gameserver &s = *gameservers[i];
-            if(s.address.host == addr.host && s.address.port == addr.port)
+            gameserver **found = serveraddrs.access(serverkey(addrs[k]));
+            if(!found) continue;
+            gameserver &s = **found;
+            if(s.lastping && (!s.lastpong || ENET_TIME_GREATER(s.lastping, s.lastpong)))
             {
-                if(s.lastping && (!s.lastpong || ENET_TIME_GREATER(s.lastping, s.lastpong)))
+                client *c = findclient(s);
+                if(c)
                 {
-                    client *c = findclient(s);
-                    if(c)
-                    {
-                        c->registeredserver = true;
-                        outputf(*c, "succreg\n");
-                        if(!c->message && gbanlists.length())
-                        {
-                            c->message = gbanlists.last();
-                            c->message->refs++;
-                        }
-                    }
+                    c->registeredserver = true;
+                    outputf(*c, "succreg\n");
+                    if(!c->message && gbanlists.length()) sendmessage(*c, gbanlists.last());
                 }
-                if(!s.lastpong) updateserverlist = true;
-                s.lastpong = servtime ? servtime : 1;
-                break;
             }
+            if(!s.lastpong) logserverchange(s, true);
+            s.lastpong = servtime ? servtime : 1;
         }
+        if(received < ENET_HOST_BATCH_SIZE) break;
     }
 }
 
 void bangameservers()
 {
-    loopvrev(gameservers) if(checkban(servbans, gameservers[i]->address.host))
-    {
-        delete gameservers.remove(i);
-        updateserverlist = true;
-    }
+    loopvrev(gameservers) if(checkban(servbans, gameservers[i]->address.host)) removegameserver(i);
+}
+
+static ENetAddress pingaddrs[ENET_HOST_BATCH_SIZE];
+static ENetBuffer pingbufs[ENET_HOST_BATCH_SIZE];
+static int numpingaddrs = 0;
+
+static void flushpings()
+{
+    if(numpingaddrs > 0) enet_socket_send_batch(pingsocket, pingaddrs, pingbufs, numpingaddrs);
+    numpingaddrs = 0;
+}
+
+static void queueping(const ENetAddress &address)
+{
+    static const uchar ping[] = { 1 };
+    pingaddrs[numpingaddrs] = address;
+    pingbufs[numpingaddrs].data = (void *)ping;
+    pingbufs[numpingaddrs].dataLength = sizeof(ping);
+    if(++numpingaddrs >= ENET_HOST_BATCH_SIZE) flushpings();
 }
 
 void checkgameservers()
 {
-    ENetBuffer buf;
+    static enet_uint32 lastcheck = 0;
+    if(lastcheck && ENET_TIME_DIFFERENCE(servtime, lastcheck) < CHECK_TIME) return;
+    lastcheck = servtime;
+    // pings go out in bounded rounds so the pongs of thousands of fresh registrations don't overrun the socket buffer
+    int pings = 0;
     loopv(gameservers)
     {
         gameserver &s = *gameservers[i];
         if(s.lastping && s.lastpong && ENET_TIME_LESS_EQUAL(s.lastping, s.lastpong))
         {
-            if(ENET_TIME_DIFFERENCE(servtime, s.lastpong) > KEEPALIVE_TIME)
-            {
-                delete gameservers.remove(i--);
-                updateserverlist = true;
-            }
+            if(ENET_TIME_DIFFERENCE(servtime, s.lastpong) > KEEPALIVE_TIME) removegameserver(i--);
         }
         else if(!s.lastping || ENET_TIME_DIFFERENCE(servtime, s.lastping) > PING_TIME)
         {
             if(s.numpings >= PING_RETRY)
             {
                 servermessage(s, "failreg failed pinging server\n");
-                delete gameservers.remove(i--);
-                updateserverlist = true;
+                removegameserver(i--);
             }
-            else
+            else if(pings < PING_LIMIT)
             {
-                static const uchar ping[] = { 1 };
-                buf.data = (void *)ping;
-                buf.dataLength = sizeof(ping);
                 s.numpings++;
                 s.lastping = servtime ? servtime : 1;
-                enet_socket_send(pingsocket, &s.address, &buf, 1);
+                queueping(s.address);
+                pings++;
             }
         }
     }
+    flushpings();
 }
 
 void messagebuf::purge()
 {
     refs = max(refs - 1, 0);
-    if(refs<=0 && owner.last()!=this)
+    // deltas against the current version stay cached until the list changes
+    if(refs<=0 && owner.last()!=this && (version < 0 || version != listversion))
     {
         owner.removeobj(this);
         delete this;
@@ -556,18 +883,26 @@ bool checkclientinput(client &c)
         *end++ = '\0';
         c.lastinput = servtime;
 
-        int port;
-        uint id;
+        int port, since;
+        uint id, epoch;
         string user, val;
         if(!strncmp(c.input, "list", 4) && (!c.input[4] || isspace(c.input[4])))
         {
             genserverlist();
             if(gameserverlists.empty() || c.message) return false;
-            c.message = gameserverlists.last();
-            c.message->refs++;
             c.output.setsize(0);
             c.outputpos = 0;
             c.shouldpurge = true;
+            sendmessage(c, gameserverlists.last());
+            return true;
+        }
+        else if(sscanf(c.input, "listdelta %u %d", &epoch, &since) == 2)
+        {
+            if(c.message) return false;
+            c.output.setsize(0);
+            c.outputpos = 0;
+            c.shouldpurge = true;
+            sendmessage(c, genserverdelta(epoch, since));
             return true;
         }
         else if(sscanf(c.input, "regserv %d", &port) == 1)
@@ -596,104 +931,304 @@ bool checkclientinput(client &c)
     return c.inputpos<(int)sizeof(c.input);
 }
 
-ENetSocketSet readset, writeset;
-
-void checkclients()
+void acceptclients()
 {
-    ENetSocketSet readset, writeset;
-    ENetSocket maxsock = max(serversocket, pingsocket);
-    ENET_SOCKETSET_EMPTY(readset);
-    ENET_SOCKETSET_EMPTY(writeset);
-    ENET_SOCKETSET_ADD(readset, serversocket);
-    ENET_SOCKETSET_ADD(readset, pingsocket);
-    loopv(clients)
+    loopi(ACCEPT_LIMIT)
     {
-        client &c = *clients[i];
-        if(c.message || c.output.length()) ENET_SOCKETSET_ADD(writeset, c.socket);
-        else ENET_SOCKETSET_ADD(readset, c.socket);
-        maxsock = max(maxsock, c.socket);
+        ENetAddress address;
+        ENetSocket clientsocket = enet_socket_accept(serversocket, &address);
+        if(clientsocket==ENET_SOCKET_NULL) break;
+        if(clients.length()>=CLIENT_LIMIT || checkban(bans, address.host) || enet_socket_set_option(clientsocket, ENET_SOCKOPT_NONBLOCK, 1)<0)
+        {
+            enet_socket_destroy(clientsocket);
+            continue;
+        }
+        if(hostclients.access(int(address.host), 0) >= DUP_LIMIT)
+        {
+            client *oldest = NULL;
+            loopv(clients) if(clients[i]->address.host == address.host && (!oldest || clients[i]->connecttime < oldest->connecttime)) oldest = clients[i];
+            if(oldest) purgeclient(*oldest);
+        }
+        hostclients.access(int(address.host), 0)++;
+
+        client *c = new client;
+        c->address = address;
+        c->socket = clientsocket;
+        c->connecttime = servtime;
+        c->lastinput = servtime;
+        c->index = clients.length();
+        c->polling = POLL_READ;
+        clients.add(c);
+        polladd(c->socket, c, c->polling);
     }
-    if(enet_socketset_select(maxsock, &readset, &writeset, 1000)<=0) return;
+}
 
-    if(ENET_SOCKETSET_CHECK(readset, pingsocket)) checkserverpongs();
-    if(ENET_SOCKETSET_CHECK(readset, serversocket))
+void checkclient(client &c, int events)
+{
+    if(events&POLL_WRITE && (c.message || c.output.length()))
     {
-        ENetAddress address;
-        ENetSocket clientsocket = enet_socket_accept(serversocket, &address);
-        if(clients.length()>=CLIENT_LIMIT || checkban(bans, address.host)) enet_socket_destroy(clientsocket);
-        else if(clientsocket!=ENET_SOCKET_NULL)
+        const char *data = c.output.length() ? c.output.getbuf() : c.message->getbuf();
+        int len = c.output.length() ? c.output.length() : c.message->length();
+        ENetBuffer buf;
+        buf.data = (void *)&data[c.outputpos];
+        buf.dataLength = len-c.outputpos;
+        int res = enet_socket_send(c.socket, NULL, &buf, 1);
+        if(res<0) { purgeclient(c); return; }
+        c.outputpos += res;
+        if(c.outputpos>=len)
         {
-            int dups = 0, oldest = -1;
-            loopv(clients) if(clients[i]->address.host == address.host)
+            if(c.output.length()) c.output.setsize(0);
+            else
             {
-                dups++;
-                if(oldest<0 || clients[i]->connecttime < clients[oldest]->connecttime) oldest = i;
+                c.message->purge();
+                c.message = NULL;
             }
-            if(dups >= DUP_LIMIT) purgeclient(oldest);
-
-            client *c = new client;
-            c->address = address;
-            c->socket = clientsocket;
-            c->connecttime = servtime;
-            c->lastinput = servtime;
-            clients.add(c);
+            c.outputpos = 0;
+            if(!c.message && c.output.empty() && c.shouldpurge) { purgeclient(c); return; }
         }
     }
+    else if(events&POLL_READ)
+    {
+        ENetBuffer buf;
+        buf.data = &c.input[c.inputpos];
+        buf.dataLength = sizeof(c.input) - c.inputpos;
+        int res = enet_socket_receive(c.socket, NULL, &buf, 1);
+        if(res<=0) { purgeclient(c); return; }
+        c.inputpos += res;
+        c.input[min(c.inputpos, (int)sizeof(c.input)-1)] = '\0';
+        if(!checkclientinput(c)) { purgeclient(c); return; }
+    }
+    if(c.output.length() > OUTPUT_LIMIT) { purgeclient(c); return; }
+    updateclient(c);
+}
 
-    loopv(clients)
+// idle clients time out in minutes, so they are swept for occasionally rather than on every wakeup
+void sweepclients()
+{
+    static enet_uint32 lastsweep = 0;
+    if(ENET_TIME_DIFFERENCE(servtime, lastsweep) < SWEEP_TIME) return;
+    lastsweep = servtime;
+    loopvrev(clients)
     {
         client &c = *clients[i];
-        if((c.message || c.output.length()) && ENET_SOCKETSET_CHECK(writeset, c.socket))
+        if(c.output.length() > OUTPUT_LIMIT || ENET_TIME_DIFFERENCE(servtime, c.lastinput) >= (c.registeredserver ? KEEPALIVE_TIME : CLIENT_TIME))
+            purgeclient(c);
+    }
+}
+
+void checkclients()
+{
+    static pollevent events[EVENT_LIMIT];
+    int numevents = pollwait(events, EVENT_LIMIT, CHECK_TIME);
+    servtime = enet_time_get();
+    loopi(numevents)
+    {
+        pollevent &e = events[i];
+        if(e.data == &serversocket) acceptclients();
+        else if(e.data == &pingsocket) checkserverpongs();
+        else
         {
-            const char *data = c.output.length() ? c.output.getbuf() : c.message->getbuf();
-            int len = c.output.length() ? c.output.length() : c.message->length();
-            ENetBuffer buf;
-            buf.data = (void *)&data[c.outputpos];
-            buf.dataLength = len-c.outputpos;
-            int res = enet_socket_send(c.socket, NULL, &buf, 1);
-            if(res>=0)
-            {
-                c.outputpos += res;
-                if(c.outputpos>=len)
-                {
-                    if(c.output.length()) c.output.setsize(0);
-                    else
-                    { 
-                        c.message->purge();
-                        c.message = NULL; 
-                    }
-                    c.outputpos = 0;
-                    if(!c.message && c.output.empty() && c.shouldpurge)
-                    {
-                        purgeclient(i--);
-                        continue;
-                    }
-                }
-            }
-            else { purgeclient(i--); continue; }
+            client &c = *(client *)e.data;
+            if(c.socket != ENET_SOCKET_NULL) checkclient(c, e.events);
         }
-        if(ENET_SOCKETSET_CHECK(readset, c.socket))
+    }
+    sweepclients();
+    deletepurgedclients();
+}
+
+void banclients()
+{
+    loopvrev(clients) if(checkban(bans, clients[i]->address.host)) purgeclient(*clients[i]);
+    deletepurgedclients();
+}
+
+// load generator: many fake game servers register with a master and answer its pings, then a few clients fetch the list
+struct fakeserver;
+
+struct fakesocket
+{
+    fakeserver *owner;
+    bool ping;
+};
+
+struct fakeserver
+{
+    ENetSocket tcp, udp;
+    fakesocket tcpevents, udpevents;
+    int port, inputpos;
+    bool connected, registered, done;
+    enet_uint32 regtime;
+    char input[1024];
+};
+
+static void closefake(fakeserver &f)
+{
+    if(f.tcp != ENET_SOCKET_NULL) { pollremove(f.tcp); enet_socket_destroy(f.tcp); f.tcp = ENET_SOCKET_NULL; }
+    f.done = true;
+}
+
+static void checkfake(fakesocket &s, enet_uint32 start)
+{
+    fakeserver &f = *s.owner;
+    ENetBuffer buf;
+    ENetAddress addr;
+    if(s.ping)
+    {
+        uchar ping[MAXTRANS];
+        buf.data = ping;
+        buf.dataLength = sizeof(ping);
+        while(enet_socket_receive(f.udp, &addr, &buf, 1) > 0)
         {
-            ENetBuffer buf;
-            buf.data = &c.input[c.inputpos];
-            buf.dataLength = sizeof(c.input) - c.inputpos;
-            int res = enet_socket_receive(c.socket, NULL, &buf, 1);
-            if(res>0)
-            {
-                c.inputpos += res;
-                c.input[min(c.inputpos, (int)sizeof(c.input)-1)] = '\0';
-                if(!checkclientinput(c)) { purgeclient(i--); continue; }
-            }
-            else { purgeclient(i--); continue; }
+            // just enough of a reply for the master to count it as a pong
+            buf.dataLength = 1;
+            enet_socket_send(f.udp, &addr, &buf, 1);
+            buf.dataLength = sizeof(ping);
         }
-        if(c.output.length() > OUTPUT_LIMIT) { purgeclient(i--); continue; }
-        if(ENET_TIME_DIFFERENCE(servtime, c.lastinput) >= (c.registeredserver ? KEEPALIVE_TIME : CLIENT_TIME)) { purgeclient(i--); continue; }
+        return;
+    }
+    if(f.tcp == ENET_SOCKET_NULL) return;
+    if(!f.connected)
+    {
+        int err = 0;
+#ifdef WIN32
+        int len = sizeof(err);
+#else
+        socklen_t len = sizeof(err);
+#endif
+        if(getsockopt(f.tcp, SOL_SOCKET, SO_ERROR, (char *)&err, &len) < 0 || err) { closefake(f); return; }
+        defformatstring(req)("regserv %d\n", f.port);
+        buf.data = req;
+        buf.dataLength = strlen(req);
+        int sent = enet_socket_send(f.tcp, NULL, &buf, 1);
+        if(sent < 0) { closefake(f); return; }
+        if(!sent) return;
+        f.connected = true;
+        pollmodify(f.tcp, &f.tcpevents, POLL_READ);
+        return;
     }
+    buf.data = &f.input[f.inputpos];
+    buf.dataLength = sizeof(f.input) - 1 - f.inputpos;
+    int res = enet_socket_receive(f.tcp, NULL, &buf, 1);
+    if(res <= 0) { closefake(f); return; }
+    f.inputpos += res;
+    f.input[f.inputpos] = '\0';
+    if(!f.registered && strstr(f.input, "succreg")) { f.registered = true; f.regtime = enet_time_get() - start; }
+    if(strstr(f.input, "failreg")) closefake(f);
+    char *end = strrchr(f.input, '\n');
+    if(end) { f.inputpos = &f.input[f.inputpos] - (end+1); memmove(f.input, end+1, f.inputpos+1); }
+    else if(f.inputpos >= int(sizeof(f.input)) - 1) f.inputpos = 0;
 }
 
-void banclients()
+static int fakeregorder(fakeserver **x, fakeserver **y)
 {
-    loopvrev(clients) if(checkban(bans, clients[i]->address.host)) purgeclient(i);
+    if((*x)->regtime < (*y)->regtime) return -1;
+    if((*x)->regtime > (*y)->regtime) return 1;
+    return 0;
+}
+
+static void fetchlist(const ENetAddress &master)
+{
+    enet_uint32 start = enet_time_get();
+    ENetSocket sock = enet_socket_create(ENET_SOCKET_TYPE_STREAM);
+    if(sock == ENET_SOCKET_NULL || enet_socket_connect(sock, &master) < 0) { conoutf("list: could not connect"); if(sock != ENET_SOCKET_NULL) enet_socket_destroy(sock); return; }
+    ENetBuffer buf;
+    buf.data = (void *)"list\n";
+    buf.dataLength = 5;
+    enet_socket_send(sock, NULL, &buf, 1);
+    int bytes = 0, servers = 0;
+    char data[4096];
+    for(;;)
+    {
+        buf.data = data;
+        buf.dataLength = sizeof(data);
+        int res = enet_socket_receive(sock, NULL, &buf, 1);
+        if(res <= 0) break;
+        bytes += res;
+        loopi(res) if(data[i] == '\n') servers++;
+    }
+    enet_socket_destroy(sock);
+    conoutf("list: %d servers, %d bytes in %u ms", servers, bytes, enet_time_get() - start);
+}
+
+int loadtest(int numservers, const char *host, int port, int baseport)
+{
+#ifndef WIN32
+    struct rlimit limit;
+    if(!getrlimit(RLIMIT_NOFILE, &limit) && limit.rlim_cur < limit.rlim_max)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+#endif
+    ENetAddress master;
+    if(enet_address_set_host(&master, host) < 0) fatal("failed to resolve master address: %s", host);
+    master.port = port;
+    pollinit();
+    // the master only takes DUP_LIMIT connections per address, so against a local master spread them over 127.0.0.0/8
+    bool loopback = (ENET_NET_TO_HOST_32(master.host)>>24) == 127;
+    vector<fakeserver *> fakes;
+    enet_uint32 start = enet_time_get();
+    for(int servport = baseport; fakes.length() < numservers && servport < 0xFFFF-1; servport += 2)
+    {
+        ENetAddress addr;
+        int group = fakes.length()/(DUP_LIMIT/2);
+        addr.host = loopback ? ENET_HOST_TO_NET_32(0x7F010001U + ((group/250)<<8) + group%250) : ENET_HOST_ANY;
+        addr.port = servport+1;
+        ENetSocket udp = enet_socket_create(ENET_SOCKET_TYPE_DATAGRAM);
+        if(udp == ENET_SOCKET_NULL) break;
+        if(enet_socket_bind(udp, &addr) < 0) { enet_socket_destroy(udp); continue; }
+        enet_socket_set_option(udp, ENET_SOCKOPT_NONBLOCK, 1);
+        ENetSocket tcp = enet_socket_create(ENET_SOCKET_TYPE_STREAM);
+        if(tcp == ENET_SOCKET_NULL) { enet_socket_destroy(udp); break; }
+        enet_socket_set_option(tcp, ENET_SOCKOPT_NONBLOCK, 1);
+        addr.port = 0;
+        if(loopback && enet_socket_bind(tcp, &addr) < 0) { enet_socket_destroy(udp); enet_socket_destroy(tcp); break; }
+        if(enet_socket_connect(tcp, &master) < 0 && !inprogress()) { enet_socket_destroy(udp); enet_socket_destroy(tcp); break; }
+        fakeserver *f = fakes.add(new fakeserver);
+        f->tcp = tcp;
+        f->udp = udp;
+        f->port = servport;
+        f->inputpos = 0;
+        f->connected = f->registered = f->done = false;
+        f->regtime = 0;
+        f->tcpevents.owner = f->udpevents.owner = f;
+        f->tcpevents.ping = false;
+        f->udpevents.ping = true;
+        polladd(tcp, &f->tcpevents, POLL_WRITE);
+        polladd(udp, &f->udpevents, POLL_READ);
+    }
+    conoutf("loadtest: %d servers connecting to %s:%d", fakes.length(), host, port);
+
+    static pollevent events[EVENT_LIMIT];
+    int registered = 0, done = 0;
+    enet_uint32 lastprogress = start;
+    while(registered + done < fakes.length() && ENET_TIME_DIFFERENCE(enet_time_get(), lastprogress) < 2*PING_TIME*PING_RETRY)
+    {
+        int numevents = pollwait(events, EVENT_LIMIT, 100);
+        loopi(numevents) checkfake(*(fakesocket *)events[i].data, start);
+        int nowregistered = 0, nowdone = 0;
+        loopv(fakes) { if(fakes[i]->registered) nowregistered++; else if(fakes[i]->done) nowdone++; }
+        if(nowregistered != registered || nowdone != done) lastprogress = enet_time_get();
+        registered = nowregistered;
+        done = nowdone;
+    }
+    enet_uint32 elapsed = enet_time_get() - start;
+
+    vector<fakeserver *> regs;
+    loopv(fakes) if(fakes[i]->registered) regs.add(fakes[i]);
+    regs.sort(fakeregorder);
+    conoutf("loadtest: %d/%d registered, %d failed, in %u ms", regs.length(), fakes.length(), done, elapsed);
+    if(regs.length()) conoutf("loadtest: registration latency p50 %u ms, p99 %u ms, max %u ms", regs[regs.length()/2]->regtime, regs[(regs.length()*99)/100]->regtime, regs.last()->regtime);
+    loopi(3) fetchlist(master);
+
+    loopv(fakes)
+    {
+        closefake(*fakes[i]);
+        pollremove(fakes[i]->udp);
+        enet_socket_destroy(fakes[i]->udp);
+    }
+    fakes.deletecontents();
+    return EXIT_SUCCESS;
 }
 
 volatile bool reloadcfg = true;
@@ -710,6 +1245,13 @@ int main(int argc, char **argv)
 
     const char *dir = "", *ip = NULL;
     int port = 28787;
+    if(argc>=2 && !strncmp(argv[1], "-l", 2))
+    {
+        // sauer_master -l<servers> [port] [ip] [baseport]
+        logfile = stdout;
+        int servers = argv[1][2] ? atoi(&argv[1][2]) : 1000;
+        return loadtest(servers, argc>=4 ? argv[3] : "127.0.0.1", argc>=3 ? atoi(argv[2]) : port, argc>=5 ? atoi(argv[4]) : 40000);
+    }
     if(argc>=2) dir = argv[1];
     if(argc>=3) port = atoi(argv[2]);
     if(argc>=4) ip = argv[3];
@@ -736,7 +1278,6 @@ int main(int argc, char **argv)
             reloadcfg = false;
         }
 
-        servtime = enet_time_get();
         checkclients();
         checkgameservers();
     }
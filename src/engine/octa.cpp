@@ -136,6 +136,57 @@ void printcube()
 
 COMMAND(printcube, "");
 
+static void countlayout(cube *c, cube *&prev, int &families, int &sequential, int &exts)
+{
+    families++;
+    if(prev && c == prev+8) sequential++;
+    prev = c;
+    loopi(8)
+    {
+        if(c[i].ext) exts++;
+        if(c[i].children) countlayout(c[i].children, prev, families, sequential, exts);
+    }
+}
+
+static inline uint octastatsrand(uint &seed)
+{
+    seed = seed*1103515245 + 12345;
+    return seed>>8;
+}
+
+// reports the octree's size and memory layout and times lookups, rays and walks over it
+void octastats(int *iterations)
+{
+    int families = 0, sequential = 0, exts = 0;
+    cube *prev = NULL;
+    countlayout(worldroot, prev, families, sequential, exts);
+    conoutf("octree: %d families (%.1f MB), %d extensions (%.1f MB), %d%% in traversal order",
+        families, families*8*sizeof(cube)/(1024.0f*1024.0f),
+        exts, exts*sizeof(cubeext)/(1024.0f*1024.0f),
+        families > 1 ? sequential*100/(families-1) : 100);
+
+    int n = *iterations > 0 ? *iterations : 1<<20;
+    uint seed = 1;
+    Uint32 start = SDL_GetTicks();
+    loopi(n) lookupcube(octastatsrand(seed)%worldsize, octastatsrand(seed)%worldsize, octastatsrand(seed)%worldsize);
+    Uint32 lookup = SDL_GetTicks();
+    loopi(n/16)
+    {
+        vec o(octastatsrand(seed)%worldsize, octastatsrand(seed)%worldsize, octastatsrand(seed)%worldsize),
+            ray(float(octastatsrand(seed)&0xFFFF) - 0x8000, float(octastatsrand(seed)&0xFFFF) - 0x8000, float(octastatsrand(seed)&0xFFFF) - 0x8000);
+        if(ray.iszero()) continue;
+        raycube(o, ray.normalize(), worldsize);
+    }
+    Uint32 ray = SDL_GetTicks();
+    int cubes = 0;
+    loopi(16) { cubes = 0; loopj(8) cubes += familysize(worldroot[j]); }
+    Uint32 walk = SDL_GetTicks();
+    conoutf("octree: %d lookups %d ms, %d rays %d ms, 16 walks of %d cubes %d ms",
+        n, lookup - start, n/16, ray - lookup, cubes, walk - ray);
+}
+
+COMMAND(octastats, "i");
+
 bool isvalidcube(cube &c)
 {
     clipplanes p;
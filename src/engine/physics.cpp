@@ -396,6 +396,177 @@ float shadowray(ShadowRayCache *cache, const vec &o, const vec &ray, float radiu
     }
 }
 
+// packet version of the above: rays are stepped together for as long as they pass through the
+// same cubes, so the octree is descended and the clip planes fetched once per cube for the whole
+// packet, and the per ray work is laid out lane by lane so the compiler can vectorize it; rays
+// that leave the packet's path are split off and traced as a new packet from the root, so every
+// ray returns exactly what the scalar version would
+
+void shadowrays(ShadowRayCache *cache, int n, const vec *o, const vec *ray, const float *radius, int mode, float *dists, extentity *t)
+{
+    float v[3][RAYPACKETSIZE], dir[3][RAYPACKETSIZE], invray[3][RAYPACKETSIZE], dist[RAYPACKETSIZE], dent[RAYPACKETSIZE],
+          enterdist[RAYPACKETSIZE], exitdist[RAYPACKETSIZE];
+    int pos[3][RAYPACKETSIZE], lsizemask[3][RAYPACKETSIZE], side[RAYPACKETSIZE], hitside[RAYPACKETSIZE], miss[RAYPACKETSIZE];
+    octaentities *oclast[RAYPACKETSIZE];
+    uint pending = 0;
+    loopk(n)
+    {
+        dist[k] = 0;
+        dent[k] = mode&RAY_BB ? 1e16f : 1e14f;
+        oclast[k] = NULL;
+        side[k] = O_BOTTOM;
+        loopi(3)
+        {
+            v[i][k] = o[k][i];
+            dir[i][k] = ray[k][i];
+            invray[i][k] = ray[k][i] ? 1/ray[k][i] : 1e16f;
+            lsizemask[i][k] = invray[i][k]>0 ? 1 : 0;
+        }
+        if(!insideworld(o[k]))
+        {
+            float disttoworld = 0, exitworld = 1e16f;
+            bool behind = false;
+            loopi(3)
+            {
+                float c = v[i][k];
+                if(c<0 || c>=worldsize)
+                {
+                    float d = ((invray[i][k]>0?0:worldsize)-c)*invray[i][k];
+                    if(d<0) { behind = true; break; }
+                    disttoworld = max(disttoworld, 0.1f + d);
+                }
+                float e = ((invray[i][k]>0?worldsize:0)-c)*invray[i][k];
+                exitworld = min(exitworld, e);
+            }
+            if(behind || disttoworld > exitworld) { dists[k] = radius[k]>0 ? radius[k] : -1; continue; }
+            loopi(3) v[i][k] += dir[i][k]*disttoworld;
+            dist[k] += disttoworld;
+        }
+        loopi(3) pos[i][k] = int(v[i][k]);
+        pending |= 1<<k;
+    }
+
+    cube *levels[20];
+    levels[worldscale] = worldroot;
+    while(pending)
+    {
+        uint active = pending;
+        pending = 0;
+        int lshift = worldscale;
+        for(;;)
+        {
+            int lead = 0;
+            while(!(active&(1<<lead))) lead++;
+            int x = pos[0][lead], y = pos[1][lead], z = pos[2][lead];
+            cube *lc = levels[lshift];
+            for(;;)
+            {
+                lshift--;
+                loopk(n) if(active&(1<<k) && (uint((pos[0][k]^x)|(pos[1][k]^y)|(pos[2][k]^z))>>lshift))
+                {
+                    active &= ~(1<<k);
+                    pending |= 1<<k;
+                }
+                lc += octastep(x, y, z, lshift);
+                if(lc->ext && lc->ext->ents) loopk(n) if(active&(1<<k) && dent[k] > 1e15f)
+                {
+                    dent[k] = shadowent(lc->ext->ents, oclast[k], o[k], ray[k], radius[k], mode, t);
+                    if(dent[k] < 1e15f) { dists[k] = min(dent[k], dist[k]); active &= ~(1<<k); }
+                    else oclast[k] = lc->ext->ents;
+                }
+                if(lc->children==NULL) break;
+                lc = lc->children;
+                levels[lshift] = lc;
+            }
+            if(!active) break;
+
+            cube &c = *lc;
+            ivec lo(x&(~0<<lshift), y&(~0<<lshift), z&(~0<<lshift));
+
+            if(!isempty(c) && !(c.material&MAT_ALPHA))
+            {
+                if(isentirelysolid(c))
+                {
+                    loopk(n) if(active&(1<<k)) dists[k] = c.texture[side[k]]==DEFAULT_SKY && mode&RAY_SKIPSKY ? radius[k] : dist[k];
+                    break;
+                }
+                clipplanes &p = cache->clipcache[int(&c - worldroot)&(MAXCLIPPLANES-1)];
+                if(p.owner != &c || p.version != cache->version) { p.owner = &c; p.version = cache->version; genclipplanes(c, lo.x, lo.y, lo.z, 1<<lshift, p); }
+                loopk(n) { enterdist[k] = -1e16f; exitdist[k] = 1e16f; hitside[k] = side[k]; miss[k] = 0; }
+                loopi(p.size)
+                {
+                    const plane &pl = p.p[i];
+                    int pside = p.side[i];
+                    loopk(n)
+                    {
+                        float pdist = pl.x*v[0][k] + pl.y*v[1][k] + pl.z*v[2][k] + pl.offset,
+                              facing = dir[0][k]*pl.x + dir[1][k]*pl.y + dir[2][k]*pl.z,
+                              d = pdist / -facing;
+                        bool entering = facing < 0, exiting = facing > 0;
+                        miss[k] |= entering ? d > enterdist[k] && d > exitdist[k] : (exiting ? d < exitdist[k] && d < enterdist[k] : pdist > 0);
+                        if(entering && d > enterdist[k]) { enterdist[k] = d; hitside[k] = pside; }
+                        if(exiting && d < exitdist[k]) exitdist[k] = d;
+                    }
+                }
+                loopi(3)
+                {
+                    float bo = p.o[i], br = p.r[i];
+                    loopk(n)
+                    {
+                        if(dir[i][k])
+                        {
+                            float prad = fabs(br * invray[i][k]), pdist = (bo - v[i][k]) * invray[i][k], pmin = pdist - prad, pmax = pdist + prad;
+                            miss[k] |= pmin > enterdist[k] && pmin > exitdist[k];
+                            if(pmin > enterdist[k]) { enterdist[k] = pmin; hitside[k] = (i<<1) + 1 - lsizemask[i][k]; }
+                            miss[k] |= pmax < exitdist[k] && pmax < enterdist[k];
+                            if(pmax < exitdist[k]) exitdist[k] = pmax;
+                        }
+                        else miss[k] |= v[i][k] < bo-br || v[i][k] > bo+br;
+                    }
+                }
+                loopk(n) if(active&(1<<k) && !miss[k] && exitdist[k] >= 0)
+                {
+                    dists[k] = c.texture[hitside[k]]==DEFAULT_SKY && mode&RAY_SKIPSKY ? radius[k] : dist[k]+max(enterdist[k]+0.1f, 0.0f);
+                    active &= ~(1<<k);
+                }
+                if(!active) break;
+            }
+
+            int nextshift = lshift;
+            loopk(n) if(active&(1<<k))
+            {
+                float dx = (lo.x+(lsizemask[0][k]<<lshift)-v[0][k])*invray[0][k],
+                      dy = (lo.y+(lsizemask[1][k]<<lshift)-v[1][k])*invray[1][k],
+                      dz = (lo.z+(lsizemask[2][k]<<lshift)-v[2][k])*invray[2][k];
+                float disttonext = dx;
+                side[k] = O_RIGHT - lsizemask[0][k];
+                if(dy < disttonext) { disttonext = dy; side[k] = O_FRONT - lsizemask[1][k]; }
+                if(dz < disttonext) { disttonext = dz; side[k] = O_TOP - lsizemask[2][k]; }
+                disttonext += 0.1f;
+                loopi(3) v[i][k] += dir[i][k]*disttonext;
+                dist[k] += disttonext;
+
+                if(dist[k]>=radius[k]) { dists[k] = dist[k]; active &= ~(1<<k); continue; }
+
+                loopi(3) pos[i][k] = int(v[i][k]);
+                uint diff = uint(lo.x^pos[0][k])|uint(lo.y^pos[1][k])|uint(lo.z^pos[2][k]);
+                if(diff >= uint(worldsize)) { dists[k] = radius[k]; active &= ~(1<<k); continue; }
+                diff >>= lshift;
+                if(!diff) { dists[k] = radius[k]; active &= ~(1<<k); continue; }
+                int kshift = lshift;
+                do
+                {
+                    kshift++;
+                    diff >>= 1;
+                } while(diff);
+                nextshift = max(nextshift, kshift);
+            }
+            if(!active) break;
+            lshift = nextshift;
+        }
+    }
+}
+
 float rayent(const vec &o, const vec &ray, float radius, int mode, int size, int &orient, int &ent)
 {
     hitent = -1;
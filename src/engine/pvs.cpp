@@ -263,22 +263,36 @@ struct pvsdata
 
 static vector<uchar> pvsbuf;
 
-static inline uint hthash(const pvsdata &k)
+struct pvskey
 {
+    vector<uchar> *buf;
+    int offset, len;
+
+    pvskey() {}
+    pvskey(vector<uchar> &buf, int offset, int len) : buf(&buf), offset(offset), len(len) {}
+
+    const uchar *data() const { return buf->getbuf() + offset; }
+};
+
+static inline uint hthash(const pvskey &k)
+{
+    const uchar *data = k.data();
     uint h = 5381;
-    loopi(k.len) h = ((h<<5)+h)^pvsbuf[k.offset+i];
+    loopi(k.len) h = ((h<<5)+h)^data[i];
     return h;
 }
 
-static inline bool htcmp(const pvsdata &x, const pvsdata &y)
+static inline bool htcmp(const pvskey &x, const pvskey &y)
 {
-    return x.len==y.len && !memcmp(&pvsbuf[x.offset], &pvsbuf[y.offset], x.len);
+    return x.len==y.len && !memcmp(x.data(), y.data(), x.len);
 }
 
-static SDL_mutex *pvsmutex = NULL;
-static hashtable<pvsdata, int> pvscompress;
+static hashtable<pvskey, int> pvscompress;
 static vector<pvsdata> pvs;
 
+#define MAXPVSTHREADS 256
+#define PVSREQUESTCHUNK 16
+
 static SDL_mutex *viewcellmutex = NULL;
 struct viewcellrequest
 {
@@ -287,9 +301,10 @@ struct viewcellrequest
     int size;
 };
 static vector<viewcellrequest> viewcellrequests;
+static int nextviewcell = 0;
 
 static bool genpvs_canceled = false;
-static int numviewcells = 0;
+static int numviewcells = 0, numlocalviewcells = 0;
 
 VAR(maxpvsblocker, 1, 512, 1<<16);
 VAR(pvsleafsize, 1, 64, 1024);
@@ -306,7 +321,7 @@ uint numwaterplanes = 0;
 
 struct pvsworker
 {
-    pvsworker() : thread(NULL), pvsnodes(new pvsnode[origpvsnodes.length()])
+    pvsworker(int index = 0) : thread(NULL), index(index), pvsnodes(new pvsnode[origpvsnodes.length()])
     {
     }
     ~pvsworker()
@@ -315,8 +330,15 @@ struct pvsworker
     }
 
     SDL_Thread *thread;
+    int index;
     pvsnode *pvsnodes;
 
+    // view cells are deduplicated per worker without locking, then merged into pvsbuf once all workers are done
+    vector<uchar> localbuf;
+    vector<pvsdata> localpvs;
+    hashtable<pvskey, int> localcompress;
+    vector<int> remap;
+
     shaftbb viewcellbb;
 
     pvsnode *levels[32];
@@ -756,34 +778,39 @@ struct pvsworker
     {
         calcpvs(co, size);
 
-        if(pvsmutex) SDL_LockMutex(pvsmutex);
-        numviewcells++;
-        pvsdata key(pvsbuf.length(), waterbytes + outbuf.length());
-        loopi(waterbytes) pvsbuf.add((wateroccluded>>(i*8))&0xFF);
-        pvsbuf.put(outbuf.getbuf(), outbuf.length());
-        int *val = pvscompress.access(key);
-        if(val) pvsbuf.setsize(key.offset);
+        pvskey key(localbuf, localbuf.length(), waterbytes + outbuf.length());
+        loopi(waterbytes) localbuf.add((wateroccluded>>(i*8))&0xFF);
+        localbuf.put(outbuf.getbuf(), outbuf.length());
+        int *val = localcompress.access(key);
+        if(val) localbuf.setsize(key.offset);
         else
         {
-            val = &pvscompress[key];
-            *val = pvs.length();
-            pvs.add(key);
+            val = &localcompress[key];
+            *val = localpvs.length();
+            localpvs.add(pvsdata(key.offset, key.len));
         }
-        if(pvsmutex) SDL_UnlockMutex(pvsmutex);
-        return *val;
+        return (*val<<8) | index;
     }
 
     static int run(void *data)
     {
         pvsworker *w = (pvsworker *)data;
+        int unique = 0;
         SDL_LockMutex(viewcellmutex);
-        while(viewcellrequests.length())
+        while(nextviewcell < viewcellrequests.length())
         {
-            viewcellrequest req = viewcellrequests.pop();
+            int start = nextviewcell, end = min(start + PVSREQUESTCHUNK, viewcellrequests.length());
+            nextviewcell = end;
             SDL_UnlockMutex(viewcellmutex);
-            int result = w->genviewcell(req.o, req.size);
+            for(int i = start; i < end; i++)
+            {
+                viewcellrequest &req = viewcellrequests[i];
+                *req.result = w->genviewcell(req.o, req.size);
+            }
             SDL_LockMutex(viewcellmutex);
-            *req.result = result;
+            numviewcells += end - start;
+            numlocalviewcells += w->localpvs.length() - unique;
+            unique = w->localpvs.length();
         }
         SDL_UnlockMutex(viewcellmutex);
         return 0;
@@ -809,9 +836,14 @@ struct viewcellnode
     }
 };
 
-VARP(pvsthreads, 1, 1, 16);
+VARP(pvsthreads, 0, 0, MAXPVSTHREADS);
 static vector<pvsworker *> pvsworkers;
 
+static int numpvsthreads()
+{
+    return clamp(pvsthreads ? pvsthreads : numcpus(), 1, MAXPVSTHREADS);
+}
+
 static volatile bool check_genpvs_progress = false;
 
 static Uint32 genpvs_timer(Uint32 interval, void *param)
@@ -822,7 +854,7 @@ static Uint32 genpvs_timer(Uint32 interval, void *param)
 
 static int totalviewcells = 0;
 
-static void show_genpvs_progress(int unique = pvs.length(), int processed = numviewcells)
+static void show_genpvs_progress(int unique, int processed = numviewcells)
 {
     float bar1 = float(processed) / float(totalviewcells>0 ? totalviewcells : 1);
 
@@ -907,11 +939,12 @@ static void genviewcells(viewcellnode &p, cube *c, const ivec &co, int size, int
             if(isallclip(h.children)) continue;
         }
         else if(isentirelysolid(h) || (h.material&MATF_CLIP)==MAT_CLIP) continue;
-        if(pvsthreads<=1)
+        if(pvsworkers.length())
         {
             if(genpvs_canceled) return;
             p.children[i].pvs = pvsworkers[0]->genviewcell(o, size);
-            if(check_genpvs_progress) show_genpvs_progress();
+            numviewcells++;
+            if(check_genpvs_progress) show_genpvs_progress(pvsworkers[0]->localpvs.length());
         }
         else
         {
@@ -923,6 +956,43 @@ static void genviewcells(viewcellnode &p, cube *c, const ivec &co, int size, int
     }
 }
 
+static void mergeviewcells()
+{
+    loopv(pvsworkers)
+    {
+        pvsworker &w = *pvsworkers[i];
+        w.remap.setsize(0);
+        loopvj(w.localpvs)
+        {
+            const pvsdata &d = w.localpvs[j];
+            pvskey key(pvsbuf, pvsbuf.length(), d.len);
+            pvsbuf.put(&w.localbuf[d.offset], d.len);
+            int *val = pvscompress.access(key);
+            if(val) pvsbuf.setsize(key.offset);
+            else
+            {
+                val = &pvscompress[key];
+                *val = pvs.length();
+                pvs.add(pvsdata(key.offset, key.len));
+            }
+            w.remap.add(*val);
+        }
+    }
+}
+
+static void remapviewcells(viewcellnode &p)
+{
+    loopi(8)
+    {
+        if(!(p.leafmask&(1<<i))) remapviewcells(*p.children[i].node);
+        else if(p.children[i].pvs >= 0)
+        {
+            int local = p.children[i].pvs;
+            p.children[i].pvs = pvsworkers[local&0xFF]->remap[local>>8];
+        }
+    }
+}
+
 static viewcellnode *viewcells = NULL;
 static int lockedwaterplanes[MAXWATERPVS];
 static uchar *curpvs = NULL, *lockedpvs = NULL;
@@ -1076,6 +1146,117 @@ void testpvs(int *vcsize)
 
 COMMAND(testpvs, "i");
 
+/* Generated view cells are kept in the asset cache under a hash of everything they are computed
+ * from: the occluder tree, the water surfaces, the view cell bounds and the generation settings.
+ * Every view cell depends on occluders anywhere in the map, so any change to the geometry
+ * regenerates the whole PVS.
+ */
+
+static bool pvscachekey(int threshold, char *key, int maxlen)
+{
+    key[0] = '\0';
+    if(!assetcache) return false;
+    vector<uchar> buf;
+    buf.reserve(64 + origpvsnodes.length()*sizeof(pvsnode));
+    buf.put((const uchar *)"PVS1", 4);
+    putint(buf, worldsize);
+    putint(buf, threshold);
+    putint(buf, maxpvsblocker);
+    putint(buf, pvsleafsize);
+    loopk(3) { putint(buf, pvsbounds.min[k]); putint(buf, pvsbounds.max[k]); }
+    putint(buf, numwaterplanes);
+    loopi(numwaterplanes)
+    {
+        vector<materialsurface *> &matsurfs = waterplanes[i].height < 0 ? waterfalls : waterplanes[i].matsurfs;
+        putint(buf, waterplanes[i].height);
+        putint(buf, matsurfs.length());
+        loopvj(matsurfs)
+        {
+            const materialsurface &m = *matsurfs[j];
+            loopk(3) putint(buf, m.o[k]);
+            putint(buf, m.csize);
+            putint(buf, m.rsize);
+            putint(buf, m.orient);
+        }
+    }
+    buf.put((const uchar *)origpvsnodes.getbuf(), origpvsnodes.length()*sizeof(pvsnode));
+    return assetcachekey(buf.getbuf(), buf.length(), key, maxlen);
+}
+
+static void putviewcells(vector<uchar> &buf, viewcellnode &p)
+{
+    buf.add(p.leafmask);
+    loopi(8)
+    {
+        if(p.leafmask&(1<<i)) putint(buf, p.children[i].pvs);
+        else putviewcells(buf, *p.children[i].node);
+    }
+}
+
+static void storepvscache(const char *key)
+{
+    vector<uchar> buf;
+    putint(buf, pvs.length());
+    loopv(pvs) putint(buf, pvs[i].len);
+    buf.put(pvsbuf.getbuf(), pvsbuf.length());
+    putviewcells(buf, *viewcells);
+    storecachedasset("pvs", key, buf.getbuf(), buf.length());
+}
+
+static viewcellnode *getviewcells(ucharbuf &p, int depth = 0)
+{
+    viewcellnode *vc = new viewcellnode;
+    vc->leafmask = p.get();
+    loopi(8)
+    {
+        if(vc->leafmask&(1<<i))
+        {
+            int n = getint(p);
+            vc->children[i].pvs = n >= 0 && n < pvs.length() ? n : -1;
+        }
+        else if(depth < worldscale && !p.overread()) vc->children[i].node = getviewcells(p, depth+1);
+        else
+        {
+            vc->leafmask |= 0xFF<<i;
+            p.forceoverread();
+            break;
+        }
+    }
+    return vc;
+}
+
+static bool loadpvscache(const char *key)
+{
+    int size = 0;
+    char *data = loadcachedasset("pvs", key, &size);
+    if(!data) return false;
+    ucharbuf p((uchar *)data, size);
+    int numpvs = getint(p), totallen = 0;
+    if(numpvs > 0 && numpvs <= size) loopi(numpvs)
+    {
+        int len = getint(p);
+        if(len <= 0 || len > USHRT_MAX) { p.forceoverread(); break; }
+        pvs.add(pvsdata(totallen, len));
+        totallen += len;
+    }
+    else p.forceoverread();
+    if(!p.overread() && totallen <= p.remaining())
+    {
+        pvsbuf.put(p.subbuf(totallen).buf, totallen);
+        viewcells = getviewcells(p);
+    }
+    else p.forceoverread();
+    delete[] data;
+    if(p.overread())
+    {
+        DELETEP(viewcells);
+        pvs.setsize(0);
+        pvsbuf.setsize(0);
+        return false;
+    }
+    return true;
+}
+
 void genpvs(int *viewcellsize)
 {
     if(worldsize > 1<<15)
@@ -1100,30 +1281,41 @@ void genpvs(int *viewcellsize)
     root.children = 0;
     genpvsnodes(worldroot);
 
-    totalviewcells = countviewcells(worldroot, ivec(0, 0, 0), worldsize>>1, *viewcellsize>0 ? *viewcellsize : 32);
-    numviewcells = 0;
+    int threshold = *viewcellsize>0 ? *viewcellsize : 32;
+    string cachekey;
+    if(pvscachekey(threshold, cachekey, sizeof(cachekey)) && loadpvscache(cachekey))
+    {
+        origpvsnodes.setsize(0);
+        conoutf("loaded %d unique view cells totaling %.1f kB from cache (%.1f seconds)",
+            pvs.length(), pvsbuf.length()/1024.0f, (SDL_GetTicks() - start) / 1000.0f);
+        return;
+    }
+
+    totalviewcells = countviewcells(worldroot, ivec(0, 0, 0), worldsize>>1, threshold);
+    numviewcells = numlocalviewcells = 0;
     genpvs_canceled = false;
     check_genpvs_progress = false;
     SDL_TimerID timer = NULL;
-    if(pvsthreads<=1) 
+    int numthreads = numpvsthreads();
+    if(numthreads<=1)
     {
         pvsworkers.add(new pvsworker);
         timer = SDL_AddTimer(500, genpvs_timer, NULL);
     }
     viewcells = new viewcellnode;
-    genviewcells(*viewcells, worldroot, ivec(0, 0, 0), worldsize>>1, *viewcellsize>0 ? *viewcellsize : 32);
-    if(pvsthreads<=1)
+    genviewcells(*viewcells, worldroot, ivec(0, 0, 0), worldsize>>1, threshold);
+    if(numthreads<=1)
     {
         SDL_RemoveTimer(timer);
     }
     else
     {
         renderprogress(0, "creating threads");
-        if(!pvsmutex) pvsmutex = SDL_CreateMutex();
         if(!viewcellmutex) viewcellmutex = SDL_CreateMutex();
-        loopi(pvsthreads)
+        nextviewcell = 0;
+        loopi(numthreads)
         {
-            pvsworker *w = pvsworkers.add(new pvsworker);
+            pvsworker *w = pvsworkers.add(new pvsworker(i));
             w->thread = SDL_CreateThread(pvsworker::run, w);
         }
         show_genpvs_progress(0, 0);
@@ -1131,15 +1323,25 @@ void genpvs(int *viewcellsize)
         {
             SDL_Delay(500);
             SDL_LockMutex(viewcellmutex);
-            int unique = pvs.length(), processed = numviewcells, remaining = viewcellrequests.length();
+            int unique = numlocalviewcells, processed = numviewcells;
             SDL_UnlockMutex(viewcellmutex);
             show_genpvs_progress(unique, processed);
-            if(!remaining) break;
-        }        
+            if(processed >= viewcellrequests.length()) break;
+        }
         SDL_LockMutex(viewcellmutex);
-        viewcellrequests.setsize(0);
+        nextviewcell = viewcellrequests.length();
         SDL_UnlockMutex(viewcellmutex);
         loopv(pvsworkers) SDL_WaitThread(pvsworkers[i]->thread, NULL);
+        viewcellrequests.setsize(0);
+    }
+
+    Uint32 merge = SDL_GetTicks();
+    if(!genpvs_canceled)
+    {
+        renderprogress(1, "merging view cells");
+        mergeviewcells();
+        remapviewcells(*viewcells);
+        if(cachekey[0]) storepvscache(cachekey);
     }
     pvsworkers.deletecontents();
 
@@ -1152,8 +1354,8 @@ void genpvs(int *viewcellsize)
         clearpvs();
         conoutf("genpvs aborted");
     }
-    else conoutf("generated %d unique view cells totaling %.1f kB and averaging %d B (%.1f seconds)", 
-            pvs.length(), pvsbuf.length()/1024.0f, pvsbuf.length()/max(pvs.length(), 1), (end - start) / 1000.0f);
+    else conoutf("generated %d unique view cells totaling %.1f kB and averaging %d B (%.1f seconds, %d threads, %.1f seconds merging)", 
+            pvs.length(), pvsbuf.length()/1024.0f, pvsbuf.length()/max(pvs.length(), 1), (end - start) / 1000.0f, numthreads, (end - merge) / 1000.0f);
 }
 
 COMMAND(genpvs, "i");
@@ -3,6 +3,10 @@
 
 #include "engine.h"
 
+#ifndef WIN32
+#include <errno.h>
+#endif
+
 static FILE *logfile = NULL;
 
 void closelogfile()
@@ -136,6 +140,192 @@ int getuint(ucharbuf &p)
     return n;
 }
 
+// bulk variants of the above for runs of values: when the buffer has room for the worst case the bytes are
+// written and read through a raw pointer without per-byte bounds checks, and runs of single byte values are
+// handled 8 at a time by testing a whole 64 bit word at once; the encoding is identical to the scalar path
+
+#define BULKINTSIZE 5
+
+static inline uchar *encodeints(uchar *dst, const int *v, int n)
+{
+    loopi(n)
+    {
+        int x = v[i];
+        if(x<128 && x>-127) *dst++ = x;
+        else if(x<0x8000 && x>=-0x8000) { dst[0] = 0x80; dst[1] = x; dst[2] = x>>8; dst += 3; }
+        else { dst[0] = 0x81; dst[1] = x; dst[2] = x>>8; dst[3] = x>>16; dst[4] = x>>24; dst += 5; }
+    }
+    return dst;
+}
+
+static inline uchar *encodeuints(uchar *dst, const int *v, int n)
+{
+    loopi(n)
+    {
+        int x = v[i];
+        if(x < 0 || x >= (1<<21)) { dst[0] = 0x80 | (x & 0x7F); dst[1] = 0x80 | ((x >> 7) & 0x7F); dst[2] = 0x80 | ((x >> 14) & 0x7F); dst[3] = x >> 21; dst += 4; }
+        else if(x < (1<<7)) *dst++ = x;
+        else if(x < (1<<14)) { dst[0] = 0x80 | (x & 0x7F); dst[1] = x >> 7; dst += 2; }
+        else { dst[0] = 0x80 | (x & 0x7F); dst[1] = 0x80 | ((x >> 7) & 0x7F); dst[2] = x >> 14; dst += 3; }
+    }
+    return dst;
+}
+
+static inline unsigned long long loadword(const uchar *src)
+{
+    unsigned long long w;
+    memcpy(&w, src, sizeof(w));
+    return w;
+}
+
+#define WORDBYTES(b) (0x0101010101010101ULL*(b))
+
+static inline const uchar *decodeints(const uchar *src, int *v, int n)
+{
+    int i = 0;
+    while(i < n)
+    {
+        if(n - i >= 8)
+        {
+            // no byte is 0x80 or 0x81, so all 8 are single byte values
+            unsigned long long w = loadword(src) ^ WORDBYTES(0x80);
+            if(!((w - WORDBYTES(0x02)) & ~w & WORDBYTES(0x80)))
+            {
+                loopj(8) v[i+j] = (char)src[j];
+                src += 8;
+                i += 8;
+                continue;
+            }
+        }
+        int c = (char)*src++;
+        if(c==-128) { c = src[0] | (char(src[1])<<8); src += 2; }
+        else if(c==-127) { c = src[0] | (src[1]<<8) | (src[2]<<16) | (src[3]<<24); src += 4; }
+        v[i++] = c;
+    }
+    return src;
+}
+
+static inline const uchar *decodeuints(const uchar *src, int *v, int n)
+{
+    int i = 0;
+    while(i < n)
+    {
+        if(n - i >= 8 && !(loadword(src) & WORDBYTES(0x80)))
+        {
+            loopj(8) v[i+j] = src[j];
+            src += 8;
+            i += 8;
+            continue;
+        }
+        int x = *src++;
+        if(x & 0x80)
+        {
+            x += (*src++ << 7) - 0x80;
+            if(x & (1<<14)) x += (*src++ << 14) - (1<<14);
+            if(x & (1<<21)) x += (*src++ << 21) - (1<<21);
+            if(x & (1<<28)) x |= -1<<28;
+        }
+        v[i++] = x;
+    }
+    return src;
+}
+
+void putints(ucharbuf &p, const int *v, int n)
+{
+    if(p.remaining() < n*BULKINTSIZE) { loopi(n) putint(p, v[i]); return; }
+    p.len = encodeints(&p.buf[p.len], v, n) - p.buf;
+}
+void putints(packetbuf &p, const int *v, int n) { p.checkspace(n*BULKINTSIZE); putints((ucharbuf &)p, v, n); }
+void putints(vector<uchar> &p, const int *v, int n) { uchar *buf = p.reserve(n*BULKINTSIZE).buf; p.advance(encodeints(buf, v, n) - buf); }
+
+void getints(ucharbuf &p, int *v, int n)
+{
+    if(p.remaining() < n*BULKINTSIZE) { loopi(n) v[i] = getint(p); return; }
+    p.len = decodeints(&p.buf[p.len], v, n) - p.buf;
+}
+
+void putuints(ucharbuf &p, const int *v, int n)
+{
+    if(p.remaining() < n*BULKINTSIZE) { loopi(n) putuint(p, v[i]); return; }
+    p.len = encodeuints(&p.buf[p.len], v, n) - p.buf;
+}
+void putuints(packetbuf &p, const int *v, int n) { p.checkspace(n*BULKINTSIZE); putuints((ucharbuf &)p, v, n); }
+void putuints(vector<uchar> &p, const int *v, int n) { uchar *buf = p.reserve(n*BULKINTSIZE).buf; p.advance(encodeuints(buf, v, n) - buf); }
+
+void getuints(ucharbuf &p, int *v, int n)
+{
+    if(p.remaining() < n*BULKINTSIZE) { loopi(n) v[i] = getuint(p); return; }
+    p.len = decodeuints(&p.buf[p.len], v, n) - p.buf;
+}
+
+static int benchvarints(bool bulk, bool unsignedints, const vector<int> &vals, vector<uchar> &enc, vector<int> &dec, int reps)
+{
+    int n = vals.length();
+    enc.setsize(0);
+    enc.reserve(n*BULKINTSIZE);
+    dec.setsize(0);
+    dec.pad(n);
+    enet_uint32 start = enet_time_get();
+    loopk(reps)
+    {
+        ucharbuf p(enc.getbuf(), n*BULKINTSIZE);
+        if(bulk) { if(unsignedints) putuints(p, vals.getbuf(), n); else putints(p, vals.getbuf(), n); }
+        else if(unsignedints) loopi(n) putuint(p, vals[i]);
+        else loopi(n) putint(p, vals[i]);
+        ucharbuf q(enc.getbuf(), p.length());
+        if(bulk) { if(unsignedints) getuints(q, dec.getbuf(), n); else getints(q, dec.getbuf(), n); }
+        else if(unsignedints) loopi(n) dec[i] = getuint(q);
+        else loopi(n) dec[i] = getint(q);
+        if(!k) enc.advance(p.length());
+    }
+    return int(enet_time_get() - start);
+}
+
+void varintbench(int *count, int *iters)
+{
+    int n = *count > 0 ? *count : 4096, reps = *iters > 0 ? *iters : 1000;
+    vector<int> vals;
+    vector<uchar> scalarenc, bulkenc;
+    vector<int> scalardec, bulkdec;
+    loopk(2)
+    {
+        // mostly small values with the odd large one, roughly what positions and game messages look like
+        vals.setsize(0);
+        loopi(n)
+        {
+            int r = rnd(100);
+            if(k) vals.add(r < 80 ? rnd(1<<7) : (r < 95 ? rnd(1<<14) : int(randomMT()&0xFFFFFFF)));
+            else vals.add(r < 80 ? rnd(253)-126 : (r < 95 ? rnd(0x10000)-0x8000 : int(randomMT())));
+        }
+        int scalartime = benchvarints(false, k!=0, vals, scalarenc, scalardec, reps),
+            bulktime = benchvarints(true, k!=0, vals, bulkenc, bulkdec, reps);
+        bool same = scalarenc.length() == bulkenc.length() && !memcmp(scalarenc.getbuf(), bulkenc.getbuf(), bulkenc.length()) &&
+                    !memcmp(scalardec.getbuf(), vals.getbuf(), n*sizeof(int)) && !memcmp(bulkdec.getbuf(), vals.getbuf(), n*sizeof(int));
+        conoutf("%s: %d values x %d, %d bytes: scalar %d ms, bulk %d ms%s", k ? "uint" : "int", n, reps, bulkenc.length(), scalartime, bulktime, same ? "" : " (MISMATCH)");
+    }
+}
+COMMAND(varintbench, "ii");
+
+// field-level delta coding on top of the above: a mask of changed fields followed by their differences from a base
+template<class T>
+static inline void putdelta_(T &p, const int *fields, const int *base, int numfields)
+{
+    int mask = 0;
+    loopi(numfields) if(fields[i] != base[i]) mask |= 1<<i;
+    putuint(p, mask);
+    loopi(numfields) if(mask&(1<<i)) putint(p, fields[i] - base[i]);
+}
+void putdelta(ucharbuf &p, const int *fields, const int *base, int numfields) { putdelta_(p, fields, base, numfields); }
+void putdelta(packetbuf &p, const int *fields, const int *base, int numfields) { putdelta_(p, fields, base, numfields); }
+void putdelta(vector<uchar> &p, const int *fields, const int *base, int numfields) { putdelta_(p, fields, base, numfields); }
+
+int getdelta(ucharbuf &p, int *fields, const int *base, int numfields)
+{
+    int mask = getuint(p);
+    loopi(numfields) fields[i] = mask&(1<<i) ? base[i] + getint(p) : base[i];
+    return mask;
+}
+
 template<class T>
 static inline void putfloat_(T &p, float f)
 {
@@ -219,6 +409,405 @@ void cleanupserver()
     pongsock = lansock = ENET_SOCKET_NULL;
 }
 
+// tick profiler: per-tick microsecond totals of each section go into log-linear histograms (4 buckets per
+// power of two), and message parsing and sent packets are accounted per message type
+
+VAR(serverprofile, 0, 0, 1);
+
+#define PROFBUCKETS 128
+#define PROFMSGTYPES 256
+
+struct profhistogram
+{
+    uint buckets[PROFBUCKETS];
+    uint count, max;
+    double total;
+
+    void reset() { memset(this, 0, sizeof(*this)); }
+
+    static int bucket(uint v)
+    {
+        if(v < 16) return v;
+        int e = 4;
+        while(e < 31 && v >> (e+1)) e++;
+        return 16 + (e-4)*4 + ((v >> (e-2)) & 3);
+    }
+
+    static uint bucketlimit(int b)
+    {
+        if(b < 16) return b;
+        int e = 4 + (b-16)/4;
+        return (uint(4 + (b-16)%4 + 1) << (e-2)) - 1;
+    }
+
+    void add(uint v)
+    {
+        buckets[bucket(v)]++;
+        count++;
+        max = ::max(max, v);
+        total += v;
+    }
+
+    uint percentile(float pct)
+    {
+        if(!count) return 0;
+        uint target = uint(ceil(count*pct)), seen = 0;
+        loopi(PROFBUCKETS)
+        {
+            seen += buckets[i];
+            if(seen >= target) return min(bucketlimit(i), max);
+        }
+        return max;
+    }
+};
+
+struct profmsgstats
+{
+    uint count, bytesin, sent, bytesout;
+    double time;
+};
+
+static const char * const profsectionnames[NUMPROFSECTIONS] = { "tick", "serverupdate", "parsepacket", "worldstate", "enet service", "enet flush" };
+static profhistogram profsections[NUMPROFSECTIONS];
+static uint profticktimes[NUMPROFSECTIONS];
+static profmsgstats profmsgs[PROFMSGTYPES];
+
+uint profiletime()
+{
+#ifdef WIN32
+    static LARGE_INTEGER freq = { 0 };
+    if(!freq.QuadPart) QueryPerformanceFrequency(&freq);
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return uint(now.QuadPart/freq.QuadPart*1000000 + now.QuadPart%freq.QuadPart*1000000/freq.QuadPart);
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return uint(now.tv_sec*1000000ULL + now.tv_nsec/1000);
+#endif
+}
+
+bool profiling() { return serverprofile!=0; }
+
+void profilesection(int section, uint start)
+{
+    if(serverprofile) profticktimes[section] += profiletime() - start;
+}
+
+void profilemessage(int type, int bytes, uint start)
+{
+    if(!serverprofile || type < 0 || type >= PROFMSGTYPES) return;
+    profmsgstats &m = profmsgs[type];
+    m.count++;
+    m.bytesin += bytes;
+    m.time += profiletime() - start;
+}
+
+static void profilesent(ENetPacket *packet)
+{
+    if(!packet->dataLength) return;
+    ucharbuf p(packet->data, packet->dataLength);
+    int type = getint(p);
+    if(type < 0 || type >= PROFMSGTYPES) return;
+    profmsgs[type].sent++;
+    profmsgs[type].bytesout += packet->dataLength;
+}
+
+static void profiletick()
+{
+    loopi(NUMPROFSECTIONS) profsections[i].add(profticktimes[i]);
+    memset(profticktimes, 0, sizeof(profticktimes));
+}
+
+void profilereset()
+{
+    loopi(NUMPROFSECTIONS) profsections[i].reset();
+    memset(profticktimes, 0, sizeof(profticktimes));
+    memset(profmsgs, 0, sizeof(profmsgs));
+}
+COMMAND(profilereset, "");
+
+static int profmsgorder(const int *x, const int *y)
+{
+    if(profmsgs[*x].time > profmsgs[*y].time) return -1;
+    if(profmsgs[*x].time < profmsgs[*y].time) return 1;
+    return *x - *y;
+}
+
+void profilestats()
+{
+    conoutf("tick profile over %d ticks (microseconds):", profsections[0].count);
+    loopi(NUMPROFSECTIONS)
+    {
+        profhistogram &h = profsections[i];
+        conoutf("  %-14s p50 %6u  p99 %6u  max %6u  avg %.1f", profsectionnames[i], h.percentile(0.5f), h.percentile(0.99f), h.max, h.count ? h.total/h.count : 0.0);
+    }
+    vector<int> types;
+    loopi(PROFMSGTYPES) if(profmsgs[i].count || profmsgs[i].sent) types.add(i);
+    types.sort(profmsgorder);
+    if(types.empty()) return;
+    conoutf("messages by parse time (type: count, bytes in, total us, avg us; packets sent, bytes out):");
+    loopv(types)
+    {
+        profmsgstats &m = profmsgs[types[i]];
+        conoutf("  %3d: %u, %u, %.0f, %.2f; %u, %u", types[i], m.count, m.bytesin, m.time, m.count ? m.time/m.count : 0.0, m.sent, m.bytesout);
+    }
+}
+COMMAND(profilestats, "");
+
+// transport compression: ENet's range coder, starting each datagram from a model primed with game traffic for its channel
+VAR(servercompress, 0, 1, 1);
+
+struct compressionstats
+{
+    uint datagrams, raw, packed;
+    double time;
+};
+
+static compressionstats compressout, compressin;
+
+static size_t compressdatagram(void *context, const ENetBuffer *inbuffers, size_t inbuffercount, size_t inlimit, enet_uint8 *outdata, size_t outlimit)
+{
+    uint start = profiletime();
+    size_t len = enet_range_coder_compress_primed(context, inbuffers, inbuffercount, inlimit, outdata, outlimit);
+    compressout.time += profiletime() - start;
+    compressout.datagrams++;
+    compressout.raw += inlimit;
+    compressout.packed += len > 0 && len < inlimit ? len : inlimit;
+    return len;
+}
+
+static size_t decompressdatagram(void *context, const enet_uint8 *indata, size_t inlimit, enet_uint8 *outdata, size_t outlimit)
+{
+    uint start = profiletime();
+    size_t len = enet_range_coder_decompress_primed(context, indata, inlimit, outdata, outlimit);
+    compressin.time += profiletime() - start;
+    compressin.datagrams++;
+    compressin.raw += len;
+    compressin.packed += inlimit;
+    return len;
+}
+
+static void destroycompressor(void *context)
+{
+    enet_range_coder_destroy(context);
+}
+
+static bool primecompression(void *coder, int chan)
+{
+    vector<uchar> sample;
+    uchar buf[MAXTRANS];
+    for(int n = 0;; n++)
+    {
+        ucharbuf p(buf, sizeof(buf));
+        if(!server::compressionsample(chan, n, p)) break;
+        // frame each sample the way ENet sends it: unreliable on channel 0, reliable on the rest
+        ENetProtocol command;
+        memset(&command, 0, sizeof(command));
+        command.header.channelID = chan;
+        command.header.reliableSequenceNumber = ENET_HOST_TO_NET_16(n+1);
+        if(chan)
+        {
+            command.header.command = ENET_PROTOCOL_COMMAND_SEND_RELIABLE | ENET_PROTOCOL_COMMAND_FLAG_ACKNOWLEDGE;
+            command.sendReliable.dataLength = ENET_HOST_TO_NET_16(p.length());
+        }
+        else
+        {
+            command.header.command = ENET_PROTOCOL_COMMAND_SEND_UNRELIABLE;
+            command.sendUnreliable.unreliableSequenceNumber = ENET_HOST_TO_NET_16(n+1);
+            command.sendUnreliable.dataLength = ENET_HOST_TO_NET_16(p.length());
+        }
+        sample.put((const uchar *)&command, enet_protocol_command_size(command.header.command));
+        sample.put(buf, p.length());
+    }
+    return sample.empty() || enet_range_coder_prime(coder, chan, sample.getbuf(), sample.length()) >= 0;
+}
+
+bool setupcompression(ENetHost *host)
+{
+    ENetCompressor compressor;
+    compressor.context = enet_range_coder_create();
+    if(!compressor.context) return false;
+    compressor.compress = compressdatagram;
+    compressor.decompress = decompressdatagram;
+    compressor.destroy = destroycompressor;
+    loopi(min(server::numchannels(), int(ENET_RANGE_CODER_DICTIONARIES)))
+    {
+        if(!primecompression(compressor.context, i)) conoutf(CON_WARN, "WARNING: could not prime compression for channel %d", i);
+    }
+    enet_host_compress(host, &compressor);
+    return true;
+}
+
+static void printcompressionstats(const char *dir, const compressionstats &c)
+{
+    conoutf("  %s: %u datagrams, %u -> %u bytes (%.1f%%), %.0f us (%.2f us/KB)", dir, c.datagrams, c.raw, c.packed,
+        c.raw ? 100.0*c.packed/c.raw : 100.0, c.time, c.raw ? c.time*1024/c.raw : 0.0);
+}
+
+void compressstats()
+{
+    conoutf("transport compression:");
+    printcompressionstats("sent", compressout);
+    printcompressionstats("received", compressin);
+}
+COMMAND(compressstats, "");
+
+void compressreset()
+{
+    memset(&compressout, 0, sizeof(compressout));
+    memset(&compressin, 0, sizeof(compressin));
+}
+COMMAND(compressreset, "");
+
+// pooled allocation behind enet_malloc: packets, commands and small packet buffers come in a handful of sizes and churn
+// every tick, so they are carved from per size class slabs instead of going to the system allocator each time; the
+// largest class holds a full MAXTRANS packetbuf, which is what sendf and friends start out with
+// ENet is only ever driven from the main thread, so the pools take no locks
+VAR(netpool, 0, 1, 1);
+
+#define NETPOOLCLASSES 9
+#define NETPOOLMINSIZE 32
+#define NETPOOLHEADER 16
+#define NETPOOLSLAB 0x10000
+#define NETPOOLMAXSLABS 64
+
+struct netpoolblock { netpoolblock *next; };
+
+struct netpoolclass
+{
+    netpoolblock *freelist;
+    int slabs;
+    uint allocs, inuse, peak;
+};
+
+static netpoolclass netpools[NETPOOLCLASSES];
+static uint netpoolsysallocs = 0;
+
+static inline int netpoolsize(int c) { return NETPOOLMINSIZE<<c; }
+
+static bool refillnetpool(int c)
+{
+    netpoolclass &p = netpools[c];
+    if(p.slabs >= NETPOOLMAXSLABS) return false;
+    int blocksize = NETPOOLHEADER + netpoolsize(c), numblocks = max(NETPOOLSLAB/blocksize, 8);
+    uchar *slab = (uchar *)malloc(blocksize*numblocks);
+    if(!slab) return false;
+    netpoolsysallocs++;
+    p.slabs++;
+    loopi(numblocks)
+    {
+        netpoolblock *b = (netpoolblock *)&slab[i*blocksize];
+        b->next = p.freelist;
+        p.freelist = b;
+    }
+    return true;
+}
+
+static void * ENET_CALLBACK netpoolalloc(size_t size)
+{
+    if(netpool && size <= size_t(netpoolsize(NETPOOLCLASSES-1)))
+    {
+        int c = 0;
+        while(size_t(netpoolsize(c)) < size) c++;
+        netpoolclass &p = netpools[c];
+        if(p.freelist || refillnetpool(c))
+        {
+            uchar *block = (uchar *)p.freelist;
+            p.freelist = p.freelist->next;
+            *(int *)block = c;
+            p.allocs++;
+            p.peak = max(p.peak, ++p.inuse);
+            return block + NETPOOLHEADER;
+        }
+    }
+    // blocks remember where they came from, so toggling netpool with packets in flight is safe
+    uchar *block = (uchar *)malloc(NETPOOLHEADER + size);
+    if(!block) return NULL;
+    netpoolsysallocs++;
+    *(int *)block = -1;
+    return block + NETPOOLHEADER;
+}
+
+static void ENET_CALLBACK netpoolfree(void *mem)
+{
+    if(!mem) return;
+    uchar *block = (uchar *)mem - NETPOOLHEADER;
+    int c = *(int *)block;
+    if(c < 0) { free(block); return; }
+    netpoolclass &p = netpools[c];
+    netpoolblock *b = (netpoolblock *)block;
+    b->next = p.freelist;
+    p.freelist = b;
+    p.inuse--;
+}
+
+int initnetwork()
+{
+    ENetCallbacks callbacks = { netpoolalloc, netpoolfree, NULL };
+    return enet_initialize_with_callbacks(ENET_VERSION, &callbacks);
+}
+
+void netpoolstats()
+{
+    conoutf("net pools (%s): %u system allocations", netpool ? "enabled" : "disabled", netpoolsysallocs);
+    loopi(NETPOOLCLASSES)
+    {
+        netpoolclass &p = netpools[i];
+        if(p.slabs) conoutf("  %5d bytes: %u allocations, %u in use, %u peak, %d slabs", netpoolsize(i), p.allocs, p.inuse, p.peak, p.slabs);
+    }
+}
+COMMAND(netpoolstats, "");
+
+// what a 32 player server tick allocates: every client sends a position and a reliable message, which arrive as incoming
+// commands and get acknowledged, and every client is sent a position and a message packet built up through packetbuf
+static void netpooltick(vector<ENetPacket *> &packets, vector<void *> &commands)
+{
+    const int players = 32;
+    loopi(players)
+    {
+        packets.add(enet_packet_create(NULL, 24, 0));
+        commands.add(enet_malloc(sizeof(ENetIncomingCommand)));
+        packets.add(enet_packet_create(NULL, 16, ENET_PACKET_FLAG_RELIABLE));
+        commands.add(enet_malloc(sizeof(ENetIncomingCommand)));
+        commands.add(enet_malloc(sizeof(ENetAcknowledgement)));
+    }
+    loopi(players)
+    {
+        packetbuf pos(MAXTRANS);
+        loopj(players-1) { putuint(pos, j); pos.put((const uchar *)"0123456789abcdef", 16); }
+        // queueing on a peer takes a reference, which keeps packetbuf from destroying the packet
+        packets.add(pos.finalize())->referenceCount++;
+        commands.add(enet_malloc(sizeof(ENetOutgoingCommand)));
+        packetbuf msg(16, ENET_PACKET_FLAG_RELIABLE);
+        loopj(players) putint(msg, j);
+        packets.add(msg.finalize())->referenceCount++;
+        commands.add(enet_malloc(sizeof(ENetOutgoingCommand)));
+    }
+    loopv(packets) enet_packet_destroy(packets[i]);
+    loopv(commands) enet_free(commands[i]);
+    packets.setsize(0);
+    commands.setsize(0);
+}
+
+void netpoolbench(int *iters)
+{
+    int ticks = *iters > 0 ? *iters : 10000, oldnetpool = netpool;
+    vector<ENetPacket *> packets;
+    vector<void *> commands;
+    loopk(2)
+    {
+        netpool = k;
+        netpooltick(packets, commands);
+        uint sysallocs = netpoolsysallocs, start = profiletime();
+        loopi(ticks) netpooltick(packets, commands);
+        uint elapsed = profiletime() - start;
+        conoutf("%s: %d ticks, %.1f system allocations/tick, %.2f us/tick", k ? "pooled" : "malloc", ticks, double(netpoolsysallocs - sysallocs)/ticks, double(elapsed)/ticks);
+    }
+    netpool = oldnetpool;
+}
+COMMAND(netpoolbench, "i");
+
 void process(ENetPacket *packet, int sender, int chan);
 //void disconnect_client(int n, int reason);
 
@@ -239,6 +828,7 @@ void sendpacket(int n, int chan, ENetPacket *packet, int exclude)
     {
         case ST_TCPIP:
         {
+            if(serverprofile) profilesent(packet);
             enet_peer_send(clients[n]->peer, chan, packet);
             break;
         }
@@ -269,7 +859,7 @@ ENetPacket *sendf(int cn, int chan, const char *format, ...)
         {
             int n = va_arg(args, int);
             int *v = va_arg(args, int *);
-            loopi(n) putint(p, v[i]);
+            putints(p, v, n);
             break;
         }
 
@@ -363,7 +953,9 @@ void kicknonlocalclients(int reason)
 void process(ENetPacket *packet, int sender, int chan)   // sender may be -1
 {
     packetbuf p(packet);
+    uint start = serverprofile ? profiletime() : 0;
     server::parsepacket(sender, chan, p);
+    profilesection(PROF_PARSEPACKET, start);
     if(p.overread()) { disconnect_client(sender, DISC_EOP); return; }
 }
 
@@ -393,57 +985,116 @@ int localclients = 0, nonlocalclients = 0;
 bool hasnonlocalclients() { return nonlocalclients!=0; }
 bool haslocalclients() { return localclients!=0; }
 
-#ifdef STANDALONE
-bool resolverwait(const char *name, ENetAddress *address)
-{
-    return enet_address_set_host(address, name) >= 0;
-}
+enum { MASTER_DISCONNECTED = 0, MASTER_RESOLVING, MASTER_CONNECTING, MASTER_CONNECTED };
 
-int connectwithtimeout(ENetSocket sock, const char *hostname, const ENetAddress &remoteaddress)
-{
-    int result = enet_socket_connect(sock, &remoteaddress);
-    if(result<0) enet_socket_destroy(sock);
-    return result;
-}
-#endif
+#define MAXMASTEROUT (64*1024)
+#define MASTERCONNECTLIMIT 20000
+#define MASTERBACKOFFMIN 1000
+#define MASTERBACKOFFMAX (5*60*1000)
 
 ENetSocket mastersock = ENET_SOCKET_NULL;
 ENetAddress masteraddress = { ENET_HOST_ANY, ENET_PORT_ANY }, serveraddress = { ENET_HOST_ANY, ENET_PORT_ANY };
 int lastupdatemaster = 0;
 vector<char> masterout, masterin;
 int masteroutpos = 0, masterinpos = 0;
+int masterstate = MASTER_DISCONNECTED, masterconnecttime = 0, masterretrytime = 0, masterbackoff = 0;
 VARN(updatemaster, allowupdatemaster, 0, 1, 1);
 
-void disconnectmaster()
+// name lookups block, so they run on a helper thread that the server loop polls
+SDL_Thread *masterresolver = NULL;
+SDL_mutex *masterresolvelock = NULL;
+string masterresolvename;
+ENetAddress masterresolveaddress;
+int masterresolveresult = 0;
+
+static int resolvemaster(void *data)
+{
+    ENetAddress address = { ENET_HOST_ANY, ENET_PORT_ANY };
+    int result = enet_address_set_host(&address, masterresolvename) >= 0 ? 1 : -1;
+    SDL_LockMutex(masterresolvelock);
+    masterresolveaddress = address;
+    masterresolveresult = result;
+    SDL_UnlockMutex(masterresolvelock);
+    return 0;
+}
+
+void closemaster()
 {
-    if(mastersock != ENET_SOCKET_NULL) 
+    if(mastersock != ENET_SOCKET_NULL)
     {
         enet_socket_destroy(mastersock);
         mastersock = ENET_SOCKET_NULL;
     }
 
+    bool pending = masterstate != MASTER_DISCONNECTED;
+    masterstate = MASTER_DISCONNECTED;
+
     masterout.setsize(0);
     masterin.setsize(0);
     masteroutpos = masterinpos = 0;
 
+    lastupdatemaster = 0;
+
+    if(pending) server::masterdisconnected();
+}
+
+void disconnectmaster()
+{
+    closemaster();
+
     masteraddress.host = ENET_HOST_ANY;
     masteraddress.port = ENET_PORT_ANY;
 
-    lastupdatemaster = 0;
+    masterretrytime = masterbackoff = 0;
+}
+
+void masterfailed(const char *reason)
+{
+    closemaster();
+
+    masterbackoff = clamp(masterbackoff*2, MASTERBACKOFFMIN, MASTERBACKOFFMAX);
+#ifdef STANDALONE
+    logoutf("master server %s, retrying in %d seconds", reason, masterbackoff/1000);
+#endif
+    masterretrytime = totalmillis + masterbackoff;
+    if(!masterretrytime) masterretrytime = 1;
 }
 
 SVARF(mastername, server::defaultmaster(), disconnectmaster());
 VARF(masterport, 1, server::masterport(), 0xFFFF, disconnectmaster());
 
+void startmasterconnect()
+{
+    mastersock = enet_socket_create(ENET_SOCKET_TYPE_STREAM);
+    if(mastersock != ENET_SOCKET_NULL && serveraddress.host != ENET_HOST_ANY && enet_socket_bind(mastersock, &serveraddress) < 0)
+    {
+        enet_socket_destroy(mastersock);
+        mastersock = ENET_SOCKET_NULL;
+    }
+    if(mastersock == ENET_SOCKET_NULL) { masterfailed("socket could not be opened"); return; }
+
+    enet_socket_set_option(mastersock, ENET_SOCKOPT_NONBLOCK, 1);
+    if(enet_socket_connect(mastersock, &masteraddress) < 0)
+    {
+#ifdef WIN32
+        bool inprogress = WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+        bool inprogress = errno == EINPROGRESS;
+#endif
+        if(!inprogress) { masterfailed("could not be connected"); return; }
+    }
+    masterstate = MASTER_CONNECTING;
+    masterconnecttime = totalmillis;
+}
+
+#ifndef STANDALONE
+// blocking connect used by the server browser, which shows its own progress while waiting
 ENetSocket connectmaster()
 {
     if(!mastername[0]) return ENET_SOCKET_NULL;
 
     if(masteraddress.host == ENET_HOST_ANY)
     {
-#ifdef STANDALONE
-        logoutf("looking up %s...", mastername);
-#endif
         masteraddress.port = masterport;
         if(!resolverwait(mastername, &masteraddress)) return ENET_SOCKET_NULL;
     }
@@ -453,30 +1104,104 @@ ENetSocket connectmaster()
         enet_socket_destroy(sock);
         sock = ENET_SOCKET_NULL;
     }
-    if(sock == ENET_SOCKET_NULL || connectwithtimeout(sock, mastername, masteraddress) < 0) 
+    if(sock == ENET_SOCKET_NULL || connectwithtimeout(sock, mastername, masteraddress) < 0) return ENET_SOCKET_NULL;
+
+    enet_socket_set_option(sock, ENET_SOCKOPT_NONBLOCK, 1);
+    return sock;
+}
+#endif
+
+bool startmaster()
+{
+    if(!mastername[0] || (masterretrytime && totalmillis - masterretrytime < 0)) return false;
+    masterretrytime = 0;
+
+    if(masteraddress.host == ENET_HOST_ANY)
     {
+        if(masterresolver) return false;
 #ifdef STANDALONE
-        logoutf(sock==ENET_SOCKET_NULL ? "could not open socket" : "could not connect"); 
+        logoutf("looking up %s...", mastername);
 #endif
-        return ENET_SOCKET_NULL;
+        if(!masterresolvelock) masterresolvelock = SDL_CreateMutex();
+        copystring(masterresolvename, mastername);
+        masterresolveresult = 0;
+        masterresolver = SDL_CreateThread(resolvemaster, NULL);
+        if(!masterresolver) { masterfailed("lookup could not be started"); return false; }
+        masterstate = MASTER_RESOLVING;
+        masterconnecttime = totalmillis;
+        return true;
     }
-    
-    enet_socket_set_option(sock, ENET_SOCKOPT_NONBLOCK, 1);
-    return sock;
+
+    startmasterconnect();
+    return masterstate != MASTER_DISCONNECTED;
 }
 
-bool requestmaster(const char *req)
+void checkmasterresolve()
+{
+    if(!masterresolver) return;
+    SDL_LockMutex(masterresolvelock);
+    int result = masterresolveresult;
+    ENetAddress address = masterresolveaddress;
+    SDL_UnlockMutex(masterresolvelock);
+    if(!result)
+    {
+        if(masterstate == MASTER_RESOLVING && totalmillis - masterconnecttime > MASTERCONNECTLIMIT)
+        {
+            // leave the lookup running, it is reaped once it returns
+            masterfailed("lookup timed out");
+        }
+        return;
+    }
+
+    SDL_WaitThread(masterresolver, NULL);
+    masterresolver = NULL;
+    if(masterstate != MASTER_RESOLVING || strcmp(masterresolvename, mastername)) return;
+    if(result < 0) { masterfailed("could not be resolved"); return; }
+    masteraddress.host = address.host;
+    masteraddress.port = masterport;
+    startmasterconnect();
+}
+
+void checkmasterconnect(bool writable)
 {
-    if(mastersock == ENET_SOCKET_NULL)
+    if(masterstate != MASTER_CONNECTING) return;
+    if(writable)
     {
-        mastersock = connectmaster();
-        if(mastersock == ENET_SOCKET_NULL) return false;
+        int err = 0;
+#ifdef WIN32
+        int len = sizeof(err);
+#else
+        socklen_t len = sizeof(err);
+#endif
+        if(getsockopt(mastersock, SOL_SOCKET, SO_ERROR, (char *)&err, &len) < 0 || err) { masterfailed("could not be connected"); return; }
+        masterstate = MASTER_CONNECTED;
+        masterbackoff = 0;
     }
+    else if(totalmillis - masterconnecttime > MASTERCONNECTLIMIT) masterfailed("connection timed out");
+}
+
+bool requestmaster(const char *req)
+{
+    if(masterstate == MASTER_DISCONNECTED && !startmaster()) return false;
 
-    masterout.put(req, strlen(req));
+    int len = strlen(req);
+    if(masterout.length() - masteroutpos + len > MAXMASTEROUT) return false;
+    if(masteroutpos > 0 && masterout.length() + len > MAXMASTEROUT)
+    {
+        masterout.remove(0, masteroutpos);
+        masteroutpos = 0;
+    }
+    masterout.put(req, len);
     return true;
 }
 
+void masterstatus()
+{
+    static const char * const states[] = { "disconnected", "resolving", "connecting", "connected" };
+    conoutf("master %s: %s, %d bytes queued, backoff %d ms%s", mastername, states[masterstate], masterout.length() - masteroutpos, masterbackoff, masterretrytime ? ", waiting to retry" : "");
+}
+COMMAND(masterstatus, "");
+
 bool requestmasterf(const char *fmt, ...)
 {
     defvformatstring(req, fmt, fmt);
@@ -517,7 +1242,7 @@ void processmasterinput()
 
 void flushmasteroutput()
 {
-    if(masterout.empty()) return;
+    if(masterstate != MASTER_CONNECTED || masterout.empty()) return;
 
     ENetBuffer buf;
     buf.data = &masterout[masteroutpos];
@@ -532,7 +1257,7 @@ void flushmasteroutput()
             masteroutpos = 0;
         }
     }
-    else disconnectmaster();
+    else masterfailed("connection was lost");
 }
 
 void flushmasterinput()
@@ -549,7 +1274,7 @@ void flushmasterinput()
         masterin.advance(recv);
         processmasterinput();
     }
-    else disconnectmaster();
+    else masterfailed("connection was lost");
 }
 
 static ENetAddress pongaddr;
@@ -568,21 +1293,29 @@ void sendserverinforeply(ucharbuf &p)
 
 void checkserversockets()        // reply all server info requests
 {
-    static ENetSocketSet sockset;
+    static ENetSocketSet sockset, connset;
     ENET_SOCKETSET_EMPTY(sockset);
+    ENET_SOCKETSET_EMPTY(connset);
     ENetSocket maxsock = pongsock;
     ENET_SOCKETSET_ADD(sockset, pongsock);
+    checkmasterresolve();
     if(mastersock != ENET_SOCKET_NULL)
     {
         maxsock = max(maxsock, mastersock);
-        ENET_SOCKETSET_ADD(sockset, mastersock);
+        if(masterstate == MASTER_CONNECTING) ENET_SOCKETSET_ADD(connset, mastersock);
+        else ENET_SOCKETSET_ADD(sockset, mastersock);
     }
     if(lansock != ENET_SOCKET_NULL)
     {
         maxsock = max(maxsock, lansock);
         ENET_SOCKETSET_ADD(sockset, lansock);
     }
-    if(enet_socketset_select(maxsock, &sockset, NULL, 0) <= 0) return;
+    if(enet_socketset_select(maxsock, &sockset, &connset, 0) <= 0)
+    {
+        checkmasterconnect(false);
+        return;
+    }
+    checkmasterconnect(mastersock != ENET_SOCKET_NULL && ENET_SOCKETSET_CHECK(connset, mastersock));
 
     ENetBuffer buf;
     uchar pong[MAXTRANS];
@@ -600,7 +1333,7 @@ void checkserversockets()        // reply all server info requests
         server::serverinforeply(req, p);
     }
 
-    if(mastersock != ENET_SOCKET_NULL && ENET_SOCKETSET_CHECK(sockset, mastersock)) flushmasterinput();
+    if(masterstate == MASTER_CONNECTED && ENET_SOCKETSET_CHECK(sockset, mastersock)) flushmasterinput();
 }
 
 #define DEFAULTCLIENTS 8
@@ -616,7 +1349,7 @@ int curtime = 0, lastmillis = 0, totalmillis = 0;
 
 void updatemasterserver()
 {
-    if(mastername[0] && allowupdatemaster) requestmasterf("regserv %d\n", serverport);
+    if(mastername[0] && allowupdatemaster && !requestmasterf("regserv %d\n", serverport) && masterretrytime) return; // register again once the backoff expires
     lastupdatemaster = totalmillis ? totalmillis : 1;
 }
 
@@ -645,7 +1378,9 @@ void serverslice(bool dedicated, uint timeout)   // main server update, called f
         totalmillis = millis;
         lastmillis += curtime;
     }
+    uint tickstart = serverprofile ? profiletime() : 0, updatestart = tickstart, enetwait = 0;
     server::serverupdate();
+    profilesection(PROF_SERVERUPDATE, updatestart);
 
     flushmasteroutput();
     checkserversockets();
@@ -658,6 +1393,7 @@ void serverslice(bool dedicated, uint timeout)   // main server update, called f
         laststatus = totalmillis;     
         if(nonlocalclients || serverhost->totalSentData || serverhost->totalReceivedData) logoutf("status: %d remote clients, %.1f send, %.1f rec (K/sec)", nonlocalclients, serverhost->totalSentData/60.0f/1024, serverhost->totalReceivedData/60.0f/1024);
         serverhost->totalSentData = serverhost->totalReceivedData = 0;
+        if(serverprofile) profilestats();
     }
 
     ENetEvent event;
@@ -666,7 +1402,15 @@ void serverslice(bool dedicated, uint timeout)   // main server update, called f
     {
         if(enet_host_check_events(serverhost, &event) <= 0)
         {
-            if(enet_host_service(serverhost, &event, timeout) <= 0) break;
+            uint servicestart = serverprofile ? profiletime() : 0;
+            int serviceresult = enet_host_service(serverhost, &event, timeout);
+            if(serverprofile)
+            {
+                uint servicetime = profiletime() - servicestart;
+                profilesection(PROF_ENETSERVICE, servicestart);
+                enetwait += servicetime;
+            }
+            if(serviceresult <= 0) break;
             serviced = true;
         }
         switch(event.type)
@@ -677,6 +1421,7 @@ void serverslice(bool dedicated, uint timeout)   // main server update, called f
                 c.type = ST_TCPIP;
                 c.peer = event.peer;
                 c.peer->data = &c;
+                c.peer->compress = servercompress && event.data&1 ? ENET_PEER_COMPRESS_ON : ENET_PEER_COMPRESS_OFF;
                 char hn[1024];
                 copystring(c.hostname, (enet_address_get_host_ip(&c.peer->address, hn, sizeof(hn))==0) ? hn : "unknown");
                 logoutf("client connected (%s)", c.hostname);
@@ -709,7 +1454,18 @@ void serverslice(bool dedicated, uint timeout)   // main server update, called f
                 break;
         }
     }
-    if(server::sendpackets()) enet_host_flush(serverhost);
+    if(server::sendpackets())
+    {
+        uint flushstart = serverprofile ? profiletime() : 0;
+        enet_host_flush(serverhost);
+        profilesection(PROF_ENETFLUSH, flushstart);
+    }
+    if(serverprofile)
+    {
+        // the service call blocks for up to the timeout waiting on packets, so it is left out of the tick
+        profticktimes[PROF_TICK] += profiletime() - tickstart - enetwait;
+        profiletick();
+    }
 }
 
 void flushserver(bool force)
@@ -1013,11 +1769,91 @@ void logoutfv(const char *fmt, va_list args)
 
 #endif
 
+// optional worker threads for the dedicated server, which the game uses to spread per-client work within a tick
+static vector<SDL_Thread *> serverworkers;
+static SDL_mutex *serverjoblock = NULL;
+static SDL_cond *serverjobcond = NULL, *serverdonecond = NULL;
+static void (*serverjob)(void *, int) = NULL;
+static void *serverjobdata = NULL;
+static int serverjobnext = 0, serverjobcount = 0, serverjobpending = 0;
+static bool serverworkersquit = false, serverworkersallowed = false;
+
+static void runserverjobs()
+{
+    while(serverjobnext < serverjobcount)
+    {
+        int i = serverjobnext++;
+        SDL_UnlockMutex(serverjoblock);
+        serverjob(serverjobdata, i);
+        SDL_LockMutex(serverjoblock);
+        if(--serverjobpending <= 0) SDL_CondSignal(serverdonecond);
+    }
+}
+
+static int serverworker(void *data)
+{
+    SDL_LockMutex(serverjoblock);
+    while(!serverworkersquit)
+    {
+        if(serverjobnext < serverjobcount) runserverjobs();
+        else SDL_CondWait(serverjobcond, serverjoblock);
+    }
+    SDL_UnlockMutex(serverjoblock);
+    return 0;
+}
+
+static void cleanupserverworkers()
+{
+    if(serverworkers.empty()) return;
+    SDL_LockMutex(serverjoblock);
+    serverworkersquit = true;
+    SDL_CondBroadcast(serverjobcond);
+    SDL_UnlockMutex(serverjoblock);
+    loopv(serverworkers) SDL_WaitThread(serverworkers[i], NULL);
+    serverworkers.setsize(0);
+    serverworkersquit = false;
+}
+
+static void setupserverworkers(int numthreads)
+{
+    cleanupserverworkers();
+    if(numthreads <= 0) return;
+    if(!serverjoblock) serverjoblock = SDL_CreateMutex();
+    if(!serverjobcond) serverjobcond = SDL_CreateCond();
+    if(!serverdonecond) serverdonecond = SDL_CreateCond();
+    loopi(numthreads)
+    {
+        SDL_Thread *thread = SDL_CreateThread(serverworker, NULL);
+        if(!thread) { conoutf(CON_WARN, "WARNING: could not create server worker thread"); break; }
+        serverworkers.add(thread);
+    }
+}
+
+VARF(serverthreads, 0, 0, 16, { if(serverworkersallowed) setupserverworkers(serverthreads); });
+
+// runs fn(data, i) for i in [0, n), spread over the worker threads, and returns once all of them are done
+void serverparallel(void (*fn)(void *, int), void *data, int n)
+{
+    if(serverworkers.empty() || n <= 1) { loopi(n) fn(data, i); return; }
+    SDL_LockMutex(serverjoblock);
+    serverjob = fn;
+    serverjobdata = data;
+    serverjobnext = 0;
+    serverjobcount = serverjobpending = n;
+    SDL_CondBroadcast(serverjobcond);
+    runserverjobs();
+    while(serverjobpending > 0) SDL_CondWait(serverdonecond, serverjoblock);
+    serverjobnext = serverjobcount = 0;
+    SDL_UnlockMutex(serverjoblock);
+}
+
 void rundedicatedserver()
 {
 #ifdef WIN32
     setupwindow("Cube 2: Sauerbraten server");
 #endif
+    serverworkersallowed = true;
+    setupserverworkers(serverthreads);
     logoutf("dedicated server started, waiting for clients...");
 #ifdef WIN32
     SetPriorityClass(GetCurrentProcess(), HIGH_PRIORITY_CLASS);
@@ -1061,6 +1897,7 @@ bool setuplistenserver(bool dedicated)
     }
     serverhost = enet_host_create(&address, min(maxclients + server::reserveclients(), MAXCLIENTS), server::numchannels(), 0, serveruprate);
     if(!serverhost) return servererror(dedicated, "could not create server host");
+    if(!setupcompression(serverhost)) conoutf(CON_WARN, "WARNING: could not set up transport compression");
     loopi(maxclients) serverhost->peers[i].data = NULL;
     address.port = server::serverinfoport(serverport > 0 ? serverport : -1);
     pongsock = enet_socket_create(ENET_SOCKET_TYPE_DATAGRAM);
@@ -1153,7 +1990,7 @@ vector<const char *> gameargs;
 int main(int argc, char **argv)
 {   
     setlogfile(NULL);
-    if(enet_initialize()<0) fatal("Unable to initialise network module");
+    if(initnetwork()<0) fatal("Unable to initialise network module");
     atexit(enet_deinitialize);
     enet_time_set(0);
     for(int i = 1; i<argc; i++) if(argv[i][0]!='-' || !serveroption(argv[i])) gameargs.add(argv[i]);
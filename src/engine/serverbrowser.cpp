@@ -530,11 +530,43 @@ char *showservers(g3d_gui *cgui)
     return newstring(command);
 }
 
+// the master list version we last synced with, so updates only need to fetch what changed since
+static string listmaster = "";
+static uint listepoch = 0;
+static int listversion = -1;
+
 void clearservers(bool full = false)
 {
     resolverclear();
     if(full) servers.deletecontents();
     else loopvrev(servers) if(!servers[i]->keep) delete servers.remove(i);
+    listversion = -1;
+}
+
+void delserver(const char *name, int port)
+{
+    if(port <= 0) port = server::serverport();
+    loopv(servers)
+    {
+        serverinfo *s = servers[i];
+        if(strcmp(s->name, name) || s->port != port || s->keep) continue;
+        // the resolver holds on to names it is still looking up, so those have to be abandoned first
+        if(s->resolved == RESOLVING)
+        {
+            resolverclear();
+            loopvj(servers) if(servers[j]->resolved == RESOLVING) servers[j]->resolved = UNRESOLVED;
+        }
+        delete servers.remove(i);
+        return;
+    }
+}
+
+void serverlistversion(int *epoch, int *version)
+{
+    extern char *mastername;
+    copystring(listmaster, mastername);
+    listepoch = uint(*epoch);
+    listversion = *version;
 }
 
 #define RETRIEVELIMIT 20000
@@ -549,7 +581,9 @@ void retrieveservers(vector<char> &data)
     renderprogress(0, text);
 
     int starttime = SDL_GetTicks(), timeout = 0;
-    const char *req = "list\n";
+    // masters that don't know listdelta ignore it and answer the plain list request after it
+    defformatstring(request)("listdelta %u %d\nlist\n", strcmp(listmaster, mastername) ? 0 : listepoch, listversion);
+    const char *req = request;
     int reqlen = strlen(req);
     ENetBuffer buf;
     while(reqlen > 0)
@@ -600,7 +634,7 @@ void updatefrommaster()
     if(data.empty()) conoutf("master server not replying");
     else
     {
-        clearservers();
+        if(!strstr(data.getbuf(), "serverlistversion")) clearservers();
         execute(data.getbuf());
     }
     refreshservers();
@@ -609,6 +643,8 @@ void updatefrommaster()
 ICOMMAND(addserver, "sis", (const char *name, int *port, const char *password), addserver(name, *port, password[0] ? password : NULL));
 ICOMMAND(keepserver, "sis", (const char *name, int *port, const char *password), addserver(name, *port, password[0] ? password : NULL, true));
 ICOMMAND(clearservers, "i", (int *full), clearservers(*full!=0));
+ICOMMAND(delserver, "si", (const char *name, int *port), delserver(name, *port));
+COMMAND(serverlistversion, "ii");
 COMMAND(updatefrommaster, "");
 
 void writeservercfg()
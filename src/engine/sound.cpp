@@ -542,7 +542,8 @@ void resetsound()
             Mix_HaltMusic();
             Mix_FreeMusic(music);
         }
-        if(musicstream) musicstream->seek(0, SEEK_SET);
+        // musicrw may read from memory with its own position rather than through musicstream
+        if(musicrw) SDL_RWseek(musicrw, 0, SEEK_SET);
         Mix_CloseAudio();
     }
     initsound();
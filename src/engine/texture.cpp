@@ -942,22 +942,114 @@ bool canloadsurface(const char *name)
     return true;
 }
 
-SDL_Surface *loadsurface(const char *name)
+/* Decoded images are kept in the asset cache as a small header followed by tightly packed
+ * rows, in the format fixsurfaceformat() leaves them in.
+ */
+
+struct cachedsurfaceheader
+{
+    char magic[4];
+    int w, h, bpp;
+};
+
+#define MAXCACHEDSURFACE (1<<14)
+
+static SDL_Surface *loadcachedsurface(const char *key)
 {
+    int size = 0;
+    char *buf = loadcachedasset("textures", key, &size);
+    if(!buf) return NULL;
     SDL_Surface *s = NULL;
-    stream *z = openzipfile(name, "rb");
-    if(z)
+    cachedsurfaceheader hdr;
+    if(size >= (int)sizeof(hdr))
+    {
+        memcpy(&hdr, buf, sizeof(hdr));
+        lilswap(&hdr.w, 3);
+        if(!memcmp(hdr.magic, "TEX1", 4) && (hdr.bpp==3 || hdr.bpp==4) &&
+           hdr.w > 0 && hdr.w <= MAXCACHEDSURFACE && hdr.h > 0 && hdr.h <= MAXCACHEDSURFACE &&
+           size == (int)sizeof(hdr) + hdr.w*hdr.h*hdr.bpp)
+        {
+            s = hdr.bpp==3 ?
+                SDL_CreateRGBSurface(SDL_SWSURFACE, hdr.w, hdr.h, 24, RGBMASKS) :
+                SDL_CreateRGBSurface(SDL_SWSURFACE, hdr.w, hdr.h, 32, RGBAMASKS);
+            if(s)
+            {
+                const uchar *src = (const uchar *)&buf[sizeof(hdr)];
+                uchar *dst = (uchar *)s->pixels;
+                loopi(hdr.h)
+                {
+                    memcpy(dst, src, hdr.w*hdr.bpp);
+                    src += hdr.w*hdr.bpp;
+                    dst += s->pitch;
+                }
+            }
+        }
+    }
+    delete[] buf;
+    return s;
+}
+
+static void storecachedsurface(const char *key, SDL_Surface *s)
+{
+    int bpp = s->format->BytesPerPixel;
+    if((bpp!=3 && bpp!=4) || s->w > MAXCACHEDSURFACE || s->h > MAXCACHEDSURFACE) return;
+    int size = sizeof(cachedsurfaceheader) + s->w*s->h*bpp;
+    uchar *buf = new uchar[size];
+    cachedsurfaceheader hdr;
+    memcpy(hdr.magic, "TEX1", 4);
+    hdr.w = s->w;
+    hdr.h = s->h;
+    hdr.bpp = bpp;
+    lilswap(&hdr.w, 3);
+    memcpy(buf, &hdr, sizeof(hdr));
+    uchar *dst = &buf[sizeof(hdr)];
+    const uchar *src = (const uchar *)s->pixels;
+    loopi(s->h)
+    {
+        memcpy(dst, src, s->w*bpp);
+        dst += s->w*bpp;
+        src += s->pitch;
+    }
+    storecachedasset("textures", key, buf, size);
+    delete[] buf;
+}
+
+static SDL_Surface *decodesurface(const char *name, SDL_RWops *rw)
+{
+    if(!rw) return NULL;
+    const char *ext = strrchr(name, '.');
+    if(ext && strpbrk(ext, "/\\")) ext = NULL;
+    SDL_Surface *s = fixsurfaceformat(IMG_LoadTyped_RW(rw, 0, (char *)(ext ? ext+1 : "")));
+    SDL_FreeRW(rw);
+    return s;
+}
+
+SDL_Surface *loadsurface(const char *name)
+{
+    int size = 0;
+    char *buf = loadprefetched(name, &size);
+    if(!buf)
     {
-        SDL_RWops *rw = z->rwops();
-        if(rw) 
+        if(!assetcache)
         {
-            s = IMG_Load_RW(rw, 0);
-            SDL_FreeRW(rw);
+            stream *f = openfile(name, "rb");
+            if(!f) return NULL;
+            SDL_Surface *s = decodesurface(name, f->rwops());
+            delete f;
+            return s;
         }
-        delete z;
+        buf = loadfile(name, &size);
+        if(!buf) return NULL;
+    }
+    string key;
+    SDL_Surface *s = assetcachekey(buf, size, key, sizeof(key)) ? loadcachedsurface(key) : NULL;
+    if(!s)
+    {
+        s = decodesurface(name, SDL_RWFromConstMem(buf, size));
+        if(s && key[0]) storecachedsurface(key, s);
     }
-    if(!s) s = IMG_Load(findfile(name, "rb"));
-    return fixsurfaceformat(s);
+    delete[] buf;
+    return s;
 }
    
 static vec parsevec(const char *arg)
@@ -1554,6 +1646,13 @@ void texture(char *type, char *name, int *rot, int *xoffset, int *yoffset, float
     st.t = NULL;
     copystring(st.name, name);
     path(st.name);
+    const char *file = st.name;
+    if(file[0]=='<' && (file = strrchr(file, '>'))) file++;
+    if(file)
+    {
+        defformatstring(pname)("packages/%s", file);
+        prefetchfile(path(pname));
+    }
     if(tnum==TEX_DIFFUSE)
     {
         setslotshader(s);
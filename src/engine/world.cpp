@@ -171,6 +171,7 @@ static bool modifyoctaent(int flags, int id)
     if(e.type == ET_LIGHT) clearlightcache(id);
     else if(e.type == ET_PARTICLES) clearparticleemitters();
     else if(flags&MODOE_ADD) lightent(e);
+    if(flags&MODOE_UPDATEBB) changedlight(e);
     return true;
 }
 
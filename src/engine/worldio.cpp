@@ -46,7 +46,35 @@ static void fixent(entity &e, int version)
     if(version <= 30 && (e.type == ET_MAPMODEL || e.type == ET_PLAYERSTART)) e.attr1 = (int(e.attr1)+180)%360;
 }
 
-bool loadents(const char *fname, vector<entity> &ents, uint *crc)
+enum { OCTSAV_CHILDREN = 0, OCTSAV_EMPTY, OCTSAV_SOLID, OCTSAV_NORMAL, OCTSAV_LODCUBE };
+
+struct mapviewcell
+{
+    uchar leafmask;
+    int children[8];
+};
+
+struct mappvs
+{
+    int scale;
+    vector<uchar> buf;
+    vector<int> offsets;
+    vector<mapviewcell> viewcells;
+
+    mappvs() : scale(0) {}
+
+    void clear()
+    {
+        scale = 0;
+        buf.setsize(0);
+        offsets.setsize(0);
+        viewcells.setsize(0);
+    }
+};
+
+static void loadmappvs(stream *f, const octaheader &hdr, int eif, mappvs &pvs);
+
+static bool loadmapents(const char *fname, vector<entity> &ents, uint *crc, mappvs *pvs)
 {
     string pakname, mapname, mcfgname, ogzname;
     getmapfilenames(fname, NULL, pakname, mapname, mcfgname);
@@ -146,6 +174,8 @@ bool loadents(const char *fname, vector<entity> &ents, uint *crc)
         }
     }
 
+    if(pvs) loadmappvs(f, hdr, eif, *pvs);
+
     if(crc)
     {
         f->seek(0, SEEK_END);
@@ -157,6 +187,265 @@ bool loadents(const char *fname, vector<entity> &ents, uint *crc)
     return true;
 }
 
+// with mapcachesize set, maps stay loaded so a server returning to one in its rotation doesn't parse
+// it again; entries are checked against the map file's size and modification time so replaced maps reload
+struct mapcache
+{
+    string name;
+    uint crc, size, mtime;
+    vector<entity> ents;
+    mappvs pvs;
+};
+
+static vector<mapcache *> mapcaches; // least recently used first
+static mappvs uncachedpvs, *curmappvs = NULL;
+
+VAR(mapcachesize, 0, 0, 64);
+
+static void mapfilestamp(const char *fname, uint &size, uint &mtime)
+{
+    string pakname, mapname, mcfgname, ogzname;
+    getmapfilenames(fname, NULL, pakname, mapname, mcfgname);
+    formatstring(ogzname)("packages/%s.ogz", mapname);
+    if(!getfilestamp(ogzname, size, mtime)) size = mtime = 0;
+}
+
+bool loadents(const char *fname, vector<entity> &ents, uint *crc, bool pvs)
+{
+    mapcache *mc = NULL;
+    uint size = 0, mtime = 0;
+    if(mapcachesize) mapfilestamp(fname, size, mtime);
+    loopv(mapcaches) if(mapcaches[i]->name[0] && !strcmp(mapcaches[i]->name, fname))
+    {
+        if(mapcaches[i]->size == size && mapcaches[i]->mtime == mtime) mc = mapcaches.remove(i);
+        // the file changed on disk: a stale entry still in use is unnamed and left for eviction
+        else if(&mapcaches[i]->pvs == curmappvs) mapcaches[i]->name[0] = '\0';
+        else delete mapcaches.remove(i);
+        break;
+    }
+    if(!mc)
+    {
+        if(!mapcachesize)
+        {
+            if(pvs) curmappvs = NULL;
+            if(!loadmapents(fname, ents, crc, pvs ? &uncachedpvs : NULL)) return false;
+            if(pvs) curmappvs = &uncachedpvs;
+            return true;
+        }
+        mc = new mapcache;
+        copystring(mc->name, fname);
+        mc->size = size;
+        mc->mtime = mtime;
+        if(!loadmapents(fname, mc->ents, &mc->crc, &mc->pvs)) { delete mc; return false; }
+        loopv(mapcaches)
+        {
+            if(mapcaches.length() < mapcachesize) break;
+            if(&mapcaches[i]->pvs == curmappvs) continue;
+            delete mapcaches.remove(i--);
+        }
+    }
+    mapcaches.add(mc);
+    ents.put(mc->ents.getbuf(), mc->ents.length());
+    if(crc) *crc = mc->crc;
+    if(pvs) curmappvs = &mc->pvs;
+    return true;
+}
+
+ICOMMAND(cachemap, "s", (char *name),
+{
+    vector<entity> ents;
+    if(!mapcachesize || !loadents(name, ents)) conoutf(CON_ERROR, "could not cache map %s", name);
+});
+
+// the server never builds the octree, so it skips over the geometry and lightmaps to reach the precomputed PVS
+
+static void skipchildren(stream *f, int version);
+
+static void skipc(stream *f, int version)
+{
+    int octsav = f->getchar();
+    switch(octsav&0x7)
+    {
+        case OCTSAV_CHILDREN: skipchildren(f, version); return;
+        case OCTSAV_NORMAL: f->seek(12, SEEK_CUR); break;
+    }
+    f->seek(version<14 ? 6 : 6*sizeof(ushort), SEEK_CUR);
+    if(version < 7) f->seek(3, SEEK_CUR);
+    else
+    {
+        uchar mask = f->getchar();
+        if(mask & 0x80) f->getchar();
+        if(mask & 0x3F)
+        {
+            int numsurfs = 6;
+            loopi(numsurfs) if(i >= 6 || mask & (1 << i))
+            {
+                uchar surface[16]; // surfaceinfo: texcoords[8], w, h, x, y, lmid, layer
+                f->read(surface, sizeof(surface));
+                if(i < 6)
+                {
+                    if(mask & 0x40) f->seek(4*3, SEEK_CUR); // surfacenormals
+                    if(surface[15]&(1<<1)) numsurfs++; // LAYER_BLEND
+                }
+            }
+        }
+        if(version >= 20 && octsav&0x80 && f->getchar()&0x80)
+        {
+            int mask = f->getchar();
+            loopi(6) if(mask&(1<<i)) f->seek(4*sizeof(ushort), SEEK_CUR); // mergeinfo
+        }
+    }
+    if((octsav&0x7) == OCTSAV_LODCUBE) skipchildren(f, version);
+}
+
+static void skipchildren(stream *f, int version)
+{
+    loopi(8) skipc(f, version);
+}
+
+// bit order follows the VSLOT_* enum in texture.h
+static void skipvslots(stream *f, int numvslots)
+{
+    while(numvslots > 0)
+    {
+        int changed = f->getlil<int>();
+        if(changed < 0) { numvslots += changed; continue; }
+        f->getlil<int>();
+        if(changed & (1<<0))
+        {
+            int numparams = f->getlil<ushort>();
+            loopi(numparams)
+            {
+                int nlen = f->getlil<ushort>();
+                f->seek(nlen + 4*sizeof(float), SEEK_CUR);
+            }
+        }
+        if(changed & (1<<1)) f->seek(sizeof(float), SEEK_CUR);
+        if(changed & (1<<2)) f->seek(sizeof(int), SEEK_CUR);
+        if(changed & (1<<3)) f->seek(2*sizeof(int), SEEK_CUR);
+        if(changed & (1<<4)) f->seek(2*sizeof(float), SEEK_CUR);
+        if(changed & (1<<5)) f->seek(sizeof(int), SEEK_CUR);
+        if(changed & (1<<6)) f->seek(2*sizeof(float), SEEK_CUR);
+        if(changed & (1<<7)) f->seek(3*sizeof(float), SEEK_CUR);
+        numvslots--;
+    }
+}
+
+void clearmappvs() { curmappvs = NULL; }
+
+static int loadmapviewcells(stream *f, vector<mapviewcell> &viewcells)
+{
+    int idx = viewcells.length();
+    viewcells.add().leafmask = f->getchar();
+    loopi(8)
+    {
+        int child = viewcells[idx].leafmask&(1<<i) ? f->getlil<int>() : loadmapviewcells(f, viewcells);
+        viewcells[idx].children[i] = child;
+    }
+    return idx;
+}
+
+static void loadmappvs(stream *f, const octaheader &hdr, int eif, mappvs &pvs)
+{
+    pvs.clear();
+    if(hdr.version < 25 || hdr.numpvs <= 0) return;
+
+    if(hdr.numents > MAXENTS) f->seek((hdr.numents-MAXENTS)*(sizeof(entity) + eif), SEEK_CUR);
+    skipvslots(f, hdr.numvslots);
+    skipchildren(f, hdr.version);
+    loopi(hdr.lightmaps)
+    {
+        int type = 0, bpp = 3; // see LM_* in lightmap.h
+        if(hdr.version >= 17)
+        {
+            type = f->getchar();
+            if(hdr.version >= 20 && type&0x80) f->seek(2*sizeof(ushort), SEEK_CUR);
+            type &= 0x7F;
+        }
+        if(type&0x10 && (type&0x0F)!=2) bpp = 4; // LM_ALPHA, unless LM_BUMPMAP1
+        f->seek(bpp*512*512, SEEK_CUR); // LM_PACKW*LM_PACKH
+    }
+
+    uint totallen = f->getlil<uint>();
+    if(totallen & 0x80000000U)
+    {
+        totallen &= ~0x80000000U;
+        int numwaterplanes = f->getlil<uint>();
+        f->seek(numwaterplanes*sizeof(int), SEEK_CUR);
+    }
+    int offset = 0;
+    loopi(hdr.numpvs)
+    {
+        pvs.offsets.add(offset);
+        offset += f->getlil<ushort>();
+    }
+    pvs.offsets.add(offset);
+    if(uint(offset) != totallen || f->read(pvs.buf.reserve(totallen).buf, totallen) != int(totallen))
+    {
+        conoutf(CON_WARN, "WARNING: map has malformatted PVS data");
+        pvs.clear();
+        return;
+    }
+    pvs.buf.advance(totallen);
+    loadmapviewcells(f, pvs.viewcells);
+    while(1<<pvs.scale < hdr.worldsize) pvs.scale++;
+}
+
+// same as octantrectangleoverlap, which the server doesn't have
+static inline uchar mappvsoverlap(const ivec &c, int size, const ivec &o, const ivec &s)
+{
+    uchar p = 0xFF;
+    ivec v(c);
+    v.add(size);
+    if(v.z <= o.z)     p &= 0xF0;
+    if(v.z >= o.z+s.z) p &= 0x0F;
+    if(v.y <= o.y)     p &= 0xCC;
+    if(v.y >= o.y+s.y) p &= 0x33;
+    if(v.x <= o.x)     p &= 0xAA;
+    if(v.x >= o.x+s.x) p &= 0x55;
+    return p;
+}
+
+static inline bool mappvsoccluded(const uchar *buf, const ivec &co, int size, const ivec &bborigin, const ivec &bbsize)
+{
+    uchar leafmask = buf[0], possible = mappvsoverlap(co, size, bborigin, bbsize);
+    loopi(8) if(possible&(1<<i))
+    {
+        ivec o(i, co.x, co.y, co.z, size);
+        if(leafmask&(1<<i))
+        {
+            uchar leafvalues = buf[1+i];
+            if(!leafvalues || (leafvalues!=0xFF && mappvsoverlap(o, size>>1, bborigin, bbsize)&~leafvalues))
+                return false;
+        }
+        else if(!mappvsoccluded(buf+9*buf[1+i], o, size>>1, bborigin, bbsize)) return false;
+    }
+    return true;
+}
+
+bool mappvsoccluded(const vec &viewer, const ivec &bborigin, const ivec &bbsize)
+{
+    if(!curmappvs || curmappvs->viewcells.empty()) return false;
+    const mappvs &pvs = *curmappvs;
+    uint x = uint(floor(viewer.x)), y = uint(floor(viewer.y)), z = uint(floor(viewer.z));
+    if((x|y|z)>=uint(1<<pvs.scale)) return false;
+    int cell = -1;
+    const mapviewcell *vc = &pvs.viewcells[0];
+    for(int scale = pvs.scale-1; scale>=0; scale--)
+    {
+        int i = (((z>>scale)&1)<<2) | (((y>>scale)&1)<<1) | ((x>>scale)&1);
+        if(vc->leafmask&(1<<i)) { cell = vc->children[i]; break; }
+        vc = &pvs.viewcells[vc->children[i]];
+    }
+    if(cell < 0 || cell >= pvs.offsets.length()-1) return false;
+
+    int diff = (bborigin.x^(bborigin.x+bbsize.x)) | (bborigin.y^(bborigin.y+bbsize.y)) | (bborigin.z^(bborigin.z+bbsize.z));
+    if(bborigin.x < 0 || bborigin.y < 0 || bborigin.z < 0 || diff&~((1<<pvs.scale)-1)) return false;
+    const uchar *buf = &pvs.buf[pvs.offsets[cell]];
+    buf += (pvs.offsets[cell+1] - pvs.offsets[cell])%9;
+    return mappvsoccluded(buf, ivec(0, 0, 0), 1<<(pvs.scale-1), bborigin, bbsize);
+}
+
 #ifndef STANDALONE
 string ogzname, bakname, cfgname, picname;
 
@@ -201,8 +490,6 @@ void backup(char *name, char *backupname)
     rename(findfile(name, "wb"), backupfile);
 }
 
-enum { OCTSAV_CHILDREN = 0, OCTSAV_EMPTY, OCTSAV_SOLID, OCTSAV_NORMAL, OCTSAV_LODCUBE };
-
 void savec(cube *c, stream *f, bool nolms)
 {
     loopi(8)
@@ -554,12 +841,16 @@ void loadvslots(stream *f, int numvslots)
     delete[] prev;
 }
 
+// splits saved maps into gzip members of this many KB that can be inflated in parallel on load,
+// 0 writes the single stream older builds expect
+VARP(mapblocksize, 0, 0, 16384);
+
 bool save_world(const char *mname, bool nolms)
 {
     if(!*mname) mname = game::getclientmap();
     setmapfilenames(*mname ? mname : "untitled");
     if(savebak) backup(ogzname, bakname);
-    stream *f = opengzfile(ogzname, "wb");
+    stream *f = opengzfile(ogzname, "wb", NULL, Z_BEST_COMPRESSION, mapblocksize<<10);
     if(!f) { conoutf(CON_WARN, "could not write map to %s", ogzname); return false; }
 
     int numvslots = vslots.length();
@@ -702,6 +993,7 @@ static void fixoversizedcubes(cube *c, int size)
 bool load_world(const char *mname, const char *cname)        // still supports all map formats that have existed since the earliest cube betas!
 {
     int loadingstart = SDL_GetTicks();
+    flushprefetched();
     setmapfilenames(mname, cname);
     stream *f = opengzfile(ogzname, "rb");
     if(!f) { conoutf(CON_ERROR, "could not read map %s", ogzname); return false; }
@@ -967,6 +1259,7 @@ bool load_world(const char *mname, const char *cname)        // still supports a
     attachentities();
     initlights();
     allchanged(true);
+    flushprefetched();
 
     renderbackground("loading...", mapshot, mname, game::getmapinfo());
 
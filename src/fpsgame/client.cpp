@@ -622,7 +622,7 @@ namespace game
                 {
                     int n = va_arg(args, int);
                     int *v = va_arg(args, int *);
-                    loopi(n) putint(p, v[i]);
+                    putints(p, v, n);
                     numi += n;
                     break;
                 }
@@ -677,6 +677,15 @@ namespace game
         if(editmode) toggleedit();
     }
 
+    static possnapshot possnapshots[POSHISTORY];
+    static int posack = 0, sentposack = 0;
+
+    void clearpossnapshots()
+    {
+        loopi(POSHISTORY) { possnapshots[i].seq = 0; possnapshots[i].entries.setsize(0); }
+        posack = sentposack = 0;
+    }
+
     void gamedisconnect(bool cleanup)
     {
         if(remote) stopfollowing();
@@ -687,6 +696,7 @@ namespace game
         messages.setsize(0);
         messagereliable = false;
         messagecn = -1;
+        clearpossnapshots();
         player1->respawn();
         player1->lifesequence = 0;
         player1->state = CS_ALIVE;
@@ -773,6 +783,14 @@ namespace game
 
     void sendpositions()
     {
+        if(posack != sentposack)
+        {
+            packetbuf q(10);
+            putint(q, N_POSACK);
+            putuint(q, posack);
+            sendclientpacket(q.finalize(), 0);
+            sentposack = posack;
+        }
         loopv(players)
         {
             fpsent *d = players[i];
@@ -879,6 +897,69 @@ namespace game
         }
     }
 
+    void applyposition(int cn, const int *f)
+    {
+        int physstate = f[POSF_PHYS], flags = f[POSF_FLAGS];
+        vec o, vel, falling;
+        float yaw, pitch, roll;
+        loopk(3) o[k] = f[POSF_X+k]/DMF;
+        int dir = f[POSF_DIR];
+        yaw = dir%360;
+        pitch = clamp(dir/360, 0, 180)-90;
+        roll = clamp(f[POSF_ROLL], 0, 180)-90;
+        dir = f[POSF_VELDIR];
+        vecfromyawpitch(dir%360, clamp(dir/360, 0, 180)-90, 1, 0, vel);
+        vel.mul(f[POSF_VEL]/DVELF);
+        if(flags&(1<<4))
+        {
+            if(flags&(1<<6))
+            {
+                dir = f[POSF_FALLDIR];
+                vecfromyawpitch(dir%360, clamp(dir/360, 0, 180)-90, 1, 0, falling);
+            }
+            else falling = vec(0, 0, -1);
+            falling.mul(f[POSF_FALL]/DVELF);
+        }
+        else falling = vec(0, 0, 0);
+        int seqcolor = (physstate>>3)&1;
+        fpsent *d = getclient(cn);
+        if(!d || d->lifesequence < 0 || seqcolor!=(d->lifesequence&1) || d->state==CS_DEAD) return;
+        float oldyaw = d->yaw, oldpitch = d->pitch;
+        d->yaw = yaw;
+        d->pitch = pitch;
+        d->roll = roll;
+        d->move = (physstate>>4)&2 ? -1 : (physstate>>4)&1;
+        d->strafe = (physstate>>6)&2 ? -1 : (physstate>>6)&1;
+        vec oldpos(d->o);
+        if(allowmove(d))
+        {
+            d->o = o;
+            d->o.z += d->eyeheight;
+            d->vel = vel;
+            d->falling = falling;
+            d->physstate = physstate&7;
+        }
+        updatephysstate(d);
+        updatepos(d);
+        if(smoothmove && d->smoothmillis>=0 && oldpos.dist(d->o) < smoothdist)
+        {
+            d->newpos = d->o;
+            d->newyaw = d->yaw;
+            d->newpitch = d->pitch;
+            d->o = oldpos;
+            d->yaw = oldyaw;
+            d->pitch = oldpitch;
+            (d->deltapos = oldpos).sub(d->newpos);
+            d->deltayaw = oldyaw - d->newyaw;
+            if(d->deltayaw > 180) d->deltayaw -= 360;
+            else if(d->deltayaw < -180) d->deltayaw += 360;
+            d->deltapitch = oldpitch - d->newpitch;
+            d->smoothmillis = lastmillis;
+        }
+        else d->smoothmillis = 0;
+        if(d->state==CS_LAGGED || d->state==CS_SPAWNING) d->state = CS_ALIVE;
+    }
+
     void parsepositions(ucharbuf &p)
     {
         int type;
@@ -886,71 +967,36 @@ namespace game
         {
             case N_POS:                        // position of another client
             {
-                int cn = getuint(p), physstate = p.get(), flags = getuint(p);
-                vec o, vel, falling;
-                float yaw, pitch, roll;
-                loopk(3)
-                {
-                    int n = p.get(); n |= p.get()<<8; if(flags&(1<<k)) { n |= p.get()<<16; if(n&0x800000) n |= -1<<24; }
-                    o[k] = n/DMF;
-                }
-                int dir = p.get(); dir |= p.get()<<8;
-                yaw = dir%360;
-                pitch = clamp(dir/360, 0, 180)-90;
-                roll = clamp(int(p.get()), 0, 180)-90;
-                int mag = p.get(); if(flags&(1<<3)) mag |= p.get()<<8;
-                dir = p.get(); dir |= p.get()<<8;
-                vecfromyawpitch(dir%360, clamp(dir/360, 0, 180)-90, 1, 0, vel);
-                vel.mul(mag/DVELF);
-                if(flags&(1<<4))
-                {
-                    mag = p.get(); if(flags&(1<<5)) mag |= p.get()<<8;
-                    if(flags&(1<<6))
-                    {
-                        dir = p.get(); dir |= p.get()<<8;
-                        vecfromyawpitch(dir%360, clamp(dir/360, 0, 180)-90, 1, 0, falling);
-                    }
-                    else falling = vec(0, 0, -1);
-                    falling.mul(mag/DVELF);
-                }
-                else falling = vec(0, 0, 0);
-                int seqcolor = (physstate>>3)&1;
-                fpsent *d = getclient(cn);
-                if(!d || d->lifesequence < 0 || seqcolor!=(d->lifesequence&1) || d->state==CS_DEAD) continue;
-                float oldyaw = d->yaw, oldpitch = d->pitch;
-                d->yaw = yaw;
-                d->pitch = pitch;
-                d->roll = roll;
-                d->move = (physstate>>4)&2 ? -1 : (physstate>>4)&1;
-                d->strafe = (physstate>>6)&2 ? -1 : (physstate>>6)&1;
-                vec oldpos(d->o);
-                if(allowmove(d))
-                {
-                    d->o = o;
-                    d->o.z += d->eyeheight;
-                    d->vel = vel;
-                    d->falling = falling;
-                    d->physstate = physstate&7;
-                }
-                updatephysstate(d);
-                updatepos(d);
-                if(smoothmove && d->smoothmillis>=0 && oldpos.dist(d->o) < smoothdist)
+                int cn = getuint(p), fields[NUMPOSFIELDS];
+                unpackposition(p, fields);
+                applyposition(cn, fields);
+                break;
+            }
+
+            case N_POSDELTA:                   // positions relative to a snapshot we acked
+            {
+                int seq = getuint(p), baseseq = getuint(p), num = getuint(p);
+                const possnapshot *base = NULL;
+                if(baseseq) loopi(POSHISTORY) if(possnapshots[i].seq == baseseq) { base = &possnapshots[i]; break; }
+                static possnapshot snap;
+                snap.entries.setsize(0);
+                static const int zerofields[NUMPOSFIELDS] = { 0 };
+                loopi(num)
                 {
-                    d->newpos = d->o;
-                    d->newyaw = d->yaw;
-                    d->newpitch = d->pitch;
-                    d->o = oldpos;
-                    d->yaw = oldyaw;
-                    d->pitch = oldpitch;
-                    (d->deltapos = oldpos).sub(d->newpos);
-                    d->deltayaw = oldyaw - d->newyaw;
-                    if(d->deltayaw > 180) d->deltayaw -= 360;
-                    else if(d->deltayaw < -180) d->deltayaw += 360;
-                    d->deltapitch = oldpitch - d->newpitch;
-                    d->smoothmillis = lastmillis;
+                    if(p.overread()) break;
+                    posentry &e = snap.entries.add();
+                    e.cn = getuint(p);
+                    const int *basefields = base ? base->find(e.cn) : NULL;
+                    getdelta(p, e.fields, basefields ? basefields : zerofields, NUMPOSFIELDS);
                 }
-                else d->smoothmillis = 0;
-                if(d->state==CS_LAGGED || d->state==CS_SPAWNING) d->state = CS_ALIVE;
+                // without the base snapshot the deltas are meaningless, so ask for full state instead
+                if(baseseq && !base) { posack = 0; break; }
+                possnapshot &dst = possnapshots[seq%POSHISTORY];
+                dst.seq = seq;
+                dst.entries.setsize(0);
+                dst.entries.put(snap.entries.getbuf(), snap.entries.length());
+                posack = seq;
+                loopv(snap.entries) applyposition(snap.entries[i].cn, snap.entries[i].fields);
                 break;
             }
 
@@ -1003,7 +1049,7 @@ namespace game
         else
         {
             d->gunselect = getint(p);
-            loopi(GUN_PISTOL-GUN_SG+1) d->ammo[GUN_SG+i] = getint(p);
+            getints(p, &d->ammo[GUN_SG], GUN_PISTOL-GUN_SG+1);
         }
     }
 
@@ -1490,6 +1536,14 @@ namespace game
                 break;
             }
 
+            case N_SEEKDEMO:
+            {
+                int secs = getint(p);
+                clearclients(false);
+                conoutf("demo seeked to %d:%02d", secs/60, secs%60);
+                break;
+            }
+
             case N_CURRENTMASTER:
             {
                 int mn = getint(p), priv = getint(p), mm = getint(p);
@@ -1731,6 +1785,13 @@ namespace game
     }
     COMMAND(stopdemo, "");
 
+    void seekdemo(int secs)
+    {
+        if(!demoplayback || (remote && player1->privilege<PRIV_ADMIN)) return;
+        addmsg(N_SEEKDEMO, "ri", secs);
+    }
+    ICOMMAND(seekdemo, "i", (int *secs), seekdemo(*secs));
+
     void recorddemo(int val)
     {
         if(remote && player1->privilege<PRIV_ADMIN) return;
@@ -232,6 +232,8 @@ enum
     N_ADDBOT, N_DELBOT, N_INITAI, N_FROMAI, N_BOTLIMIT, N_BOTBALANCE,
     N_MAPCRC, N_CHECKMAPS,
     N_SWITCHNAME, N_SWITCHMODEL, N_SWITCHTEAM,
+    N_POSDELTA, N_POSACK,
+    N_SEEKDEMO,
     NUMSV
 };
 
@@ -259,15 +261,67 @@ static const int msgsizes[] =               // size inclusive message token, 0 f
     N_ADDBOT, 2, N_DELBOT, 1, N_INITAI, 0, N_FROMAI, 2, N_BOTLIMIT, 2, N_BOTBALANCE, 2,
     N_MAPCRC, 0, N_CHECKMAPS, 1,
     N_SWITCHNAME, 0, N_SWITCHMODEL, 2, N_SWITCHTEAM, 0,
+    N_POSDELTA, 0, N_POSACK, 2,
+    N_SEEKDEMO, 2,
     -1
 };
 
+// quantized fields of an N_POS message, which N_POSDELTA sends as differences from a snapshot the client acked
+enum { POSF_PHYS = 0, POSF_FLAGS, POSF_X, POSF_Y, POSF_Z, POSF_DIR, POSF_ROLL, POSF_VEL, POSF_VELDIR, POSF_FALL, POSF_FALLDIR, NUMPOSFIELDS };
+
+static inline void unpackposition(ucharbuf &p, int *f)
+{
+    f[POSF_PHYS] = p.get();
+    int flags = f[POSF_FLAGS] = getuint(p);
+    loopk(3)
+    {
+        int n = p.get(); n |= p.get()<<8; if(flags&(1<<k)) { n |= p.get()<<16; if(n&0x800000) n |= -1<<24; }
+        f[POSF_X+k] = n;
+    }
+    int dir = p.get(); dir |= p.get()<<8;
+    f[POSF_DIR] = dir;
+    f[POSF_ROLL] = p.get();
+    int mag = p.get(); if(flags&(1<<3)) mag |= p.get()<<8;
+    f[POSF_VEL] = mag;
+    dir = p.get(); dir |= p.get()<<8;
+    f[POSF_VELDIR] = dir;
+    f[POSF_FALL] = f[POSF_FALLDIR] = 0;
+    if(flags&(1<<4))
+    {
+        mag = p.get(); if(flags&(1<<5)) mag |= p.get()<<8;
+        f[POSF_FALL] = mag;
+        if(flags&(1<<6)) { dir = p.get(); dir |= p.get()<<8; f[POSF_FALLDIR] = dir; }
+    }
+}
+
+#define POSHISTORY 8
+
+struct posentry
+{
+    int cn, fields[NUMPOSFIELDS];
+};
+
+struct possnapshot
+{
+    int seq;
+    vector<posentry> entries;
+
+    possnapshot() : seq(0) {}
+
+    const int *find(int cn) const
+    {
+        loopv(entries) if(entries[i].cn == cn) return entries[i].fields;
+        return NULL;
+    }
+};
+
 #define SAUERBRATEN_LANINFO_PORT 28784
 #define SAUERBRATEN_SERVER_PORT 28785
 #define SAUERBRATEN_SERVINFO_PORT 28786
 #define SAUERBRATEN_MASTER_PORT 28787
-#define PROTOCOL_VERSION 258            // bump when protocol changes
-#define DEMO_VERSION 1                  // bump when demo format changes
+#define PROTOCOL_VERSION 259            // bump when protocol changes
+#define DEMO_VERSION 2                  // bump when demo format changes
+#define DEMO_V1_PROTOCOL 258            // protocol of version 1 demos, whose messages the current protocol still reads
 #define DEMO_MAGIC "SAUERBRATEN_DEMO"
 
 struct demoheader
@@ -35,6 +35,7 @@ namespace server
         virtual ~gameevent() {}
 
         virtual bool flush(clientinfo *ci, int fmillis);
+        virtual void prepare(clientinfo *ci) {}
         virtual void process(clientinfo *ci) {}
 
         virtual bool keepable() const { return false; }
@@ -61,7 +62,11 @@ namespace server
         int id, gun;
         vec from, to;
         vector<hitinfo> hits;
+        bool checked;
 
+        shotevent() : checked(false) {}
+
+        void prepare(clientinfo *ci);
         void process(clientinfo *ci);
     };
 
@@ -72,6 +77,7 @@ namespace server
 
         bool keepable() const { return true; }
 
+        void prepare(clientinfo *ci);
         void process(clientinfo *ci);
     };
 
@@ -206,6 +212,28 @@ namespace server
 
     extern int gamemillis, nextexceeded;
 
+    #define MAXPOSHISTORY 64
+
+    struct posrecord
+    {
+        int millis;
+        vec o;
+    };
+
+    struct interestsource
+    {
+        clientinfo *ci;
+        int off, len;
+        float priority;
+
+        static int compare(const interestsource *x, const interestsource *y)
+        {
+            if(x->priority > y->priority) return -1;
+            if(x->priority < y->priority) return 1;
+            return 0;
+        }
+    };
+
     struct clientinfo
     {
         int clientnum, ownernum, connectmillis, sessionid, overflow;
@@ -228,6 +256,16 @@ namespace server
         bool warned, gameclip;
         ENetPacket *getdemo, *getmap, *clipboard;
         int lastclipboard, needclipboard;
+        vector<int> interestmillis;
+        int posbytes, posticks;
+        int posfields[NUMPOSFIELDS];
+        possnapshot possnapshots[POSHISTORY];
+        int posseq, posack;
+        vector<interestsource> interestcandidates;
+        vector<uchar> posupdate;
+        posrecord poshistory[MAXPOSHISTORY];
+        int numposhistory, lastposhistory;
+        int hitsaccepted, hitsrejected;
 
         clientinfo() : getdemo(NULL), getmap(NULL), clipboard(NULL) { reset(); }
         ~clientinfo() { events.deletecontents(); cleanclipboard(); }
@@ -291,6 +329,7 @@ namespace server
             clientmap[0] = '\0';
             mapcrc = 0;
             warned = false;
+            numposhistory = lastposhistory = 0;
             gameclip = false;
         }
 
@@ -321,9 +360,41 @@ namespace server
             aireinit = 0;
             needclipboard = 0;
             cleanclipboard();
+            interestmillis.setsize(0);
+            posbytes = posticks = 0;
+            loopi(POSHISTORY) { possnapshots[i].seq = 0; possnapshots[i].entries.setsize(0); }
+            posseq = posack = 0;
+            hitsaccepted = hitsrejected = 0;
             mapchange();
         }
 
+        void recordposition(int millis, const vec &o)
+        {
+            lastposhistory = (lastposhistory + 1)%MAXPOSHISTORY;
+            poshistory[lastposhistory].millis = millis;
+            poshistory[lastposhistory].o = o;
+            if(numposhistory < MAXPOSHISTORY) numposhistory++;
+        }
+
+        // where the client was at the given time, interpolated between the nearest recorded positions
+        vec rewindposition(int millis) const
+        {
+            if(!numposhistory) return state.o;
+            const posrecord *next = &poshistory[lastposhistory];
+            if(millis >= next->millis) return next->o;
+            loopi(numposhistory-1)
+            {
+                const posrecord &prev = poshistory[(lastposhistory + MAXPOSHISTORY - 1 - i)%MAXPOSHISTORY];
+                if(millis >= prev.millis)
+                {
+                    float t = next->millis > prev.millis ? float(millis - prev.millis)/(next->millis - prev.millis) : 0;
+                    return vec(next->o).sub(prev.o).mul(t).add(prev.o);
+                }
+                next = &prev;
+            }
+            return next->o;
+        }
+
         int geteventmillis(int servmillis, int clientmillis)
         {
             if(!timesync || (events.empty() && state.waitexpired(servmillis)))
@@ -338,7 +409,7 @@ namespace server
 
     struct worldstate
     {
-        int uses;
+        int uses, index;
         vector<uchar> positions, messages;
     };
 
@@ -397,9 +468,34 @@ namespace server
     #define MAXDEMOS 5
     vector<demofile> demos;
 
+    struct demochunk
+    {
+        int millis;
+        vector<uchar> data;
+    };
+
+    struct demoindexentry
+    {
+        int millis, offset;
+    };
+
+    #define DEMO_KEYFRAME -1
+
     bool demonextmatch = false;
-    stream *demotmp = NULL, *demorecord = NULL, *demoplayback = NULL;
+    stream *demotmp = NULL, *demoplayback = NULL;
+    bool demorecord = false;
     int nextplayback = 0, demomillis = 0;
+    demochunk *curdemochunk = NULL;
+    vector<demochunk *> demoqueue;
+    vector<demoindexentry> demoindex, demorecordindex; // demorecordindex belongs to the writer thread until it is joined
+    SDL_Thread *demowriter = NULL;
+    SDL_mutex *demolock = NULL;
+    SDL_cond *democond = NULL;
+    bool demowriterdone = false;
+    vector<uchar> demoplaychunk;
+    int demoplaypos = 0, demoplaynext = 0;
+
+    VAR(demokeyframes, 1000, 10000, 10*60*1000);
 
     SVAR(serverdesc, "");
     SVAR(serverpass, "");
@@ -468,6 +564,7 @@ namespace server
         mcrc = 0;
         ments.setsize(0);
         sents.setsize(0);
+        clearmappvs();
         //cps.reset();
     }
 
@@ -701,11 +798,78 @@ namespace server
 
     void writedemo(int chan, void *data, int len)
     {
-        if(!demorecord) return;
+        if(!demorecord || !curdemochunk) return;
         int stamp[3] = { gamemillis, chan, len };
         lilswap(stamp, 3);
-        demorecord->write(stamp, sizeof(stamp));
-        demorecord->write(data, len);
+        curdemochunk->data.put((uchar *)stamp, sizeof(stamp));
+        curdemochunk->data.put((uchar *)data, len);
+    }
+
+    static int writedemochunks(void *data)
+    {
+        SDL_LockMutex(demolock);
+        for(;;)
+        {
+            if(demoqueue.empty())
+            {
+                if(demowriterdone) break;
+                SDL_CondWait(democond, demolock);
+                continue;
+            }
+            demochunk *c = demoqueue.remove(0);
+            SDL_UnlockMutex(demolock);
+
+            uLongf complen = compressBound(c->data.length());
+            uchar *comp = new uchar[complen];
+            if(compress2(comp, &complen, c->data.getbuf(), c->data.length(), Z_BEST_COMPRESSION) == Z_OK)
+            {
+                demoindexentry &e = demorecordindex.add();
+                e.millis = c->millis;
+                e.offset = demotmp->tell();
+                int hdr[3] = { c->millis, int(complen), c->data.length() };
+                lilswap(hdr, 3);
+                demotmp->write(hdr, sizeof(hdr));
+                demotmp->write(comp, complen);
+            }
+            delete[] comp;
+            delete c;
+
+            SDL_LockMutex(demolock);
+        }
+        SDL_UnlockMutex(demolock);
+        return 0;
+    }
+
+    void flushdemochunk()
+    {
+        if(!curdemochunk) return;
+        SDL_LockMutex(demolock);
+        demoqueue.add(curdemochunk);
+        SDL_CondSignal(democond);
+        SDL_UnlockMutex(demolock);
+        curdemochunk = NULL;
+    }
+
+    int welcomepacket(packetbuf &p, clientinfo *ci, bool keyframe = false);
+    void sendwelcome(clientinfo *ci);
+
+    void startdemochunk(bool keyframe)
+    {
+        flushdemochunk();
+        curdemochunk = new demochunk;
+        curdemochunk->millis = gamemillis;
+        if(keyframe)
+        {
+            packetbuf p(MAXTRANS, ENET_PACKET_FLAG_RELIABLE);
+            welcomepacket(p, NULL, true);
+            writedemo(DEMO_KEYFRAME, p.buf, p.len);
+        }
+    }
+
+    void checkdemochunk()
+    {
+        if(!demorecord || !curdemochunk) return;
+        if(gamemillis - curdemochunk->millis >= demokeyframes || curdemochunk->data.length() >= 1024*1024) startdemochunk(true);
     }
 
     void recordpacket(int chan, void *data, int len)
@@ -717,10 +881,30 @@ namespace server
     {
         if(!demorecord) return;
 
-        DELETEP(demorecord);
+        demorecord = false;
+
+        flushdemochunk();
+        SDL_LockMutex(demolock);
+        demowriterdone = true;
+        SDL_CondSignal(democond);
+        SDL_UnlockMutex(demolock);
+        SDL_WaitThread(demowriter, NULL);
+        demowriter = NULL;
+        SDL_DestroyCond(democond);
+        democond = NULL;
+        SDL_DestroyMutex(demolock);
+        demolock = NULL;
 
         if(!demotmp) return;
 
+        int indexoffset = demotmp->tell(), numindex = demorecordindex.length();
+        loopv(demorecordindex) lilswap(&demorecordindex[i].millis, 2);
+        demotmp->write(demorecordindex.getbuf(), demorecordindex.length()*sizeof(demoindexentry));
+        demorecordindex.shrink(0);
+        int trailer[2] = { numindex, indexoffset };
+        lilswap(trailer, 2);
+        demotmp->write(trailer, sizeof(trailer));
+
         int len = demotmp->size();
         if(demos.length()>=MAXDEMOS)
         {
@@ -741,9 +925,6 @@ namespace server
         DELETEP(demotmp);
     }
 
-    int welcomepacket(packetbuf &p, clientinfo *ci);
-    void sendwelcome(clientinfo *ci);
-
     void setupdemorecord()
     {
         if(!m_mp(gamemode) || m_edit) return;
@@ -751,19 +932,32 @@ namespace server
         demotmp = opentempfile("demorecord", "w+b");
         if(!demotmp) return;
 
-        stream *f = opengzfile(NULL, "wb", demotmp);
-        if(!f) { DELETEP(demotmp); return; }
-
-        sendservmsg("recording demo");
-
-        demorecord = f;
-
         demoheader hdr;
         memcpy(hdr.magic, DEMO_MAGIC, sizeof(hdr.magic));
         hdr.version = DEMO_VERSION;
         hdr.protocol = PROTOCOL_VERSION;
         lilswap(&hdr.version, 2);
-        demorecord->write(&hdr, sizeof(demoheader));
+        demotmp->write(&hdr, sizeof(demoheader));
+
+        demolock = SDL_CreateMutex();
+        democond = SDL_CreateCond();
+        demowriterdone = false;
+        demowriter = SDL_CreateThread(writedemochunks, NULL);
+        if(!demowriter)
+        {
+            SDL_DestroyCond(democond);
+            democond = NULL;
+            SDL_DestroyMutex(demolock);
+            demolock = NULL;
+            DELETEP(demotmp);
+            return;
+        }
+
+        sendservmsg("recording demo");
+
+        demorecord = true;
+
+        startdemochunk(false);
 
         packetbuf p(MAXTRANS, ENET_PACKET_FLAG_RELIABLE);
         welcomepacket(p, NULL);
@@ -828,6 +1022,9 @@ namespace server
     {
         if(!demoplayback) return;
         DELETEP(demoplayback);
+        demoindex.shrink(0);
+        demoplaychunk.setsize(0);
+        demoplaypos = demoplaynext = 0;
 
         loopv(clients) sendf(clients[i]->clientnum, 1, "ri3", N_DEMOPLAYBACK, 0, clients[i]->clientnum);
 
@@ -836,6 +1033,74 @@ namespace server
         loopv(clients) sendwelcome(clients[i]);
     }
 
+    bool loaddemochunk(int n)
+    {
+        if(!demoindex.inrange(n) || !demoplayback->seek(demoindex[n].offset, SEEK_SET)) return false;
+        int hdr[3];
+        if(demoplayback->read(hdr, sizeof(hdr))!=sizeof(hdr)) return false;
+        lilswap(hdr, 3);
+        if(hdr[1] <= 0 || hdr[2] <= 0) return false;
+        uchar *comp = new uchar[hdr[1]];
+        demoplaychunk.setsize(0);
+        uLongf rawlen = hdr[2];
+        bool ok = demoplayback->read(comp, hdr[1])==hdr[1] &&
+                  uncompress(demoplaychunk.reserve(hdr[2]).buf, &rawlen, comp, hdr[1])==Z_OK &&
+                  int(rawlen)==hdr[2];
+        delete[] comp;
+        if(!ok) return false;
+        demoplaychunk.advance(hdr[2]);
+        demoplaypos = 0;
+        demoplaynext = n+1;
+        return true;
+    }
+
+    // version 1 demos have no index and are read one record at a time
+    bool loaddemorecord()
+    {
+        int stamp[3];
+        if(demoplayback->read(stamp, sizeof(stamp))!=sizeof(stamp)) return false;
+        int len = stamp[2];
+        lilswap(&len, 1);
+        if(len < 0) return false;
+        demoplaychunk.setsize(0);
+        demoplaychunk.put((uchar *)stamp, sizeof(stamp));
+        if(demoplayback->read(demoplaychunk.reserve(len).buf, len)!=len) return false;
+        demoplaychunk.advance(len);
+        demoplaypos = 0;
+        return true;
+    }
+
+    bool peekdemo(int &millis)
+    {
+        if(demoplaypos >= demoplaychunk.length() && !(demoindex.empty() ? loaddemorecord() : loaddemochunk(demoplaynext))) return false;
+        if(demoplaypos + 3*int(sizeof(int)) > demoplaychunk.length()) return false;
+        memcpy(&millis, &demoplaychunk[demoplaypos], sizeof(int));
+        lilswap(&millis, 1);
+        return true;
+    }
+
+    bool readdemorecord(int &chan, uchar *&data, int &len)
+    {
+        int stamp[3];
+        memcpy(stamp, &demoplaychunk[demoplaypos], sizeof(stamp));
+        lilswap(stamp, 3);
+        chan = stamp[1];
+        len = stamp[2];
+        demoplaypos += sizeof(stamp);
+        if(len < 0 || demoplaypos + len > demoplaychunk.length()) return false;
+        data = &demoplaychunk[demoplaypos];
+        demoplaypos += len;
+        return true;
+    }
+
+    void playdemorecord(int chan, uchar *data, int len)
+    {
+        ENetPacket *packet = enet_packet_create(data, len, 0);
+        if(!packet) return;
+        sendpacket(-1, chan, packet);
+        if(!packet->referenceCount) enet_packet_destroy(packet);
+    }
+
     void setupdemoplayback()
     {
         if(demoplayback) return;
@@ -843,19 +1108,52 @@ namespace server
         string msg;
         msg[0] = '\0';
         defformatstring(file)("%s.dmo", smapname);
-        demoplayback = opengzfile(file, "rb");
-        if(!demoplayback) formatstring(msg)("could not read demo \"%s\"", file);
-        else if(demoplayback->read(&hdr, sizeof(demoheader))!=sizeof(demoheader) || memcmp(hdr.magic, DEMO_MAGIC, sizeof(hdr.magic)))
+        demoplayback = openfile(file, "rb");
+        bool indexed = true;
+        if(demoplayback && (demoplayback->read(&hdr, sizeof(demoheader))!=sizeof(demoheader) || memcmp(hdr.magic, DEMO_MAGIC, sizeof(hdr.magic))))
+        {
+            // version 1 demos are a single gzip stream
+            DELETEP(demoplayback);
+            demoplayback = opengzfile(file, "rb");
+            if(demoplayback && demoplayback->read(&hdr, sizeof(demoheader))!=sizeof(demoheader)) DELETEP(demoplayback);
+            indexed = false;
+        }
+        int version = indexed ? DEMO_VERSION : 1;
+        if(!demoplayback) formatstring(msg)(indexed ? "could not read demo \"%s\"" : "\"%s\" is not a demo file", file);
+        else if(memcmp(hdr.magic, DEMO_MAGIC, sizeof(hdr.magic)))
             formatstring(msg)("\"%s\" is not a demo file", file);
         else
         {
             lilswap(&hdr.version, 2);
-            if(hdr.version!=DEMO_VERSION) formatstring(msg)("demo \"%s\" requires an %s version of Cube 2: Sauerbraten", file, hdr.version<DEMO_VERSION ? "older" : "newer");
-            else if(hdr.protocol!=PROTOCOL_VERSION) formatstring(msg)("demo \"%s\" requires an %s version of Cube 2: Sauerbraten", file, hdr.protocol<PROTOCOL_VERSION ? "older" : "newer");
+            int protocol = indexed ? PROTOCOL_VERSION : DEMO_V1_PROTOCOL;
+            if(hdr.version!=version) formatstring(msg)("demo \"%s\" requires an %s version of Cube 2: Sauerbraten", file, hdr.version<version ? "older" : "newer");
+            else if(hdr.protocol!=protocol) formatstring(msg)("demo \"%s\" requires an %s version of Cube 2: Sauerbraten", file, hdr.protocol<protocol ? "older" : "newer");
+            else if(indexed)
+            {
+                int trailer[2];
+                long size = demoplayback->size();
+                if(size < long(sizeof(demoheader) + sizeof(trailer)) || !demoplayback->seek(size - sizeof(trailer), SEEK_SET) ||
+                   demoplayback->read(trailer, sizeof(trailer))!=sizeof(trailer))
+                    formatstring(msg)("demo \"%s\" is missing its index", file);
+                else
+                {
+                    lilswap(trailer, 2);
+                    if(trailer[0] <= 0 || trailer[1] < int(sizeof(demoheader)) || trailer[1] + trailer[0]*long(sizeof(demoindexentry)) > size - long(sizeof(trailer)) ||
+                       !demoplayback->seek(trailer[1], SEEK_SET) ||
+                       demoplayback->read(demoindex.reserve(trailer[0]).buf, trailer[0]*sizeof(demoindexentry))!=int(trailer[0]*sizeof(demoindexentry)))
+                        formatstring(msg)("demo \"%s\" has a corrupt index", file);
+                    else
+                    {
+                        demoindex.advance(trailer[0]);
+                        loopv(demoindex) lilswap(&demoindex[i].millis, 2);
+                    }
+                }
+            }
         }
         if(msg[0])
         {
             DELETEP(demoplayback);
+            demoindex.shrink(0);
             sendservmsg(msg);
             return;
         }
@@ -866,12 +1164,13 @@ namespace server
         demomillis = 0;
         sendf(-1, 1, "ri3", N_DEMOPLAYBACK, 1, -1);
 
-        if(demoplayback->read(&nextplayback, sizeof(nextplayback))!=sizeof(nextplayback))
+        demoplaychunk.setsize(0);
+        demoplaypos = demoplaynext = 0;
+        if(!peekdemo(nextplayback))
         {
             enddemoplayback();
             return;
         }
-        lilswap(&nextplayback, 1);
     }
 
     void readdemo()
@@ -881,32 +1180,53 @@ namespace server
         while(demomillis>=nextplayback)
         {
             int chan, len;
-            if(demoplayback->read(&chan, sizeof(chan))!=sizeof(chan) ||
-               demoplayback->read(&len, sizeof(len))!=sizeof(len))
-            {
-                enddemoplayback();
-                return;
-            }
-            lilswap(&chan, 1);
-            lilswap(&len, 1);
-            ENetPacket *packet = enet_packet_create(NULL, len, 0);
-            if(!packet || demoplayback->read(packet->data, len)!=len)
+            uchar *data;
+            if(!readdemorecord(chan, data, len))
             {
-                if(packet) enet_packet_destroy(packet);
                 enddemoplayback();
                 return;
             }
-            sendpacket(-1, chan, packet);
-            if(!packet->referenceCount) enet_packet_destroy(packet);
-            if(demoplayback->read(&nextplayback, sizeof(nextplayback))!=sizeof(nextplayback))
+            if(chan != DEMO_KEYFRAME) playdemorecord(chan, data, len);
+            if(!peekdemo(nextplayback))
             {
                 enddemoplayback();
                 return;
             }
-            lilswap(&nextplayback, 1);
         }
     }
 
+    void seekdemo(int millis)
+    {
+        if(!demoplayback || demoindex.empty()) return;
+        millis = max(millis, 0);
+        int lo = 0, hi = demoindex.length()-1;
+        while(lo < hi)
+        {
+            int mid = (lo + hi + 1)/2;
+            if(demoindex[mid].millis <= millis) lo = mid;
+            else hi = mid - 1;
+        }
+        if(!loaddemochunk(lo))
+        {
+            enddemoplayback();
+            return;
+        }
+        sendf(-1, 1, "ri2", N_SEEKDEMO, millis/1000);
+        // the chunk starts with a keyframe that restores the full game state, after which only
+        // reliable messages need replaying up to the seek point; positions are skipped
+        while(peekdemo(nextplayback) && nextplayback < millis)
+        {
+            int chan, len;
+            uchar *data;
+            if(!readdemorecord(chan, data, len)) break;
+            if(chan == DEMO_KEYFRAME) chan = 1;
+            else if(chan != 1) continue;
+            playdemorecord(chan, data, len);
+        }
+        demomillis = millis;
+        if(!peekdemo(nextplayback)) enddemoplayback();
+    }
+
     void stopdemo()
     {
         if(m_demo) enddemoplayback();
@@ -1040,33 +1360,143 @@ namespace server
         // only allow edit messages in coop-edit mode
         if(type>=N_EDITENT && type<=N_EDITVAR && !m_edit) return -1;
         // server only messages
-        static const int servtypes[] = { N_SERVINFO, N_INITCLIENT, N_WELCOME, N_MAPRELOAD, N_SERVMSG, N_DAMAGE, N_HITPUSH, N_SHOTFX, N_EXPLODEFX, N_DIED, N_SPAWNSTATE, N_FORCEDEATH, N_ITEMACC, N_ITEMSPAWN, N_TIMEUP, N_CDIS, N_CURRENTMASTER, N_PONG, N_RESUME, N_BASESCORE, N_BASEINFO, N_BASEREGEN, N_ANNOUNCE, N_SENDDEMOLIST, N_SENDDEMO, N_DEMOPLAYBACK, N_SENDMAP, N_DROPFLAG, N_SCOREFLAG, N_RETURNFLAG, N_RESETFLAG, N_INVISFLAG, N_CLIENT, N_AUTHCHAL, N_INITAI };
+        static const int servtypes[] = { N_SERVINFO, N_INITCLIENT, N_WELCOME, N_MAPRELOAD, N_SERVMSG, N_DAMAGE, N_HITPUSH, N_SHOTFX, N_EXPLODEFX, N_DIED, N_SPAWNSTATE, N_FORCEDEATH, N_ITEMACC, N_ITEMSPAWN, N_TIMEUP, N_CDIS, N_CURRENTMASTER, N_PONG, N_RESUME, N_BASESCORE, N_BASEINFO, N_BASEREGEN, N_ANNOUNCE, N_SENDDEMOLIST, N_SENDDEMO, N_DEMOPLAYBACK, N_SENDMAP, N_DROPFLAG, N_SCOREFLAG, N_RETURNFLAG, N_RESETFLAG, N_INVISFLAG, N_CLIENT, N_AUTHCHAL, N_INITAI, N_POSDELTA };
         if(ci) 
         {
             loopi(sizeof(servtypes)/sizeof(int)) if(type == servtypes[i]) return -1;
             if(type < N_EDITENT || type > N_EDITVAR || !m_edit) 
             {
-                if(type != N_POS && ++ci->overflow >= 200) return -2;
+                if(type != N_POS && type != N_POSACK && ++ci->overflow >= 200) return -2;
             }
         }
         return type;
     }
 
+    #define MAXWORLDSTATEPOOL 8
+
+    vector<worldstate *> freeworldstates;
+
+    worldstate *newworldstate()
+    {
+        worldstate *ws = freeworldstates.empty() ? new worldstate : freeworldstates.pop();
+        ws->uses = 0;
+        ws->index = -1;
+        ws->positions.setsize(0);
+        ws->messages.setsize(0);
+        return ws;
+    }
+
+    void freeworldstate(worldstate *ws)
+    {
+        if(ws->index >= 0)
+        {
+            worldstate *last = worldstates.pop();
+            if(last != ws) { worldstates[ws->index] = last; last->index = ws->index; }
+            ws->index = -1;
+        }
+        // keep the buffers of recent ticks around so steady state play doesn't hit the allocator
+        if(freeworldstates.length() < MAXWORLDSTATEPOOL) freeworldstates.add(ws);
+        else delete ws;
+    }
+
     void cleanworldstate(ENetPacket *packet)
     {
-        loopv(worldstates)
+        worldstate *ws = (worldstate *)packet->userData;
+        if(ws && !--ws->uses) freeworldstate(ws);
+    }
+
+    void sendworldstateslice(worldstate &ws, vector<uchar> &buf, int off, int len, int cn, int chan, int flags)
+    {
+        ENetPacket *packet = enet_packet_create(&buf[off], len, flags | ENET_PACKET_FLAG_NO_ALLOCATE);
+        sendpacket(cn, chan, packet);
+        if(!packet->referenceCount) enet_packet_destroy(packet);
+        else { ++ws.uses; packet->userData = &ws; packet->freeCallback = cleanworldstate; }
+    }
+
+    // largest packet ENet will send to the client without fragmenting it
+    int worldstatemtu(int cn)
+    {
+        ENetPeer *peer = getclientpeer(cn);
+        return (peer ? peer->mtu : ENET_HOST_DEFAULT_MTU) - sizeof(ENetProtocolHeader) - sizeof(ENetProtocolSendFragment);
+    }
+
+    struct worldstatecopy
+    {
+        ENetPacket *packet;
+        vector<uchar> *buf;
+        int own, ownlen, cn, chan;
+    };
+
+    vector<worldstatecopy> worldstatecopies;
+
+    static void fillworldstatecopy(void *data, int i)
+    {
+        worldstatecopy &c = worldstatecopies[i];
+        vector<uchar> &buf = *c.buf;
+        memcpy(c.packet->data, buf.getbuf(), c.own);
+        memcpy(&c.packet->data[c.own], &buf[c.own+c.ownlen], buf.length()-(c.own+c.ownlen));
+    }
+
+    // packets are allocated and sent on the main thread, but filled on the worker threads
+    void sendworldstatecopies()
+    {
+        if(worldstatecopies.empty()) return;
+        serverparallel(fillworldstatecopy, NULL, worldstatecopies.length());
+        loopv(worldstatecopies)
         {
-            worldstate *ws = worldstates[i];
-            if(ws->positions.inbuf(packet->data) || ws->messages.inbuf(packet->data)) ws->uses--;
-            else continue;
-            if(!ws->uses)
-            {
-                delete ws;
-                worldstates.remove(i);
-            }
-            break;
+            worldstatecopy &c = worldstatecopies[i];
+            sendpacket(c.cn, c.chan, c.packet);
+            if(!c.packet->referenceCount) enet_packet_destroy(c.packet);
+        }
+        worldstatecopies.setsize(0);
+    }
+
+    // sends everything but the client's own block, as a slice of the shared buffer when possible;
+    // when the block is in the middle, the rest is queued to be copied into one packet unless that
+    // would need fragmenting anyway, in which case the two sides are sent as separate slices
+    int sendworldstate(worldstate &ws, vector<uchar> &buf, int own, int ownlen, int cn, int chan, int flags)
+    {
+        int size = buf.length();
+        if(own < 0) { sendworldstateslice(ws, buf, 0, size, cn, chan, flags); return size; }
+        if(own > 0 && own+ownlen < size && size-ownlen <= worldstatemtu(cn))
+        {
+            worldstatecopy &c = worldstatecopies.add();
+            c.packet = enet_packet_create(NULL, size-ownlen, flags);
+            c.buf = &buf;
+            c.own = own;
+            c.ownlen = ownlen;
+            c.cn = cn;
+            c.chan = chan;
+            return size-ownlen;
+        }
+        if(own > 0) sendworldstateslice(ws, buf, 0, own, cn, chan, flags);
+        if(own+ownlen < size) sendworldstateslice(ws, buf, own+ownlen, size-(own+ownlen), cn, chan, flags);
+        return size-ownlen;
+    }
+
+    void hitstats()
+    {
+        int accepted = 0, rejected = 0;
+        loopv(clients)
+        {
+            clientinfo *ci = clients[i];
+            if(!ci->hitsaccepted && !ci->hitsrejected) continue;
+            conoutf("%s: %d hits accepted, %d rejected", colorname(ci), ci->hitsaccepted, ci->hitsrejected);
+            accepted += ci->hitsaccepted;
+            rejected += ci->hitsrejected;
         }
+        conoutf("total: %d hits accepted, %d rejected (%.1f%%)", accepted, rejected, 100.0f*rejected/max(accepted + rejected, 1));
     }
+    COMMAND(hitstats, "");
+
+    void worldstatestats()
+    {
+        int inflight = 0, pooled = 0, uses = 0;
+        loopv(worldstates) { inflight += worldstates[i]->positions.capacity() + worldstates[i]->messages.capacity(); uses += worldstates[i]->uses; }
+        loopv(freeworldstates) pooled += freeworldstates[i]->positions.capacity() + freeworldstates[i]->messages.capacity();
+        conoutf("%d worldstates in flight holding %d bytes for %d packets, %d pooled holding %d bytes", worldstates.length(), inflight, uses, freeworldstates.length(), pooled);
+    }
+    COMMAND(worldstatestats, "");
 
     void flushclientposition(clientinfo &ci)
     {
@@ -1077,6 +1507,115 @@ namespace server
         sendpacket(-1, 0, p.finalize(), ci.ownernum);
     }
 
+    VAR(serverinterest, 0, 0, 1);           // send positions by relevance to each client instead of broadcasting them
+    VAR(interestradius, 0, 1024, 1<<16);    // beyond this distance players are out of interest, 0 for no limit
+    VAR(interestrate, 0, 250, 10000);       // millis between position updates for players out of interest
+    VAR(interestbudget, 0, 0, MAXTRANS);    // max position bytes sent to each client per tick, 0 for no limit
+    VAR(serverdelta, 0, 0, 1);              // send positions as deltas against the last snapshot each client acked
+
+    vector<interestsource> interestsources;
+
+    bool isinterested(clientinfo &viewer, clientinfo &target, float &dist)
+    {
+        dist = 0;
+        if(viewer.state.state==CS_SPECTATOR || viewer.state.state==CS_EDITING || target.state.state==CS_EDITING || viewer.state.o.x < -1e9f) return true;
+        dist = viewer.state.o.dist(target.state.o);
+        if(interestradius && dist > interestradius) return false;
+        const vec &o = target.state.o;
+        ivec bborigin(int(o.x)-5, int(o.y)-5, int(o.z)-15);
+        return !mappvsoccluded(viewer.state.o, bborigin, ivec(10, 10, 17));
+    }
+
+    void putdeltapositions(vector<uchar> &p, clientinfo &ci)
+    {
+        // the new snapshot takes the oldest slot, so only newer ones can serve as its base
+        int seq = ++ci.posseq;
+        const possnapshot *base = NULL;
+        if(ci.posack > 0 && ci.posack < seq && seq - ci.posack < POSHISTORY && ci.possnapshots[ci.posack%POSHISTORY].seq == ci.posack)
+            base = &ci.possnapshots[ci.posack%POSHISTORY];
+        possnapshot &snap = ci.possnapshots[seq%POSHISTORY];
+        snap.seq = seq;
+        snap.entries.setsize(0);
+        vector<interestsource> &interestcandidates = ci.interestcandidates;
+        putint(p, N_POSDELTA);
+        putuint(p, seq);
+        putuint(p, base ? base->seq : 0);
+        putuint(p, interestcandidates.length());
+        static const int zerofields[NUMPOSFIELDS] = { 0 };
+        loopv(interestcandidates)
+        {
+            clientinfo *cp = interestcandidates[i].ci;
+            const int *basefields = base ? base->find(cp->clientnum) : NULL;
+            putuint(p, cp->clientnum);
+            putdelta(p, cp->posfields, basefields ? basefields : zerofields, NUMPOSFIELDS);
+            posentry &e = snap.entries.add();
+            e.cn = cp->clientnum;
+            memcpy(e.fields, cp->posfields, sizeof(e.fields));
+        }
+    }
+
+    // only touches the recipient's own state, so this runs for all clients in parallel
+    void buildinterestpositions(worldstate &ws, clientinfo &ci)
+    {
+        vector<interestsource> &interestcandidates = ci.interestcandidates;
+        interestcandidates.setsize(0);
+        ci.posupdate.setsize(0);
+        loopv(interestsources)
+        {
+            interestsource &s = interestsources[i];
+            if(s.ci->ownernum == ci.clientnum) continue;
+            while(ci.interestmillis.length() <= s.ci->clientnum) ci.interestmillis.add(0);
+            int age = totalmillis - ci.interestmillis[s.ci->clientnum];
+            float dist = 0;
+            bool interested = !serverinterest || isinterested(ci, *s.ci, dist);
+            if(!interested && age < interestrate) continue;
+            interestsource &c = interestcandidates.add(s);
+            // favor nearby players in view, but let stale ones age their way up the queue
+            c.priority = (interested ? 4 : 1)*max(age, 1)/(1 + dist/64);
+        }
+        if(interestcandidates.empty()) return;
+        interestcandidates.sort(interestsource::compare);
+        int budget = 0;
+        loopv(interestcandidates)
+        {
+            interestsource &c = interestcandidates[i];
+            if(interestbudget && budget && budget + c.len > interestbudget) interestcandidates.remove(i--);
+            else
+            {
+                budget += c.len;
+                ci.interestmillis[c.ci->clientnum] = totalmillis;
+            }
+        }
+        if(serverdelta) putdeltapositions(ci.posupdate, ci);
+        else loopv(interestcandidates) ci.posupdate.put(&ws.positions[interestcandidates[i].off], interestcandidates[i].len);
+    }
+
+    static void buildinterestpositions(void *ws, int i)
+    {
+        clientinfo &ci = *clients[i];
+        if(ci.state.aitype == AI_NONE) buildinterestpositions(*(worldstate *)ws, ci);
+    }
+
+    int sendinterestpositions(clientinfo &ci)
+    {
+        if(ci.posupdate.empty()) return 0;
+        packetbuf p(ci.posupdate.length(), 0);
+        p.put(ci.posupdate.getbuf(), ci.posupdate.length());
+        sendpacket(ci.clientnum, 0, p.finalize());
+        return ci.posupdate.length();
+    }
+
+    ICOMMAND(positionstats, "", (),
+    {
+        loopv(clients)
+        {
+            clientinfo *ci = clients[i];
+            if(ci->state.aitype != AI_NONE) continue;
+            conoutf("%s: %.1f position bytes/tick over %d ticks", colorname(ci), ci->posbytes/float(max(ci->posticks, 1)), ci->posticks);
+            ci->posbytes = ci->posticks = 0;
+        }
+    });
+
     void addclientstate(worldstate &ws, clientinfo &ci)
     {
         if(ci.position.empty()) ci.posoff = -1;
@@ -1086,6 +1625,14 @@ namespace server
             ws.positions.put(ci.position.getbuf(), ci.position.length());
             ci.poslen = ws.positions.length() - ci.posoff;
             ci.position.setsize(0);
+            if(serverinterest || serverdelta)
+            {
+                interestsource &s = interestsources.add();
+                s.ci = &ci;
+                s.off = ci.posoff;
+                s.len = ci.poslen;
+                s.priority = 0;
+            }
         }
         if(ci.messages.empty()) ci.msgoff = -1;
         else
@@ -1102,7 +1649,8 @@ namespace server
 
     bool buildworldstate()
     {
-        worldstate &ws = *new worldstate;
+        worldstate &ws = *newworldstate();
+        interestsources.setsize(0);
         loopv(clients)
         {
             clientinfo &ci = *clients[i];
@@ -1126,54 +1674,42 @@ namespace server
             }
         }
         int psize = ws.positions.length(), msize = ws.messages.length();
-        if(psize)
-        {
-            recordpacket(0, ws.positions.getbuf(), psize);
-            ucharbuf p = ws.positions.reserve(psize);
-            p.put(ws.positions.getbuf(), psize);
-            ws.positions.addbuf(p);
-        }
-        if(msize)
-        {
-            recordpacket(1, ws.messages.getbuf(), msize);
-            ucharbuf p = ws.messages.reserve(msize);
-            p.put(ws.messages.getbuf(), msize);
-            ws.messages.addbuf(p);
-        }
-        ws.uses = 0;
+        if(psize) recordpacket(0, ws.positions.getbuf(), psize);
+        if(msize) recordpacket(1, ws.messages.getbuf(), msize);
+        bool sent = false;
+        if(psize && (serverinterest || serverdelta)) serverparallel(buildinterestpositions, &ws, clients.length());
         if(psize || msize) loopv(clients)
         {
             clientinfo &ci = *clients[i];
             if(ci.state.aitype != AI_NONE) continue;
-            ENetPacket *packet;
-            if(psize && (ci.posoff<0 || psize-ci.poslen>0))
+            ci.posticks++;
+            if(psize && (serverinterest || serverdelta))
+            {
+                int len = sendinterestpositions(ci);
+                if(len) { ci.posbytes += len; sent = true; }
+            }
+            else if(psize && (ci.posoff<0 || psize-ci.poslen>0))
             {
-                packet = enet_packet_create(&ws.positions[ci.posoff<0 ? 0 : ci.posoff+ci.poslen],
-                                            ci.posoff<0 ? psize : psize-ci.poslen,
-                                            ENET_PACKET_FLAG_NO_ALLOCATE);
-                sendpacket(ci.clientnum, 0, packet);
-                if(!packet->referenceCount) enet_packet_destroy(packet);
-                else { ++ws.uses; packet->freeCallback = cleanworldstate; }
+                ci.posbytes += sendworldstate(ws, ws.positions, ci.posoff, ci.poslen, ci.clientnum, 0, 0);
+                sent = true;
             }
 
             if(msize && (ci.msgoff<0 || msize-ci.msglen>0))
             {
-                packet = enet_packet_create(&ws.messages[ci.msgoff<0 ? 0 : ci.msgoff+ci.msglen],
-                                            ci.msgoff<0 ? msize : msize-ci.msglen,
-                                            (reliablemessages ? ENET_PACKET_FLAG_RELIABLE : 0) | ENET_PACKET_FLAG_NO_ALLOCATE);
-                sendpacket(ci.clientnum, 1, packet);
-                if(!packet->referenceCount) enet_packet_destroy(packet);
-                else { ++ws.uses; packet->freeCallback = cleanworldstate; }
+                sendworldstate(ws, ws.messages, ci.msgoff, ci.msglen, ci.clientnum, 1, reliablemessages ? ENET_PACKET_FLAG_RELIABLE : 0);
+                sent = true;
             }
         }
+        sendworldstatecopies();
         reliablemessages = false;
         if(!ws.uses)
         {
-            delete &ws;
-            return false;
+            freeworldstate(&ws);
+            return sent;
         }
         else
         {
+            ws.index = worldstates.length();
             worldstates.add(&ws);
             return true;
         }
@@ -1184,7 +1720,9 @@ namespace server
         if(clients.empty() || (!hasnonlocalclients() && !demorecord)) return false;
         enet_uint32 curtime = enet_time_get()-lastsend;
         if(curtime<33 && !force) return false;
+        uint start = profiling() ? profiletime() : 0;
         bool flush = buildworldstate();
+        profilesection(PROF_WORLDSTATE, start);
         lastsend += curtime - (curtime%33);
         return flush;
     }
@@ -1198,7 +1736,7 @@ namespace server
         putint(p, gs.armour);
         putint(p, gs.armourtype);
         putint(p, gs.gunselect);
-        loopi(GUN_PISTOL-GUN_SG+1) putint(p, gs.ammo[GUN_SG+i]);
+        putints(p, &gs.ammo[GUN_SG], GUN_PISTOL-GUN_SG+1);
     }
 
     void spawnstate(clientinfo *ci)
@@ -1260,17 +1798,24 @@ namespace server
         }
     }
 
-    int welcomepacket(packetbuf &p, clientinfo *ci)
+    // demo keyframes only restore game state, so they leave out the welcome and map change
+    int welcomepacket(packetbuf &p, clientinfo *ci, bool keyframe)
     {
         int hasmap = (m_edit && (clients.length()>1 || (ci && ci->local))) || (smapname[0] && (!m_timed || gamemillis<gamelimit || (ci && ci->state.state==CS_SPECTATOR && !ci->privilege && !ci->local) || numclients(ci ? ci->clientnum : -1, true, true, true)));
-        putint(p, N_WELCOME);
-        putint(p, hasmap);
+        if(!keyframe)
+        {
+            putint(p, N_WELCOME);
+            putint(p, hasmap);
+        }
         if(hasmap)
         {
-            putint(p, N_MAPCHANGE);
-            sendstring(smapname, p);
-            putint(p, gamemode);
-            putint(p, notgotitems ? 1 : 0);
+            if(!keyframe)
+            {
+                putint(p, N_MAPCHANGE);
+                sendstring(smapname, p);
+                putint(p, gamemode);
+                putint(p, notgotitems ? 1 : 0);
+            }
             if(!ci || (m_timed && smapname[0]))
             {
                 putint(p, N_TIMEUP);
@@ -1388,7 +1933,7 @@ namespace server
     {
         resetitems();
         notgotitems = true;
-        if(m_edit || !loadents(smapname, ments, &mcrc))
+        if(m_edit || !loadents(smapname, ments, &mcrc, true))
             return;
         loopv(ments) if(canspawnitem(ments[i].type))
         {
@@ -1606,6 +2151,20 @@ namespace server
         suicide(ci);
     }
 
+    // prepare() drops the hits that process() would reject without looking at any other client,
+    // so that part of the validation can run on worker threads before events are processed in order
+    void explodeevent::prepare(clientinfo *ci)
+    {
+        loopv(hits)
+        {
+            hitinfo &h = hits[i];
+            bool dup = false;
+            loopj(i) if(hits[j].target==h.target) { dup = true; break; }
+            if(dup) hits.remove(i--);
+        }
+        loopv(hits) if(hits[i].dist<0 || hits[i].dist>RL_DAMRAD) hits.remove(i--);
+    }
+
     void explodeevent::process(clientinfo *ci)
     {
         gamestate &gs = ci->state;
@@ -1641,6 +2200,45 @@ namespace server
         }
     }
 
+    VAR(lagcompensation, 0, 1, 2);  // rewind targets to the shooter's view of them: 1 only tracks hit stats, 2 also drops hits that miss
+    VAR(lagtolerance, 0, 8, 64);    // slack around the rewound bounding cylinder
+
+    bool checkhit(clientinfo *ci, clientinfo *target, const hitinfo &h, int gun, int millis, const vec &from, const vec &to)
+    {
+        // the shooter saw the target as it was about a round trip before its shot reached us
+        clientinfo *owner = ci->state.aitype != AI_NONE ? getinfo(ci->ownernum) : ci;
+        physent d;
+        d.o = target->rewindposition(millis - (owner ? owner->ping : 0));
+        vec bottom(d.o), top(d.o);
+        top.z += d.eyeheight + d.aboveeye;
+        bottom.z -= lagtolerance;
+        top.z += lagtolerance;
+        float radius = d.radius + lagtolerance;
+        if(gun==GUN_SG) radius += h.dist*SGSPREAD/20;
+        vec end = vec(to).sub(from).normalize().mul(guns[gun].range + 1).add(from);
+        float dist;
+        return linecylinderintersect(from, end, bottom, top, radius, dist);
+    }
+
+    void shotevent::prepare(clientinfo *ci)
+    {
+        if(gun<GUN_FIST || gun>GUN_PISTOL || gun==GUN_RL || gun==GUN_GL) return;
+        loopv(hits) if(hits[i].rays<1 || hits[i].dist > guns[gun].range + 1) hits.remove(i--);
+        if(checked || !lagcompensation) return;
+        checked = true;
+        loopv(hits)
+        {
+            clientinfo *target = getinfo(hits[i].target);
+            if(!target || target==ci) continue;
+            if(checkhit(ci, target, hits[i], gun, millis, from, to)) ci->hitsaccepted++;
+            else
+            {
+                ci->hitsrejected++;
+                if(lagcompensation >= 2) hits.remove(i--);
+            }
+        }
+    }
+
     void shotevent::process(clientinfo *ci)
     {
         gamestate &gs = ci->state;
@@ -1721,8 +2319,15 @@ namespace server
         }
     }
 
+    static void prepareevents(void *data, int i)
+    {
+        clientinfo *ci = clients[i];
+        loopvj(ci->events) ci->events[j]->prepare(ci);
+    }
+
     void processevents()
     {
+        serverparallel(prepareevents, NULL, clients.length());
         loopv(clients)
         {
             clientinfo *ci = clients[i];
@@ -1761,6 +2366,7 @@ namespace server
         if(m_demo) readdemo();
         else if(!gamepaused && (!m_timed || gamemillis < gamelimit))
         {
+            checkdemochunk();
             processevents();
             if(curtime)
             {
@@ -2073,6 +2679,115 @@ namespace server
             addgban(val);
     }
 
+    void masterdisconnected()
+    {
+        loopv(clients)
+        {
+            clientinfo *ci = clients[i];
+            if(!ci->authreq) continue;
+            ci->authreq = 0;
+            sendf(ci->clientnum, 1, "ris", N_SERVMSG, "disconnected from authentication server");
+        }
+    }
+
+    // both ends prime their transport compressor from these samples, so they must not depend on any local state
+    static void samplefields(int *f, int cn, int n)
+    {
+        f[POSF_PHYS] = (n%5 ? 4 : 1) | ((n&1)<<3) | ((n/3%3)<<4);
+        f[POSF_FLAGS] = n%4 ? 0 : 1<<4;
+        f[POSF_X] = int((1024 + cn*97 + n*11)*DMF);
+        f[POSF_Y] = int((768 + cn*53 - n*7)*DMF);
+        f[POSF_Z] = int((512 + (n%4)*3)*DMF);
+        f[POSF_DIR] = (cn*45 + n*7)%360 + (90 + n%9 - 4)*360;
+        f[POSF_ROLL] = 90;
+        f[POSF_VEL] = 40 + cn*13 + n%60;
+        f[POSF_VELDIR] = (cn*45 + n*5)%360 + 90*360;
+        f[POSF_FALL] = n%4 ? 0 : 20 + n;
+        f[POSF_FALLDIR] = 0;
+    }
+
+    static void putsampleposition(ucharbuf &p, const int *f)
+    {
+        p.put(f[POSF_PHYS]);
+        putuint(p, f[POSF_FLAGS]);
+        loopk(3) { p.put(f[POSF_X+k]&0xFF); p.put((f[POSF_X+k]>>8)&0xFF); }
+        p.put(f[POSF_DIR]&0xFF);
+        p.put((f[POSF_DIR]>>8)&0xFF);
+        p.put(f[POSF_ROLL]);
+        p.put(f[POSF_VEL]);
+        p.put(f[POSF_VELDIR]&0xFF);
+        p.put((f[POSF_VELDIR]>>8)&0xFF);
+        if(f[POSF_FLAGS]&(1<<4)) p.put(f[POSF_FALL]);
+    }
+
+    bool compressionsample(int chan, int n, ucharbuf &p)
+    {
+        if(n >= 24) return false;
+        int fields[NUMPOSFIELDS], base[NUMPOSFIELDS];
+        switch(chan)
+        {
+            case 0:
+                if(n&1)
+                {
+                    int num = 2 + n%6;
+                    putint(p, N_POSDELTA);
+                    putuint(p, n+1);
+                    putuint(p, n);
+                    putuint(p, num);
+                    loopi(num)
+                    {
+                        putuint(p, i);
+                        samplefields(base, i, n-1);
+                        samplefields(fields, i, n);
+                        putdelta(p, fields, base, NUMPOSFIELDS);
+                    }
+                }
+                else
+                {
+                    samplefields(fields, n%8, n);
+                    putint(p, N_POS);
+                    putuint(p, n%8);
+                    putsampleposition(p, fields);
+                }
+                return true;
+
+            case 1:
+            {
+                int cn = n%8, target = (n+3)%8, gun = GUN_SG + n%(GUN_PISTOL-GUN_SG+1);
+                uchar buf[64];
+                ucharbuf q(buf, sizeof(buf));
+                samplefields(fields, cn, n);
+                samplefields(base, target, n);
+                switch(n%4)
+                {
+                    case 0:
+                        putint(q, N_SHOTFX); putint(q, cn); putint(q, gun); putint(q, n*3);
+                        loopk(3) putint(q, fields[POSF_X+k]);
+                        loopk(3) putint(q, base[POSF_X+k]);
+                        break;
+                    case 1:
+                        putint(q, N_DAMAGE); putint(q, target); putint(q, cn); putint(q, 10 + n*3); putint(q, max(100 - n*4, 0)); putint(q, 100 - n*2);
+                        putint(q, N_HITPUSH); putint(q, target); putint(q, gun); putint(q, 10 + n*3); putint(q, 71); putint(q, -70); putint(q, 5);
+                        break;
+                    case 2:
+                        putint(q, N_SOUND); putint(q, S_JUMP);
+                        putint(q, N_CLIENTPING); putint(q, 30 + n*5);
+                        break;
+                    case 3:
+                        putint(q, N_GUNSELECT); putint(q, gun);
+                        putint(q, N_TAUNT);
+                        break;
+                }
+                putint(p, N_CLIENT);
+                putint(p, cn);
+                putuint(p, q.length());
+                p.put(buf, q.length());
+                return true;
+            }
+        }
+        return false;
+    }
+
     void receivefile(int sender, uchar *data, int len)
     {
         if(!m_edit || len > 1024*1024) return;
@@ -2102,6 +2817,26 @@ namespace server
         }
     }
 
+    struct msgprofiler
+    {
+        int type, start;
+        uint time;
+
+        msgprofiler() : type(-1), start(0), time(0) {}
+
+        bool next(ucharbuf &p)
+        {
+            if(!profiling()) return true;
+            if(type >= 0) profilemessage(type, p.length() - start, time);
+            type = -1;
+            start = p.length();
+            time = profiletime();
+            return true;
+        }
+
+        int settype(int n) { return type = n; }
+    };
+
     void parsepacket(int sender, int chan, packetbuf &p)     // has to parse exactly each byte of the packet
     {
         if(sender<0) return;
@@ -2173,30 +2908,20 @@ namespace server
         #define QUEUE_UINT(n) QUEUE_BUF(putuint(cm->messages, n))
         #define QUEUE_STR(text) QUEUE_BUF(sendstring(text, cm->messages))
         int curmsg;
-        while((curmsg = p.length()) < p.maxlen) switch(type = checktype(getint(p), ci))
+        msgprofiler prof;
+        while(prof.next(p) && (curmsg = p.length()) < p.maxlen) switch(type = prof.settype(checktype(getint(p), ci)))
         {
             case N_POS:
             {
-                int pcn = getuint(p); 
-                p.get(); 
-                uint flags = getuint(p);
+                int pcn = getuint(p), fields[NUMPOSFIELDS];
+                unpackposition(p, fields);
+                uint flags = fields[POSF_FLAGS];
                 clientinfo *cp = getinfo(pcn);
                 if(cp && pcn != sender && cp->ownernum != sender) cp = NULL;
                 vec pos;
-                loopk(3)
-                {
-                    int n = p.get(); n |= p.get()<<8; if(flags&(1<<k)) { n |= p.get()<<16; if(n&0x800000) n |= -1<<24; }
-                    pos[k] = n/DMF;
-                }
-                loopk(3) p.get();
-                int mag = p.get(); if(flags&(1<<3)) mag |= p.get()<<8;
-                int dir = p.get(); dir |= p.get()<<8;
-                vec vel = vec((dir%360)*RAD, (clamp(dir/360, 0, 180)-90)*RAD).mul(mag/DVELF);
-                if(flags&(1<<4))
-                {
-                    p.get(); if(flags&(1<<5)) p.get();
-                    if(flags&(1<<6)) loopk(2) p.get();
-                }
+                loopk(3) pos[k] = fields[POSF_X+k]/DMF;
+                int dir = fields[POSF_VELDIR];
+                vec vel = vec((dir%360)*RAD, (clamp(dir/360, 0, 180)-90)*RAD).mul(fields[POSF_VEL]/DVELF);
                 if(cp)
                 {
                     if((!ci->local || demorecord || hasnonlocalclients()) && (cp->state.state==CS_ALIVE || cp->state.state==CS_EDITING))
@@ -2205,9 +2930,11 @@ namespace server
                             cp->setexceeded();
                         cp->position.setsize(0);
                         while(curmsg<p.length()) cp->position.add(p.buf[curmsg++]);
+                        memcpy(cp->posfields, fields, sizeof(fields));
                     }
                     if(smode && cp->state.state==CS_ALIVE) smode->moved(cp, cp->state.o, cp->gameclip, pos, (flags&0x80)!=0);
                     cp->state.o = pos;
+                    cp->recordposition(gamemillis, pos);
                     cp->gameclip = (flags&0x80)!=0;
                 }
                 break;
@@ -2334,6 +3061,7 @@ namespace server
                 cq->state.state = CS_ALIVE;
                 cq->state.gunselect = gunselect;
                 cq->exceeded = 0;
+                cq->numposhistory = 0;
                 if(smode) smode->spawned(cq);
                 QUEUE_AI;
                 QUEUE_BUF({
@@ -2535,6 +3263,10 @@ namespace server
                 sendf(sender, 1, "i2", N_PONG, getint(p));
                 break;
 
+            case N_POSACK:
+                ci->posack = getuint(p);
+                break;
+
             case N_CLIENTPING:
             {
                 int ping = getint(p);
@@ -2665,6 +3397,14 @@ namespace server
                 break;
             }
 
+            case N_SEEKDEMO:
+            {
+                int secs = getint(p);
+                if(ci->privilege<PRIV_ADMIN && !ci->local) break;
+                if(m_demo) seekdemo(secs*1000);
+                break;
+            }
+
             case N_CLEARDEMOS:
             {
                 int demo = getint(p);
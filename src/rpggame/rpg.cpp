@@ -296,6 +296,8 @@ namespace server
     int masterport() { return 0; }
     int laninfoport() { return 0; }
     void processmasterinput(const char *cmd, int cmdlen, const char *args) {}
+    void masterdisconnected() {}
+    bool compressionsample(int chan, int n, ucharbuf &p) { return false; }
     bool ispaused() { return false; }
 }
 
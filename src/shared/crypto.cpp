@@ -285,6 +285,18 @@ template<int BI_DIGITS> struct bigint
 
     void shrink() { while(len && !digits[len-1]) len--; }
 
+    /* zeroes the digits past len so that select() may copy whole digit arrays */
+    void pad() { memset(&digits[len], 0, (BI_DIGITS-len)*sizeof(digit)); }
+
+    /* copies y if cond is set, touching the same memory either way; both must be padded */
+    void select(const bigint &y, bool cond)
+    {
+        int lmask = -int(cond);
+        digit mask = digit(lmask);
+        len ^= (len ^ y.len) & lmask;
+        loopi(BI_DIGITS) digits[i] ^= (digits[i] ^ y.digits[i]) & mask;
+    }
+
     template<int X_DIGITS, int Y_DIGITS> bigint &mul(const bigint<X_DIGITS> &x, const bigint<Y_DIGITS> &y)
     {
         if(!x.len || !y.len) { len = 0; return *this; }
@@ -441,6 +453,95 @@ struct gfield : gfint
     }
     template<int Y_DIGITS> gfield &mul(const bigint<Y_DIGITS> &y) { return mul(*this, y); }
 
+#if GF_BITS==192
+    /* Field elements that are already reduced fit in six 32 bit words, so multiply those
+     * a word at a time and fold the 384 bit product using P=2^192-2^64-1 directly:
+     * with the product split into 64 bit chunks c5..c0, the result is
+     * (c2,c1,c0) + (0,c3,c3) + (c4,c4,0) + (c5,c5,c5) mod P.
+     */
+    typedef unsigned long long int dblword;
+
+    gfield &mul(const gfield &x, const gfield &y)
+    {
+        if(x.len > GF_DIGITS || y.len > GF_DIGITS) return mul((const gfint &)x, (const gfint &)y);
+        uint a[6], b[6], r[12];
+        loadwords(x, a);
+        loadwords(y, b);
+        memset(r, 0, sizeof(r));
+        loopi(6)
+        {
+            dblword carry = 0;
+            loopj(6)
+            {
+                carry += (dblword)a[i] * b[j] + r[i+j];
+                r[i+j] = (uint)carry;
+                carry >>= 32;
+            }
+            r[i+6] = (uint)carry;
+        }
+
+        uint w[6];
+        dblword t = (dblword)r[0] + r[6] + r[10];
+        w[0] = (uint)t; t >>= 32;
+        t += (dblword)r[1] + r[7] + r[11];
+        w[1] = (uint)t; t >>= 32;
+        t += (dblword)r[2] + r[6] + r[8] + r[10];
+        w[2] = (uint)t; t >>= 32;
+        t += (dblword)r[3] + r[7] + r[9] + r[11];
+        w[3] = (uint)t; t >>= 32;
+        t += (dblword)r[4] + r[8] + r[10];
+        w[4] = (uint)t; t >>= 32;
+        t += (dblword)r[5] + r[9] + r[11];
+        w[5] = (uint)t;
+        uint carry = uint(t >> 32);
+        /* 2^192 = 2^64+1 mod P, so fold the overflow back in until none is left */
+        while(carry) carry = addwords(w, carry);
+        /* w < 2^192 < 2P now, so at most one subtraction of P remains; adding 2^64+1
+         * overflows exactly when w >= P, and the wrapped sum is then w-P
+         */
+        uint v[6];
+        memcpy(v, w, sizeof(w));
+        uint mask = -addwords(v, 1);
+        loopi(6) w[i] ^= (w[i] ^ v[i]) & mask;
+
+        loopi(6)
+        {
+            digits[2*i] = digit(w[i]);
+            digits[2*i+1] = digit(w[i]>>16);
+        }
+        len = GF_DIGITS;
+        shrink();
+        return *this;
+    }
+    gfield &mul(const gfield &y) { return mul(*this, y); }
+    gfield &square(const gfield &x) { return mul(x, x); }
+
+    static void loadwords(const gfield &x, uint *w)
+    {
+        digit d[GF_DIGITS];
+        memcpy(d, x.digits, x.len*sizeof(digit));
+        memset(&d[x.len], 0, (GF_DIGITS-x.len)*sizeof(digit));
+        loopi(6) w[i] = d[2*i] | (uint(d[2*i+1])<<16);
+    }
+
+    /* adds n*(2^64+1) to w, returning the carry out of bit 192 */
+    static uint addwords(uint *w, uint n)
+    {
+        dblword t = (dblword)w[0] + n;
+        w[0] = (uint)t; t >>= 32;
+        t += w[1];
+        w[1] = (uint)t; t >>= 32;
+        t += (dblword)w[2] + n;
+        w[2] = (uint)t; t >>= 32;
+        loopi(3)
+        {
+            t += w[i+3];
+            w[i+3] = (uint)t; t >>= 32;
+        }
+        return (uint)t;
+    }
+#endif
+
     template<int RESULT_DIGITS> void reduce(const bigint<RESULT_DIGITS> &result)
     {
 #if GF_BITS==192
@@ -587,9 +688,14 @@ struct gfield : gfint
     bool sqrt() { return sqrt(*this); }
 };
 
+#define EC_WINDOW_BITS  4
+#define EC_WINDOW_SIZE  (1<<(EC_WINDOW_BITS-1))
+#define EC_WINDOWS      ((GF_BITS+1+EC_WINDOW_BITS-1)/EC_WINDOW_BITS)
+
 struct ecjacobian
 {
     static const gfield B;
+    static const gfint order;
     static const ecjacobian base;
     static const ecjacobian origin;
 
@@ -647,7 +753,8 @@ struct ecjacobian
         y.sub(f, x).sub(x).mul(b).sub(e.mul(a).mul(d)).div2();
     }
 
-    template<int Q_DIGITS> void mul(const ecjacobian &p, const bigint<Q_DIGITS> q)
+    /* plain double-and-add, kept as a reference for authbench */
+    template<int Q_DIGITS> void mulbinary(const ecjacobian &p, const bigint<Q_DIGITS> &q)
     {
         *this = origin;
         for(int i = q.numbits()-1; i >= 0; i--)
@@ -656,7 +763,150 @@ struct ecjacobian
             if(q.hasbit(i)) add(p);
         }
     }
-    template<int Q_DIGITS> void mul(const bigint<Q_DIGITS> q) { ecjacobian tmp(*this); mul(tmp, q); }
+
+    /* Scalars are reduced mod the group order, made odd by adding the order if needed, and
+     * recoded into EC_WINDOWS signed odd digits. Every digit is nonzero, so a multiplication
+     * always runs the same sequence of doublings and additions whatever the key bits are,
+     * and table entries are fetched by scanning the whole table.
+     */
+    template<int Q_DIGITS> static void recode(const bigint<Q_DIGITS> &q, signed char *d)
+    {
+        bigint<Q_DIGITS+1> r(q);
+        for(int shift = r.numbits() - order.numbits(); shift >= 0; shift--)
+        {
+            bigint<Q_DIGITS+1> s(order);
+            s.lshift(shift);
+            if(r >= s) r.sub(s);
+        }
+        gfint k(r), kn;
+        kn.add(k, order);
+        k.pad();
+        kn.pad();
+        k.select(kn, !k.hasbit(0));
+        loopi(EC_WINDOWS-1)
+        {
+            int digit = int(k.digits[0]&((2<<EC_WINDOW_BITS)-1)) - (1<<EC_WINDOW_BITS), carry = -digit;
+            d[i] = (signed char)digit;
+            loopj(GF_DIGITS+1)
+            {
+                carry += k.digits[j];
+                k.digits[j] = gfield::digit(carry);
+                carry >>= BI_DIGIT_BITS;
+            }
+            loopj(GF_DIGITS)
+                k.digits[j] = gfield::digit((k.digits[j]>>EC_WINDOW_BITS) | (k.digits[j+1]<<(BI_DIGIT_BITS-EC_WINDOW_BITS)));
+            k.digits[GF_DIGITS] >>= EC_WINDOW_BITS;
+        }
+        d[EC_WINDOWS-1] = (signed char)k.digits[0];
+    }
+
+    /* fetches digit*P from a table of the odd multiples P, 3P, 5P, ... */
+    static void select(ecjacobian &r, const ecjacobian *table, int digit)
+    {
+        int sign = digit>>31, index = ((digit^sign) - sign)>>1;
+        r.x.zero(); r.x.pad();
+        r.y.zero(); r.y.pad();
+        r.z.zero(); r.z.pad();
+        loopi(EC_WINDOW_SIZE)
+        {
+            const ecjacobian &t = table[i];
+            r.x.select(t.x, i==index);
+            r.y.select(t.y, i==index);
+            r.z.select(t.z, i==index);
+        }
+        gfield ny;
+        ny.neg(r.y);
+        ny.pad();
+        r.y.select(ny, sign!=0);
+    }
+
+    /* normalizes a batch of points with a single inversion, padding them for select() */
+    static void normalize(ecjacobian *points, int n)
+    {
+        gfield *prods = new gfield[n], acc((gfield::digit)1), inv;
+        loopi(n)
+        {
+            if(!points[i].z.iszero()) acc.mul(points[i].z);
+            prods[i] = acc;
+        }
+        inv.invert(acc);
+        for(int i = n-1; i >= 0; i--)
+        {
+            ecjacobian &p = points[i];
+            if(!p.z.iszero())
+            {
+                gfield zinv, zinv2;
+                if(i > 0) zinv.mul(inv, prods[i-1]);
+                else zinv = inv;
+                inv.mul(p.z);
+                zinv2.square(zinv);
+                p.x.mul(zinv2);
+                p.y.mul(zinv2).mul(zinv);
+                p.z = bigint<1>(1);
+            }
+            p.x.pad();
+            p.y.pad();
+            p.z.pad();
+        }
+        delete[] prods;
+    }
+
+    static void oddmultiples(const ecjacobian &p, ecjacobian *table)
+    {
+        ecjacobian p2(p);
+        p2.mul2();
+        table[0] = p;
+        loopi(EC_WINDOW_SIZE-1)
+        {
+            table[i+1] = table[i];
+            table[i+1].add(p2);
+        }
+    }
+
+    template<int Q_DIGITS> void mul(const ecjacobian &p, const bigint<Q_DIGITS> &q)
+    {
+        signed char d[EC_WINDOWS];
+        recode(q, d);
+        ecjacobian table[EC_WINDOW_SIZE], t;
+        oddmultiples(p, table);
+        normalize(table, EC_WINDOW_SIZE);
+        select(*this, table, d[EC_WINDOWS-1]);
+        for(int i = EC_WINDOWS-2; i >= 0; i--)
+        {
+            loopj(EC_WINDOW_BITS) mul2();
+            select(t, table, d[i]);
+            add(t);
+        }
+    }
+    template<int Q_DIGITS> void mul(const bigint<Q_DIGITS> &q) { ecjacobian tmp(*this); mul(tmp, q); }
+
+    /* Multiples of the base point use a comb of odd multiples of base*16^i for every window,
+     * built on first use, so they need no doublings at all: one mixed addition per window.
+     */
+    template<int Q_DIGITS> void mulbase(const bigint<Q_DIGITS> &q)
+    {
+        static ecjacobian *combs = NULL;
+        if(!combs)
+        {
+            combs = new ecjacobian[EC_WINDOWS*EC_WINDOW_SIZE];
+            ecjacobian p(base);
+            loopi(EC_WINDOWS)
+            {
+                oddmultiples(p, &combs[i*EC_WINDOW_SIZE]);
+                loopj(EC_WINDOW_BITS) p.mul2();
+            }
+            normalize(combs, EC_WINDOWS*EC_WINDOW_SIZE);
+        }
+        signed char d[EC_WINDOWS];
+        recode(q, d);
+        ecjacobian t;
+        *this = origin;
+        loopi(EC_WINDOWS)
+        {
+            select(t, &combs[i*EC_WINDOW_SIZE], d[i]);
+            add(t);
+        }
+    }
 
     void normalize()
     {
@@ -699,6 +949,7 @@ const ecjacobian ecjacobian::origin(gfield((gfield::digit)1), gfield((gfield::di
 #if GF_BITS==192
 const gfield gfield::P("fffffffffffffffffffffffffffffffeffffffffffffffff");
 const gfield ecjacobian::B("64210519e59c80e70fa7e9ab72243049feb8deecc146b9b1");
+const gfint ecjacobian::order("ffffffffffffffffffffffff99def836146bc9b1b4d22831");
 const ecjacobian ecjacobian::base(
     gfield("188da80eb03090f67cbf20eb43a18800f4ff0afd82ff1012"),
     gfield("07192b95ffc8da78631011ed6b24cdd573f977a11e794811")
@@ -706,6 +957,7 @@ const ecjacobian ecjacobian::base(
 #elif GF_BITS==224
 const gfield gfield::P("ffffffffffffffffffffffffffffffff000000000000000000000001");
 const gfield ecjacobian::B("b4050a850c04b3abf54132565044b0b7d7bfd8ba270b39432355ffb4");
+const gfint ecjacobian::order("ffffffffffffffffffffffffffff16a2e0b8f03e13dd29455c5c2a3d");
 const ecjacobian ecjacobian::base(
     gfield("b70e0cbd6bb4bf7f321390b94a03c1d356c21122343280d6115c1d21"),
     gfield("bd376388b5f723fb4c22dfe6cd4375a05a07476444d5819985007e34"),
@@ -713,6 +965,7 @@ const ecjacobian ecjacobian::base(
 #elif GF_BITS==256
 const gfield gfield::P("ffffffff00000001000000000000000000000000ffffffffffffffffffffffff");
 const gfield ecjacobian::B("5ac635d8aa3a93e7b3ebbd55769886bc651d06b0cc53b0f63bce3c3e27d2604b");
+const gfint ecjacobian::order("ffffffff00000000ffffffffffffffffbce6faada7179e84f3b9cac2fc632551");
 const ecjacobian ecjacobian::base(
     gfield("6b17d1f2e12c4247f8bce6e563a440f277037d812deb33a0f4a13945d898c296"),
     gfield("4fe342e2fe1a7f9b8ee7eb4a7c0f9e162bce33576b315ececbb6406837bf51f5"),
@@ -720,6 +973,7 @@ const ecjacobian ecjacobian::base(
 #elif GF_BITS==384
 const gfield gfield::P("fffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffeffffffff0000000000000000ffffffff");
 const gfield ecjacobian::B("b3312fa7e23ee7e4988e056be3f82d19181d9c6efe8141120314088f5013875ac656398d8a2ed19d2a85c8edd3ec2aef");
+const gfint ecjacobian::order("ffffffffffffffffffffffffffffffffffffffffffffffffc7634d81f4372ddf581a0db248b0a77aecec196accc52973");
 const ecjacobian ecjacobian::base(
     gfield("aa87ca22be8b05378eb1c71ef320ad746e1d3b628ba79b9859f741e082542a385502f25dbf55296c3a545e3872760ab7"),
     gfield("3617de4a96262c6f5d9e98bf9292dc29f8f41dbd289a147ce9da3113b5f0b8c00a60b1ce1d7e819d7a431d7c90ea0e5f"),
@@ -727,6 +981,7 @@ const ecjacobian ecjacobian::base(
 #elif GF_BITS==521
 const gfield gfield::P("1ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff");
 const gfield ecjacobian::B("051953eb968e1c9a1f929a21a0b68540eea2da725b99b315f3b8b489918ef109e156193951ec7e937b1652c0bd3bb1bf073573df883d2c34f1ef451fd46b503f00");
+const gfint ecjacobian::order("1ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffa51868783bf2f966b7fcc0148f709a5d03bb5c9b8899c47aebb6fb71e91386409");
 const ecjacobian ecjacobian::base(
     gfield("c6858e06b70404e9cd9e3ecb662395b4429c648139053fb521f828af606b4d3dbaa14b5e77efe75928fe1dc127a2ffa8de3348b3c1856a429bf97e7e31c2e5bd66"),
     gfield("11839296a789a3bc0045c8a5fb42c7d1bd998f54449579b446817afbd17273e662c97ee72995ef42640c550b9013fad0761353c7086a272c24088be94769fd16650")
@@ -746,18 +1001,18 @@ void genprivkey(const char *seed, vector<char> &privstr, vector<char> &pubstr)
     privkey.printdigits(privstr);
     privstr.add('\0');
 
-    ecjacobian c(ecjacobian::base);
-    c.mul(privkey);
+    ecjacobian c;
+    c.mulbase(privkey);
     c.normalize();
     c.print(pubstr);
     pubstr.add('\0');
 }
 
-bool hashstring(const char *str, char *result, int maxlen)
+bool hashdata(const void *data, int len, char *result, int maxlen)
 {
     tiger::hashval hv;
     if(maxlen < 2*(int)sizeof(hv.bytes) + 1) return false;
-    tiger::hash((uchar *)str, strlen(str), hv);
+    tiger::hash((const uchar *)data, len, hv);
     loopi(sizeof(hv.bytes))
     {
         uchar c = hv.bytes[i];
@@ -768,6 +1023,11 @@ bool hashstring(const char *str, char *result, int maxlen)
     return true;
 }
 
+bool hashstring(const char *str, char *result, int maxlen)
+{
+    return hashdata(str, (int)strlen(str), result, maxlen);
+}
+
 void answerchallenge(const char *privstr, const char *challenge, vector<char> &answerstr)
 {
     gfint privkey;
@@ -805,8 +1065,8 @@ void *genchallenge(void *pubkey, const void *seed, int seedlen, vector<char> &ch
     answer.mul(challenge);
     answer.normalize();
 
-    ecjacobian secret(ecjacobian::base);
-    secret.mul(challenge);
+    ecjacobian secret;
+    secret.mulbase(challenge);
     secret.normalize();
 
     secret.print(challengestr);
@@ -826,3 +1086,59 @@ bool checkchallenge(const char *answerstr, void *correct)
     return answer == *(gfint *)correct;
 }
 
+void authbench(int *n)
+{
+    int iterations = *n > 0 ? *n : 100, failed = 0, mismatched = 0;
+    vector<char> privstr, pubstr;
+    genprivkey("authbench", privstr, pubstr);
+    void *pubkey = parsepubkey(pubstr.getbuf());
+
+    uint start = enet_time_get(), seed[2] = { 0, start };
+    loopi(iterations)
+    {
+        vector<char> challengestr, answerstr;
+        seed[0] = i;
+        void *answer = genchallenge(pubkey, seed, sizeof(seed), challengestr);
+        answerchallenge(privstr.getbuf(), challengestr.getbuf(), answerstr);
+        if(!checkchallenge(answerstr.getbuf(), answer)) failed++;
+        freechallenge(answer);
+    }
+    uint elapsed = max(enet_time_get() - start, 1U);
+    conoutf("authbench: %d challenges issued, answered and checked in %ums (%.1f/sec), %d failed",
+        iterations, elapsed, iterations*1000.0f/elapsed, failed);
+
+    /* the server side of a challenge is one multiple of the base point and one of the
+     * user's key; time that against plain double-and-add and check both agree
+     */
+    int reference = min(iterations, 100);
+    uint fasttime = 0, slowtime = 0;
+    loopi(reference)
+    {
+        tiger::hashval hash;
+        seed[0] = i;
+        tiger::hash((const uchar *)seed, sizeof(seed), hash);
+        gfint q;
+        memcpy(q.digits, hash.bytes, sizeof(hash.bytes));
+        q.len = 8*sizeof(hash.bytes)/BI_DIGIT_BITS;
+        q.shrink();
+
+        ecjacobian a, b, c, d;
+        uint fast = enet_time_get();
+        a.mulbase(q);
+        b.mul(*(ecjacobian *)pubkey, q);
+        uint slow = enet_time_get();
+        c.mulbinary(ecjacobian::base, q);
+        d.mulbinary(*(ecjacobian *)pubkey, q);
+        uint done = enet_time_get();
+        fasttime += slow - fast;
+        slowtime += done - slow;
+
+        a.normalize(); b.normalize(); c.normalize(); d.normalize();
+        if(a.x != c.x || a.y != c.y || b.x != d.x || b.y != d.y) mismatched++;
+    }
+    conoutf("authbench: server side %.1f/sec windowed, %.1f/sec double-and-add, %d of %d mismatched",
+        reference*1000.0f/max(fasttime, 1U), reference*1000.0f/max(slowtime, 1U), mismatched, reference);
+
+    freepubkey(pubkey);
+}
+COMMAND(authbench, "i");
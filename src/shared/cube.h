@@ -72,6 +72,9 @@ typedef int GLenum;
 #endif
 
 #include "tools.h"
+#ifdef STANDALONE
+#include "threads.h"
+#endif
 #include "geom.h"
 #include "ents.h"
 #include "command.h"
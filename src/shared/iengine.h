@@ -265,7 +265,9 @@ extern bool load_world(const char *mname, const char *cname = NULL);
 extern bool save_world(const char *mname, bool nolms = false);
 extern void getmapfilenames(const char *fname, const char *cname, char *pakname, char *mapname, char *cfgname);
 extern uint getmapcrc();
-extern bool loadents(const char *fname, vector<entity> &ents, uint *crc = NULL);
+extern bool loadents(const char *fname, vector<entity> &ents, uint *crc = NULL, bool pvs = false);
+extern void clearmappvs();
+extern bool mappvsoccluded(const vec &viewer, const ivec &bborigin, const ivec &bbsize);
 
 // physics
 extern void moveplayer(physent *pl, int moveres, bool local);
@@ -346,6 +348,14 @@ extern void sendpacket(int cn, int chan, ENetPacket *packet, int exclude = -1);
 extern void flushserver(bool force);
 extern int getnumclients();
 extern uint getclientip(int n);
+
+enum { PROF_TICK = 0, PROF_SERVERUPDATE, PROF_PARSEPACKET, PROF_WORLDSTATE, PROF_ENETSERVICE, PROF_ENETFLUSH, NUMPROFSECTIONS };
+
+extern bool profiling();
+extern uint profiletime();
+extern void profilesection(int section, uint start);
+extern void profilemessage(int type, int bytes, uint start);
+
 extern void putint(ucharbuf &p, int n);
 extern void putint(packetbuf &p, int n);
 extern void putint(vector<uchar> &p, int n);
@@ -354,6 +364,18 @@ extern void putuint(ucharbuf &p, int n);
 extern void putuint(packetbuf &p, int n);
 extern void putuint(vector<uchar> &p, int n);
 extern int getuint(ucharbuf &p);
+extern void putints(ucharbuf &p, const int *v, int n);
+extern void putints(packetbuf &p, const int *v, int n);
+extern void putints(vector<uchar> &p, const int *v, int n);
+extern void getints(ucharbuf &p, int *v, int n);
+extern void putuints(ucharbuf &p, const int *v, int n);
+extern void putuints(packetbuf &p, const int *v, int n);
+extern void putuints(vector<uchar> &p, const int *v, int n);
+extern void getuints(ucharbuf &p, int *v, int n);
+extern void putdelta(ucharbuf &p, const int *fields, const int *base, int numfields);
+extern void putdelta(packetbuf &p, const int *fields, const int *base, int numfields);
+extern void putdelta(vector<uchar> &p, const int *fields, const int *base, int numfields);
+extern int getdelta(ucharbuf &p, int *fields, const int *base, int numfields);
 extern void putfloat(ucharbuf &p, float f);
 extern void putfloat(packetbuf &p, float f);
 extern void putfloat(vector<uchar> &p, float f);
@@ -367,6 +389,7 @@ extern void localconnect();
 extern void disconnect_client(int n, int reason);
 extern void kicknonlocalclients(int reason = DISC_NONE);
 extern bool hasnonlocalclients();
+extern void serverparallel(void (*fn)(void *, int), void *data, int n);
 extern bool haslocalclients();
 extern void sendserverinforeply(ucharbuf &p);
 extern bool requestmaster(const char *req);
@@ -385,6 +408,7 @@ extern void gets2c();
 // crypto
 extern void genprivkey(const char *seed, vector<char> &privstr, vector<char> &pubstr);
 extern bool hashstring(const char *str, char *result, int maxlen);
+extern bool hashdata(const void *data, int len, char *result, int maxlen);
 extern void answerchallenge(const char *privstr, const char *challenge, vector<char> &answerstr);
 extern void *parsepubkey(const char *pubstr);
 extern void freepubkey(void *pubkey);
@@ -114,6 +114,8 @@ namespace server
     extern const char *defaultmaster();
     extern int masterport();
     extern void processmasterinput(const char *cmd, int cmdlen, const char *args);
+    extern void masterdisconnected();
+    extern bool compressionsample(int chan, int n, ucharbuf &p);
     extern bool ispaused();
 }
 
@@ -157,11 +157,130 @@ bool subhomedir(char *dst, int len, const char *src)
 	return true;
 }
 
+/* Lookups for reading go through an index of every file under the home and package
+ * directories, built by walking them once on first use, instead of probing each directory
+ * in turn. Files written through findfile() are added as they are created. An entry that
+ * has since vanished falls back to probing when it fails to open; other changes made
+ * behind the engine's back need a rescanfiles.
+ */
+
+#define MAXINDEXDEPTH 16
+
+static hashtable<const char *, int> fileindex(1<<12);
+static vector<char *> indexnames;
+static bool fileindexed = false;
+
+static void clearfileindex()
+{
+    fileindex.clear();
+    indexnames.deletearrays();
+    fileindexed = false;
+}
+
+static inline const char *indexdir(int dir) { return dir ? packagedirs[dir-1] : homedir; }
+
+static const char *indexkey(const char *filename)
+{
+    static string key;
+    if(strpbrk(filename, "<&:")) return NULL;
+    copystring(key, filename);
+    path(key);
+    if(key[0]==PATHDIV || (key[0]=='.' && key[1]=='.' && (!key[2] || key[2]==PATHDIV))) return NULL;
+#ifdef WIN32
+    for(char *c = key; *c; c++) *c = tolower(*c);
+#endif
+    return key;
+}
+
+static void indexfile(int dir, const char *name)
+{
+#ifdef WIN32
+    string lower;
+    copystring(lower, name);
+    for(char *c = lower; *c; c++) *c = tolower(*c);
+    name = lower;
+#endif
+    if(fileindex.access(name)) return;
+    char *key = indexnames.add(newstring(name));
+    fileindex[key] = dir;
+}
+
+static void indexfiles(int dir, char *name, size_t len, int depth)
+{
+    defformatstring(pathname)("%s%s", indexdir(dir), name);
+#ifdef WIN32
+    concatstring(pathname, "*");
+    WIN32_FIND_DATA FindFileData;
+    HANDLE Find = FindFirstFile(pathname, &FindFileData);
+    if(Find == INVALID_HANDLE_VALUE) return;
+    do
+    {
+        const char *file = FindFileData.cFileName;
+        bool isdir = (FindFileData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+#else
+    DIR *d = opendir(pathname[0] ? pathname : ".");
+    if(!d) return;
+    for(struct dirent *de; (de = readdir(d)) != NULL;)
+    {
+        const char *file = de->d_name;
+        bool isdir = false;
+#ifdef DT_DIR
+        if(de->d_type == DT_DIR) isdir = true;
+        else if(de->d_type == DT_LNK || de->d_type == DT_UNKNOWN)
+#endif
+        {
+            struct stat st;
+            defformatstring(filepath)("%s%s", pathname, file);
+            isdir = !stat(filepath, &st) && S_ISDIR(st.st_mode);
+        }
+#endif
+        if(file[0]=='.' && (!file[1] || (file[1]=='.' && !file[2]))) continue;
+        copystring(&name[len], file, sizeof(string) - len);
+        if(!isdir) indexfile(dir, name);
+        else if(depth < MAXINDEXDEPTH)
+        {
+            size_t sublen = strlen(name);
+            if(sublen + 1 >= sizeof(string)) continue;
+            name[sublen] = PATHDIV;
+            name[sublen+1] = '\0';
+            indexfiles(dir, name, sublen+1, depth+1);
+        }
+#ifdef WIN32
+    } while(FindNextFile(Find, &FindFileData));
+    FindClose(Find);
+#else
+    }
+    closedir(d);
+#endif
+    name[len] = '\0';
+}
+
+static void indexfiles()
+{
+    clearfileindex();
+    fileindexed = true;
+    string name = "";
+    if(homedir[0]) indexfiles(0, name, 0, 0);
+    loopv(packagedirs) indexfiles(i+1, name, 0, 0);
+}
+
+void rescanfiles()
+{
+    indexfiles();
+#ifndef STANDALONE
+    conoutf("indexed %d files", fileindex.numelems);
+#endif
+}
+#ifndef STANDALONE
+COMMAND(rescanfiles, "");
+#endif
+
 const char *sethomedir(const char *dir)
 {
     string pdir;
     copystring(pdir, dir);
 	if(!subhomedir(pdir, sizeof(pdir), dir) || !fixpackagedir(pdir)) return NULL;
+    clearfileindex();
     copystring(homedir, pdir);
 	return homedir;
 }
@@ -171,32 +290,18 @@ const char *addpackagedir(const char *dir)
     string pdir;
     copystring(pdir, dir);
     if(!subhomedir(pdir, sizeof(pdir), dir) || !fixpackagedir(pdir)) return NULL;
+    clearfileindex();
 	return packagedirs.add(newstring(pdir));
 }
 
-const char *findfile(const char *filename, const char *mode)
+static const char *probefile(const char *filename, const char *mode)
 {
     static string s;
     if(homedir[0])
     {
         formatstring(s)("%s%s", homedir, filename);
         if(fileexists(s, mode)) return s;
-        if(mode[0]=='w' || mode[0]=='a')
-        {
-            string dirs;
-            copystring(dirs, s);
-            char *dir = strchr(dirs[0]==PATHDIV ? dirs+1 : dirs, PATHDIV);
-            while(dir)
-            {
-                *dir = '\0';
-                if(!fileexists(dirs, "r") && !createdir(dirs)) return s;
-                *dir = PATHDIV;
-                dir = strchr(dir+1, PATHDIV);
-            }
-            return s;
-        }
     }
-    if(mode[0]=='w' || mode[0]=='a') return filename;
     loopv(packagedirs)
     {
         formatstring(s)("%s%s", packagedirs[i], filename);
@@ -205,6 +310,42 @@ const char *findfile(const char *filename, const char *mode)
     return filename;
 }
 
+const char *findfile(const char *filename, const char *mode)
+{
+    static string s;
+    if(mode[0]=='w' || mode[0]=='a')
+    {
+        if(!homedir[0]) return filename;
+        const char *key = fileindexed ? indexkey(filename) : NULL;
+        if(key)
+        {
+            int *dir = fileindex.access(key);
+            if(dir) *dir = 0;
+            else indexfile(0, key);
+        }
+        formatstring(s)("%s%s", homedir, filename);
+        if(fileexists(s, mode)) return s;
+        string dirs;
+        copystring(dirs, s);
+        char *dir = strchr(dirs[0]==PATHDIV ? dirs+1 : dirs, PATHDIV);
+        while(dir)
+        {
+            *dir = '\0';
+            if(!fileexists(dirs, "r") && !createdir(dirs)) return s;
+            *dir = PATHDIV;
+            dir = strchr(dir+1, PATHDIV);
+        }
+        return s;
+    }
+    const char *key = indexkey(filename);
+    if(!key) return probefile(filename, mode);
+    if(!fileindexed) indexfiles();
+    int *dir = fileindex.access(key);
+    if(!dir) return filename;
+    formatstring(s)("%s%s", indexdir(*dir), filename);
+    return s;
+}
+
 bool listdir(const char *dir, bool rel, const char *ext, vector<char *> &files)
 {
     int extsize = ext ? (int)strlen(ext)+1 : 0;
@@ -294,6 +435,12 @@ static int rwopsclose(SDL_RWops *rw)
 
 SDL_RWops *stream::rwops()
 {
+    const uchar *mem = mapped();
+    if(mem) 
+    {
+        long len = size();
+        if(len >= 0) return SDL_RWFromConstMem(mem, len);
+    }
     SDL_RWops *rw = SDL_AllocRW();
     if(!rw) return NULL;
     rw->hidden.unknown.data1 = this;
@@ -376,8 +523,16 @@ struct filestream : stream
 
 #ifndef STANDALONE
 VAR(dbggz, 0, 0, 1);
+VARP(gzthreads, 1, 4, 16);
+#else
+static const int gzthreads = 4;
 #endif
 
+/* Streams written with a block size are split into gzip members of at most that many
+ * uncompressed bytes. Stock gzip reads these as one file; every member header also carries
+ * an extra field with the member's compressed and uncompressed sizes, so that readers can
+ * find all members up front and inflate them in parallel.
+ */
 struct gzstream : stream
 {
     enum
@@ -385,7 +540,10 @@ struct gzstream : stream
         MAGIC1   = 0x1F,
         MAGIC2   = 0x8B,
         BUFSIZE  = 16384,
-        OS_UNIX  = 0x03
+        OS_UNIX  = 0x03,
+        BLOCKID1 = 'S',
+        BLOCKID2 = 'B',
+        BLOCKHEADERSIZE = 24
     };
 
     enum
@@ -402,10 +560,12 @@ struct gzstream : stream
     z_stream zfile;
     uchar *buf;
     bool reading, writing, autoclose;
-    uint crc;
-    int headersize;
+    uint crc, prevcrc;
+    int headersize, blocksize;
+    long prevsize;
+    vector<uchar> member;
 
-    gzstream() : file(NULL), buf(NULL), reading(false), writing(false), autoclose(false), crc(0), headersize(0)
+    gzstream() : file(NULL), buf(NULL), reading(false), writing(false), autoclose(false), crc(0), prevcrc(0), headersize(0), blocksize(0), prevsize(0)
     {
         zfile.zalloc = NULL;
         zfile.zfree = NULL;
@@ -425,6 +585,32 @@ struct gzstream : stream
         file->write(header, sizeof(header));
     }
 
+    void writetrailer()
+    {
+        uchar trailer[8] =
+        {
+            crc&0xFF, (crc>>8)&0xFF, (crc>>16)&0xFF, (crc>>24)&0xFF,
+            zfile.total_in&0xFF, (zfile.total_in>>8)&0xFF, (zfile.total_in>>16)&0xFF, (zfile.total_in>>24)&0xFF
+        };
+        file->write(trailer, sizeof(trailer));
+    }
+
+    void writemember()
+    {
+        uint size = member.length(), len = zfile.total_in;
+        uchar header[BLOCKHEADERSIZE] =
+        {
+            MAGIC1, MAGIC2, Z_DEFLATED, F_EXTRA, 0, 0, 0, 0, 0, OS_UNIX,
+            12, 0, BLOCKID1, BLOCKID2, 8, 0,
+            uchar(size&0xFF), uchar((size>>8)&0xFF), uchar((size>>16)&0xFF), uchar((size>>24)&0xFF),
+            uchar(len&0xFF), uchar((len>>8)&0xFF), uchar((len>>16)&0xFF), uchar((len>>24)&0xFF)
+        };
+        file->write(header, sizeof(header));
+        file->write(member.getbuf(), member.length());
+        writetrailer();
+        member.setsize(0);
+    }
+
     void readbuf(int size = BUFSIZE)
     {
         if(!zfile.avail_in) zfile.next_in = (Bytef *)buf;
@@ -454,7 +640,7 @@ struct gzstream : stream
         file->seek(n, SEEK_CUR);
     }
 
-    bool checkheader()
+    bool checkheader(bool first = true)
     {
         readbuf(10);
         if(readbyte() != MAGIC1 || readbyte() != MAGIC2 || readbyte() != Z_DEFLATED) return false;
@@ -470,11 +656,11 @@ struct gzstream : stream
         if(flags & F_NAME) while(readbyte(512));
         if(flags & F_COMMENT) while(readbyte(512));
         if(flags & F_CRC) skipbytes(2);
-        headersize = file->tell() - zfile.avail_in;
+        if(first) headersize = file->tell() - zfile.avail_in;
         return zfile.avail_in > 0 || !file->end();
     }
 
-    bool open(stream *f, const char *mode, bool needclose, int level)
+    bool open(stream *f, const char *mode, bool needclose, int level, int blocks = 0)
     {
         if(file) return false;
         for(; *mode; mode++)
@@ -498,21 +684,24 @@ struct gzstream : stream
         {
             if(!checkheader()) { stopreading(); return false; }
         }
-        else if(writing) writeheader();
+        else if(writing)
+        {
+            blocksize = max(blocks, 0);
+            if(!blocksize) writeheader();
+        }
         return true;
     }
 
-    uint getcrc() { return crc; }
+    uint getcrc() { return prevsize ? crc32_combine(prevcrc, crc, zfile.total_out) : crc; }
 
-    void finishreading()
+    void readtrailer()
     {
-        if(!reading) return;
+        uint checkcrc = 0, checksize = 0;
+        loopi(4) checkcrc |= uint(readbyte()) << (i*8);
+        loopi(4) checksize |= uint(readbyte()) << (i*8);
 #ifndef STANDALONE
         if(dbggz)
         {
-            uint checkcrc = 0, checksize = 0;
-            loopi(4) checkcrc |= uint(readbyte()) << (i*8);
-            loopi(4) checksize |= uint(readbyte()) << (i*8);
             if(checkcrc != crc)
                 conoutf(CON_DEBUG, "gzip crc check failed: read %X, calculated %X", checkcrc, crc);
             if(checksize != zfile.total_out)
@@ -521,6 +710,25 @@ struct gzstream : stream
 #endif
     }
 
+    void finishreading()
+    {
+        if(!reading) return;
+#ifndef STANDALONE
+        if(dbggz) readtrailer();
+#endif
+    }
+
+    bool nextmember()
+    {
+        readtrailer();
+        if(!checkheader(false)) return false;
+        prevcrc = getcrc();
+        prevsize += zfile.total_out;
+        inflateReset(&zfile);
+        crc = crc32(0, NULL, 0);
+        return true;
+    }
+
     void stopreading()
     {
         if(!reading) return;
@@ -528,9 +736,8 @@ struct gzstream : stream
         reading = false;
     }
 
-    void finishwriting()
+    void finishdeflate()
     {
-        if(!writing) return;
         for(;;)
         {
             int err = zfile.avail_out > 0 ? deflate(&zfile, Z_FINISH) : Z_OK;
@@ -538,12 +745,22 @@ struct gzstream : stream
             flush();
             if(err == Z_STREAM_END) break;
         }
-        uchar trailer[8] =
-        {
-            crc&0xFF, (crc>>8)&0xFF, (crc>>16)&0xFF, (crc>>24)&0xFF,
-            zfile.total_in&0xFF, (zfile.total_in>>8)&0xFF, (zfile.total_in>>16)&0xFF, (zfile.total_in>>24)&0xFF
-        };
-        file->write(trailer, sizeof(trailer));
+    }
+
+    void finishwriting()
+    {
+        if(!writing) return;
+        finishdeflate();
+        if(blocksize) writemember();
+        else writetrailer();
+    }
+
+    void endmember()
+    {
+        finishdeflate();
+        writemember();
+        deflateReset(&zfile);
+        crc = crc32(0, NULL, 0);
     }
 
     void stopwriting()
@@ -564,7 +781,7 @@ struct gzstream : stream
     }
 
     bool end() { return !reading && !writing; }
-    long tell() { return reading ? zfile.total_out : (writing ? zfile.total_in : -1); }
+    long tell() { return reading ? prevsize + zfile.total_out : (writing ? zfile.total_in : -1); }
 
     bool seek(long offset, int whence)
     {
@@ -576,24 +793,17 @@ struct gzstream : stream
             while(read(skip, sizeof(skip)) == sizeof(skip));
             return !offset;
         }
-        else if(whence == SEEK_CUR) offset += zfile.total_out;
+        else if(whence == SEEK_CUR) offset += tell();
 
-        if(offset >= (int)zfile.total_out) offset -= zfile.total_out;
+        if(offset >= tell()) offset -= tell();
         else if(offset < 0 || !file->seek(headersize, SEEK_SET)) return false;
         else
         {
-            if(zfile.next_in && zfile.total_in <= uint(zfile.next_in - buf))
-            {
-                zfile.avail_in += zfile.total_in;
-                zfile.next_in -= zfile.total_in;
-            }
-            else
-            {
-                zfile.avail_in = 0;
-                zfile.next_in = NULL;
-            }
+            zfile.avail_in = 0;
+            zfile.next_in = NULL;
             inflateReset(&zfile);
-            crc = crc32(0, NULL, 0);
+            crc = prevcrc = crc32(0, NULL, 0);
+            prevsize = 0;
         }
 
         uchar skip[512];
@@ -612,6 +822,7 @@ struct gzstream : stream
         if(!reading || !buf || !len) return 0;
         zfile.next_out = (Bytef *)buf;
         zfile.avail_out = len;
+        Bytef *unchecked = (Bytef *)buf;
         while(zfile.avail_out > 0)
         {
             if(!zfile.avail_in)
@@ -620,10 +831,15 @@ struct gzstream : stream
                 if(!zfile.avail_in) { stopreading(); break; }
             }
             int err = inflate(&zfile, Z_NO_FLUSH);
-            if(err == Z_STREAM_END) { crc = crc32(crc, (Bytef *)buf, len - zfile.avail_out); finishreading(); stopreading(); return len - zfile.avail_out; }
+            if(err == Z_STREAM_END)
+            {
+                crc = crc32(crc, unchecked, zfile.next_out - unchecked);
+                unchecked = zfile.next_out;
+                if(!nextmember()) { stopreading(); return len - zfile.avail_out; }
+            }
             else if(err != Z_OK) { stopreading(); break; }
         }
-        crc = crc32(crc, (Bytef *)buf, len - zfile.avail_out);
+        crc = crc32(crc, unchecked, zfile.next_out - unchecked);
         return len - zfile.avail_out;
     }
 
@@ -631,7 +847,8 @@ struct gzstream : stream
     {
         if(zfile.next_out && zfile.avail_out < BUFSIZE)
         {
-            if(file->write(buf, BUFSIZE - zfile.avail_out) != int(BUFSIZE - zfile.avail_out))
+            if(blocksize) member.put(buf, BUFSIZE - zfile.avail_out);
+            else if(file->write(buf, BUFSIZE - zfile.avail_out) != int(BUFSIZE - zfile.avail_out))
                 return false;
         }
         zfile.next_out = buf;
@@ -642,26 +859,594 @@ struct gzstream : stream
     int write(const void *buf, int len)
     {
         if(!writing || !buf || !len) return 0;
-        zfile.next_in = (Bytef *)buf;
-        zfile.avail_in = len;
-        while(zfile.avail_in > 0)
+        int written = 0;
+        while(written < len)
+        {
+            int n = len - written;
+            if(blocksize)
+            {
+                if(zfile.total_in >= uint(blocksize)) endmember();
+                n = min(n, int(blocksize - zfile.total_in));
+            }
+            zfile.next_in = (Bytef *)buf + written;
+            zfile.avail_in = n;
+            while(zfile.avail_in > 0)
+            {
+                if(!zfile.avail_out && !flush()) { stopwriting(); break; }
+                int err = deflate(&zfile, Z_NO_FLUSH);
+                if(err != Z_OK) { stopwriting(); break; }
+            }
+            crc = crc32(crc, (Bytef *)buf + written, n - zfile.avail_in);
+            written += n - zfile.avail_in;
+            if(!writing) break;
+        }
+        return written;
+    }
+};
+
+
+/* Reads a blocked gzip file by inflating up to a window of members ahead of the reader on
+ * gzthreads worker threads. The compressed file is read into memory whole, or used in
+ * place if it is already resident, so workers never touch the underlying stream.
+ */
+struct gzblockstream : stream
+{
+    enum { PENDING = 0, INFLATING, DONE, FAILED };
+    enum { MAXBLOCKLEN = 1<<26 };
+
+    struct block
+    {
+        uint offset, size, len;
+        uchar *data;
+        int state;
+    };
+
+    stream *file;
+    bool autoclose;
+    const uchar *src;
+    uchar *srcbuf;
+    vector<block> blocks;
+    int cur, curoffset, next, window, inflating;
+    long pos, total;
+    uint crc;
+    bool quit;
+    vector<SDL_Thread *> workers;
+    SDL_mutex *mutex;
+    SDL_cond *ready, *wake;
+
+    gzblockstream() : file(NULL), autoclose(false), src(NULL), srcbuf(NULL), cur(0), curoffset(0), next(0), window(0), inflating(0), pos(0), total(0), crc(0), quit(false), mutex(NULL), ready(NULL), wake(NULL) {}
+    ~gzblockstream() { close(); }
+
+    static uint getuint(const uchar *p) { return p[0] | (p[1]<<8) | (p[2]<<16) | (uint(p[3])<<24); }
+
+    bool index(const uchar *data, uint size)
+    {
+        for(uint offset = 0; offset < size;)
+        {
+            if(size - offset < gzstream::BLOCKHEADERSIZE + 8) return false;
+            const uchar *h = &data[offset];
+            if(h[0] != gzstream::MAGIC1 || h[1] != gzstream::MAGIC2 || h[2] != Z_DEFLATED || h[3] != gzstream::F_EXTRA) return false;
+            uint xlen = h[10] | (h[11]<<8), datastart = offset + 12 + xlen;
+            if(datastart > size) return false;
+            block *b = NULL;
+            for(const uchar *x = &h[12], *xend = &data[datastart]; x + 4 <= xend;)
+            {
+                uint sublen = x[2] | (x[3]<<8);
+                if(x + 4 + sublen > xend) return false;
+                if(x[0] == gzstream::BLOCKID1 && x[1] == gzstream::BLOCKID2 && sublen == 8)
+                {
+                    b = &blocks.add();
+                    b->offset = datastart;
+                    b->size = getuint(&x[4]);
+                    b->len = getuint(&x[8]);
+                    b->data = NULL;
+                    b->state = PENDING;
+                }
+                x += 4 + sublen;
+            }
+            if(!b || b->len > MAXBLOCKLEN || b->size > size - datastart || size - datastart - b->size < 8) return false;
+            total += b->len;
+            offset = datastart + b->size + 8;
+        }
+        return blocks.length() > 0;
+    }
+
+    bool open(stream *f, bool needclose, int threads)
+    {
+        long start = f->tell(), end = f->size();
+        if(start < 0 || end <= start || end - start > INT_MAX) return false;
+        uchar header[gzstream::BLOCKHEADERSIZE];
+        if(f->read(header, sizeof(header)) != sizeof(header) || header[3] != gzstream::F_EXTRA || header[12] != gzstream::BLOCKID1 || header[13] != gzstream::BLOCKID2)
+        {
+            f->seek(start, SEEK_SET);
+            return false;
+        }
+        const uchar *mem = f->mapped();
+        if(mem) src = &mem[start];
+        else
+        {
+            srcbuf = new uchar[end - start];
+            memcpy(srcbuf, header, sizeof(header));
+            int len = end - start - sizeof(header);
+            if(f->read(&srcbuf[sizeof(header)], len) != len) { f->seek(start, SEEK_SET); return false; }
+            src = srcbuf;
+        }
+        if(!index(src, end - start)) { f->seek(start, SEEK_SET); return false; }
+
+        file = f;
+        autoclose = needclose;
+        crc = crc32(0, NULL, 0);
+        window = 2*threads;
+        mutex = SDL_CreateMutex();
+        ready = SDL_CreateCond();
+        wake = SDL_CreateCond();
+        loopi(threads)
+        {
+            SDL_Thread *thread = SDL_CreateThread(work, this);
+            if(!thread) break;
+            workers.add(thread);
+        }
+        if(workers.empty()) { file = NULL; f->seek(start, SEEK_SET); return false; }
+        return true;
+    }
+
+    bool inflateblock(block &b, uchar *out)
+    {
+        z_stream z;
+        z.zalloc = NULL;
+        z.zfree = NULL;
+        z.opaque = NULL;
+        if(inflateInit2(&z, -MAX_WBITS) != Z_OK) return false;
+        z.next_in = (Bytef *)&src[b.offset];
+        z.avail_in = b.size;
+        z.next_out = out;
+        z.avail_out = b.len;
+        int err = inflate(&z, Z_FINISH);
+        bool ok = err == Z_STREAM_END && z.total_out == b.len && crc32(crc32(0, NULL, 0), out, b.len) == getuint(&src[b.offset + b.size]);
+        inflateEnd(&z);
+        return ok;
+    }
+
+    static int work(void *data)
+    {
+        gzblockstream *s = (gzblockstream *)data;
+        SDL_LockMutex(s->mutex);
+        for(;;)
+        {
+            while(!s->quit && (s->next >= s->blocks.length() || s->next >= s->cur + s->window)) SDL_CondWait(s->wake, s->mutex);
+            if(s->quit) break;
+            block &b = s->blocks[s->next++];
+            b.state = INFLATING;
+            s->inflating++;
+            SDL_UnlockMutex(s->mutex);
+
+            uchar *out = new uchar[max(b.len, 1U)];
+            bool ok = s->inflateblock(b, out);
+
+            SDL_LockMutex(s->mutex);
+            b.data = out;
+            b.state = ok ? DONE : FAILED;
+            s->inflating--;
+            SDL_CondBroadcast(s->ready);
+        }
+        SDL_UnlockMutex(s->mutex);
+        return 0;
+    }
+
+    void rewind()
+    {
+        SDL_LockMutex(mutex);
+        next = blocks.length();
+        while(inflating) SDL_CondWait(ready, mutex);
+        loopv(blocks)
+        {
+            DELETEA(blocks[i].data);
+            blocks[i].state = PENDING;
+        }
+        cur = curoffset = next = 0;
+        pos = 0;
+        crc = crc32(0, NULL, 0);
+        SDL_CondBroadcast(wake);
+        SDL_UnlockMutex(mutex);
+    }
+
+    void close()
+    {
+        if(!mutex) { DELETEA(srcbuf); return; }
+        SDL_LockMutex(mutex);
+        quit = true;
+        SDL_CondBroadcast(wake);
+        SDL_UnlockMutex(mutex);
+        loopv(workers) SDL_WaitThread(workers[i], NULL);
+        workers.setsize(0);
+        loopv(blocks) DELETEA(blocks[i].data);
+        SDL_DestroyCond(ready);
+        SDL_DestroyCond(wake);
+        SDL_DestroyMutex(mutex);
+        mutex = NULL;
+        DELETEA(srcbuf);
+        if(autoclose) DELETEP(file);
+    }
+
+    bool end() { return cur >= blocks.length(); }
+    long tell() { return pos; }
+    long size() { return total; }
+    uint getcrc() { return crc; }
+
+    bool seek(long offset, int whence)
+    {
+        switch(whence)
+        {
+            case SEEK_END: offset += total; break;
+            case SEEK_CUR: offset += pos; break;
+            case SEEK_SET: break;
+            default: return false;
+        }
+        if(offset < 0 || offset > total) return false;
+        if(offset < pos) rewind();
+        uchar skip[4096];
+        while(offset > pos)
         {
-            if(!zfile.avail_out && !flush()) { stopwriting(); break; }
-            int err = deflate(&zfile, Z_NO_FLUSH);
-            if(err != Z_OK) { stopwriting(); break; }
+            int skipped = min(offset - pos, (long)sizeof(skip));
+            if(read(skip, skipped) != skipped) return false;
         }
-        crc = crc32(crc, (Bytef *)buf, len - zfile.avail_in);
-        return len - zfile.avail_in;
+        return true;
+    }
+
+    int read(void *buf, int len)
+    {
+        int n = 0;
+        while(n < len && cur < blocks.length())
+        {
+            block &b = blocks[cur];
+            SDL_LockMutex(mutex);
+            while(b.state < DONE) SDL_CondWait(ready, mutex);
+            SDL_UnlockMutex(mutex);
+            if(b.state == FAILED) break;
+            int avail = min(int(b.len - curoffset), len - n);
+            memcpy(&((uchar *)buf)[n], &b.data[curoffset], avail);
+            crc = crc32(crc, &b.data[curoffset], avail);
+            curoffset += avail;
+            n += avail;
+            pos += avail;
+            if(curoffset >= int(b.len))
+            {
+                SDL_LockMutex(mutex);
+                DELETEA(b.data);
+                cur++;
+                curoffset = 0;
+                SDL_CondBroadcast(wake);
+                SDL_UnlockMutex(mutex);
+            }
+        }
+        return n;
     }
 };
 
+///////////////////////// asynchronous reads /////////////////////////
+
+/* A single background thread services read requests in the order they are queued, so
+ * blocks queued for the same stream are read sequentially. Streams are opened on the
+ * main thread, as findfile() and the zip index are not thread-safe, and only read on
+ * the I/O thread.
+ */
+
+#ifndef STANDALONE
+VARP(readahead, 0, 256, 16384);
+VARP(prefetchmax, 0, 64, 1024);
+#else
+static const int readahead = 256, prefetchmax = 64;
+#endif
+
+struct asyncread
+{
+    stream *file;
+    uchar *buf;
+    int len, result;
+    bool done;
+    asyncread *next;
+
+    asyncread() : file(NULL), buf(NULL), len(0), result(0), done(true), next(NULL) {}
+};
+
+static SDL_Thread *iothread = NULL;
+static SDL_mutex *iomutex = NULL;
+static SDL_cond *ioqueued = NULL, *iodone = NULL;
+static asyncread *iohead = NULL, *iotail = NULL;
+
+static int ioworker(void *data)
+{
+    SDL_LockMutex(iomutex);
+    for(;;)
+    {
+        while(!iohead) SDL_CondWait(ioqueued, iomutex);
+        asyncread *r = iohead;
+        iohead = r->next;
+        if(!iohead) iotail = NULL;
+        SDL_UnlockMutex(iomutex);
+
+        int result = 0;
+        while(result < r->len)
+        {
+            int n = r->file->read(&r->buf[result], r->len - result);
+            if(n <= 0) break;
+            result += n;
+        }
+
+        SDL_LockMutex(iomutex);
+        r->result = result;
+        r->done = true;
+        SDL_CondBroadcast(iodone);
+    }
+    return 0;
+}
+
+static bool startio()
+{
+    if(iothread) return true;
+    if(!iomutex)
+    {
+        iomutex = SDL_CreateMutex();
+        ioqueued = SDL_CreateCond();
+        iodone = SDL_CreateCond();
+    }
+    iothread = SDL_CreateThread(ioworker, NULL);
+    return iothread != NULL;
+}
+
+static bool queueread(asyncread *r)
+{
+    if(!startio()) return false;
+    SDL_LockMutex(iomutex);
+    r->done = false;
+    r->result = 0;
+    r->next = NULL;
+    if(iotail) iotail->next = r;
+    else iohead = r;
+    iotail = r;
+    SDL_CondSignal(ioqueued);
+    SDL_UnlockMutex(iomutex);
+    return true;
+}
+
+static void waitread(asyncread *r)
+{
+    if(!iothread) return;
+    SDL_LockMutex(iomutex);
+    while(!r->done) SDL_CondWait(iodone, iomutex);
+    SDL_UnlockMutex(iomutex);
+}
+
+bool asyncreaddone(asyncread *r)
+{
+    if(!iothread) return true;
+    SDL_LockMutex(iomutex);
+    bool done = r->done;
+    SDL_UnlockMutex(iomutex);
+    return done;
+}
+
+asyncread *loadfileasync(const char *fn)
+{
+    stream *f = openfile(fn, "rb");
+    if(!f) return NULL;
+    long len = f->size();
+    if(len <= 0) { delete f; return NULL; }
+    asyncread *r = new asyncread;
+    r->file = f;
+    r->len = len;
+    r->buf = new uchar[len+1];
+    r->buf[len] = 0;
+    if(!queueread(r))
+    {
+        r->result = f->read(r->buf, len);
+        r->done = true;
+    }
+    return r;
+}
+
+char *finishasyncread(asyncread *r, int *size)
+{
+    waitread(r);
+    char *buf = (char *)r->buf;
+    if(r->result != r->len) { delete[] buf; buf = NULL; }
+    else if(size) *size = r->len;
+    delete r->file;
+    delete r;
+    return buf;
+}
+
+struct prefetch
+{
+    char *name;
+    asyncread *req;
+};
+static hashtable<const char *, prefetch> prefetched(1<<8);
+static int prefetchsize = 0;
+
+bool prefetchfile(const char *fn)
+{
+    if(prefetched.access(fn) || prefetchsize >= prefetchmax<<20) return false;
+    asyncread *r = loadfileasync(fn);
+    if(!r) return false;
+    char *name = newstring(fn);
+    prefetch &p = prefetched[name];
+    p.name = name;
+    p.req = r;
+    prefetchsize += r->len;
+    return true;
+}
+
+char *loadprefetched(const char *fn, int *size)
+{
+    prefetch *p = prefetched.access(fn);
+    if(!p) return NULL;
+    prefetch cur = *p;
+    prefetched.remove(fn);
+    delete[] cur.name;
+    prefetchsize -= cur.req->len;
+    return finishasyncread(cur.req, size);
+}
+
+void flushprefetched()
+{
+    enumerate(prefetched, prefetch, p,
+    {
+        delete[] finishasyncread(p.req, NULL);
+        delete[] p.name;
+    });
+    prefetched.clear();
+    prefetchsize = 0;
+}
+
+/* Keeps up to readahead KB of the wrapped stream queued on the I/O thread, so that the
+ * disk reads of a large sequential load overlap whatever the caller does with the data.
+ */
+struct readaheadstream : stream
+{
+    enum { BLOCKSIZE = 64*1024 };
+
+    stream *file;
+    bool autoclose;
+    vector<asyncread *> blocks;
+    int first, pending, offset;
+    long pos;
+    bool eof;
+
+    readaheadstream() : file(NULL), autoclose(false), first(0), pending(0), offset(0), pos(0), eof(false) {}
+    ~readaheadstream() { close(); }
+
+    void open(stream *f, bool needclose, int size)
+    {
+        file = f;
+        autoclose = needclose;
+        pos = f->tell();
+        loopi(max(size/BLOCKSIZE, 2))
+        {
+            asyncread *r = blocks.add(new asyncread);
+            r->file = f;
+            r->buf = new uchar[BLOCKSIZE];
+            r->len = BLOCKSIZE;
+        }
+        fill();
+    }
+
+    asyncread *block(int i) { return blocks[(first + i) % blocks.length()]; }
+
+    void fill()
+    {
+        while(!eof && pending < blocks.length())
+        {
+            queueread(block(pending));
+            pending++;
+        }
+    }
+
+    void drain()
+    {
+        loopi(pending) waitread(block(i));
+        first = pending = offset = 0;
+        eof = false;
+        file->seek(pos, SEEK_SET);
+    }
+
+    void close()
+    {
+        if(!file) return;
+        loopi(pending) waitread(block(i));
+        pending = 0;
+        loopv(blocks) delete[] blocks[i]->buf;
+        blocks.deletecontents();
+        if(autoclose) delete file;
+        file = NULL;
+    }
+
+    bool end() { return eof && !pending; }
+    long tell() { return pos; }
+
+    bool seek(long newpos, int whence)
+    {
+        if(whence == SEEK_CUR) { newpos += pos; whence = SEEK_SET; }
+        if(whence == SEEK_SET && newpos >= pos)
+        {
+            uchar skip[512];
+            while(newpos > pos) if(read(skip, min(newpos - pos, (long)sizeof(skip))) <= 0) return false;
+            return true;
+        }
+        drain();
+        if(!file->seek(newpos, whence)) return false;
+        pos = file->tell();
+        fill();
+        return pos >= 0;
+    }
+
+    long size()
+    {
+        drain();
+        long len = file->size();
+        fill();
+        return len;
+    }
+
+    int read(void *buf, int len)
+    {
+        int total = 0;
+        while(total < len && pending)
+        {
+            asyncread *r = block(0);
+            waitread(r);
+            int n = min(r->result - offset, len - total);
+            memcpy(&((uchar *)buf)[total], &r->buf[offset], n);
+            offset += n;
+            total += n;
+            pos += n;
+            if(offset < r->result) break;
+            if(r->result < r->len) eof = true;
+            first = (first + 1) % blocks.length();
+            pending--;
+            offset = 0;
+            fill();
+        }
+        return total;
+    }
+};
+
+stream *openreadahead(stream *file, bool autoclose, int size)
+{
+    if(size <= 0 || file->mapped() || file->tell() < 0 || !startio()) return file;
+    readaheadstream *s = new readaheadstream;
+    s->open(file, autoclose, size);
+    return s;
+}
+
+bool getfilestamp(const char *filename, uint &size, uint &mtime)
+{
+    const char *found = findfile(filename, "rb");
+    if(!found) return false;
+#ifdef WIN32
+    WIN32_FILE_ATTRIBUTE_DATA attr;
+    if(!GetFileAttributesEx(found, GetFileExInfoStandard, &attr)) return false;
+    size = attr.nFileSizeLow;
+    mtime = attr.ftLastWriteTime.dwLowDateTime;
+#else
+    struct stat st;
+    if(stat(found, &st) < 0) return false;
+    size = uint(st.st_size);
+    mtime = uint(st.st_mtime);
+#endif
+    return true;
+}
 
 stream *openrawfile(const char *filename, const char *mode)
 {
     const char *found = findfile(filename, mode);
     if(!found) return NULL;
     filestream *file = new filestream;
-    if(!file->open(found, mode)) { delete file; return NULL; }
+    if(!file->open(found, mode))
+    {
+        const char *probed = mode[0]=='r' && fileindexed ? probefile(filename, mode) : NULL;
+        if(!probed || !strcmp(probed, found) || !file->open(probed, mode)) { delete file; return NULL; }
+    }
     return file;
 }
 
@@ -674,6 +1459,39 @@ stream *openfile(const char *filename, const char *mode)
     return openrawfile(filename, mode);
 }
 
+#ifndef STANDALONE
+void gzbench(const char *name, int *iterations)
+{
+    int oldthreads = gzthreads, times[2] = { 0, 0 };
+    long len = 0;
+    uint crcs[2] = { 0, 0 };
+    uchar *buf = new uchar[1<<16];
+    stream *raw = openfile(name, "rb");
+    bool blocked = raw && raw->read(buf, gzstream::BLOCKHEADERSIZE) == gzstream::BLOCKHEADERSIZE &&
+                   buf[3] == gzstream::F_EXTRA && buf[12] == gzstream::BLOCKID1 && buf[13] == gzstream::BLOCKID2;
+    DELETEP(raw);
+    loopk(2)
+    {
+        gzthreads = k ? oldthreads : 1;
+        uint start = enet_time_get();
+        loopi(max(*iterations, 1))
+        {
+            stream *f = opengzfile(name, "rb");
+            if(!f) { conoutf(CON_ERROR, "could not read %s", name); gzthreads = oldthreads; delete[] buf; return; }
+            len = 0;
+            for(int n; (n = f->read(buf, 1<<16)) > 0;) len += n;
+            crcs[k] = f->getcrc();
+            delete f;
+        }
+        times[k] = enet_time_get() - start;
+    }
+    gzthreads = oldthreads;
+    delete[] buf;
+    conoutf("gzbench: %s (%s), %ld bytes: 1 thread %dms, %d threads %dms%s", name, blocked ? "blocked" : "single stream", len, times[0], gzthreads, times[1], crcs[0] != crcs[1] ? ", crc mismatch" : "");
+}
+COMMAND(gzbench, "si");
+#endif
+
 stream *opentempfile(const char *name, const char *mode)
 {
     const char *found = findfile(name, mode);
@@ -682,12 +1500,22 @@ stream *opentempfile(const char *name, const char *mode)
     return file;
 }
 
-stream *opengzfile(const char *filename, const char *mode, stream *file, int level)
+stream *opengzfile(const char *filename, const char *mode, stream *file, int level, int blocksize)
 {
     stream *source = file ? file : openfile(filename, mode);
     if(!source) return NULL;
+    if(mode[0] == 'r')
+    {
+        if(gzthreads > 1)
+        {
+            gzblockstream *blocks = new gzblockstream;
+            if(blocks->open(source, !file, gzthreads)) return blocks;
+            delete blocks;
+        }
+        if(!file) source = openreadahead(source, true, readahead<<10);
+    }
     gzstream *gz = new gzstream;
-    if(!gz->open(source, mode, !file, level)) { if(!file) delete source; return NULL; }
+    if(!gz->open(source, mode, !file, level, blocksize)) { if(!file) delete source; return NULL; }
     return gz;
 }
 
@@ -711,3 +1539,160 @@ char *loadfile(const char *fn, int *size)
     return buf;
 }
 
+
+#ifndef STANDALONE
+///////////////////////// asset cache /////////////////////////
+
+/* Decoded assets are stored under cache/<kind>/ in the home directory, named by a hash of
+ * the source file's contents, so an unchanged asset skips its decoder on later loads no
+ * matter which path or package it was found under. Entries are gzip compressed and the
+ * cache is off by default. Once it grows past assetcachesize megabytes the least recently
+ * used entries are removed; clearassetcache empties it.
+ */
+
+VARP(assetcache, 0, 0, 1);
+VARP(assetcachesize, 1, 256, 4095);
+
+struct cachedasset
+{
+    string name;
+    uint size, mtime;
+};
+
+static vector<cachedasset> cachedassets;
+static bool cachedassetsscanned = false;
+static uint cachedassetbytes = 0;
+
+static void scancachedassets()
+{
+    cachedassetsscanned = true;
+    cachedassets.setsize(0);
+    cachedassetbytes = 0;
+    if(!homedir[0]) return;
+    vector<char *> kinds, files;
+    defformatstring(cachedir)("%scache", homedir);
+    listdir(cachedir, false, NULL, kinds);
+    loopv(kinds) if(kinds[i][0] != '.')
+    {
+        defformatstring(kinddir)("%s%c%s", cachedir, PATHDIV, kinds[i]);
+        listdir(kinddir, false, NULL, files);
+        loopvj(files) if(files[j][0] != '.')
+        {
+            cachedasset &a = cachedassets.add();
+            formatstring(a.name)("cache%c%s%c%s", PATHDIV, kinds[i], PATHDIV, files[j]);
+            if(!getfilestamp(a.name, a.size, a.mtime)) { cachedassets.pop(); continue; }
+            cachedassetbytes += a.size;
+        }
+        files.deletearrays();
+    }
+    kinds.deletearrays();
+}
+
+static int cachedassetcmp(const cachedasset *x, const cachedasset *y)
+{
+    if(x->mtime < y->mtime) return -1;
+    if(x->mtime > y->mtime) return 1;
+    return 0;
+}
+
+static void trimassetcache()
+{
+    uint limit = uint(assetcachesize)<<20;
+    if(cachedassetbytes <= limit) return;
+    cachedassets.sort(cachedassetcmp);
+    int removed = 0;
+    while(removed < cachedassets.length() && cachedassetbytes > limit)
+    {
+        cachedasset &a = cachedassets[removed++];
+        remove(findfile(a.name, "wb"));
+        cachedassetbytes -= a.size;
+    }
+    cachedassets.remove(0, removed);
+}
+
+bool assetcachekey(const void *data, int len, char *key, int maxlen)
+{
+    key[0] = '\0';
+    if(!assetcache || !homedir[0] || !hashdata(data, len, key, maxlen)) { key[0] = '\0'; return false; }
+    return true;
+}
+
+static void touchcachedasset(const char *name)
+{
+    if(!cachedassetsscanned) scancachedassets();
+    loopv(cachedassets) if(!strcmp(cachedassets[i].name, name))
+    {
+        cachedassets[i].mtime = uint(time(NULL));
+        break;
+    }
+}
+
+#define MAXCACHEDASSET (1<<28)
+
+char *loadcachedasset(const char *kind, const char *key, int *size)
+{
+    defformatstring(name)("cache%c%s%c%s", PATHDIV, kind, PATHDIV, key);
+    stream *f = opengzfile(name, "rb");
+    if(!f) return NULL;
+    int len = f->getlil<int>();
+    char *buf = len > 0 && len <= MAXCACHEDASSET ? new char[len] : NULL;
+    if(buf && f->read(buf, len) != len) DELETEA(buf);
+    delete f;
+    if(!buf) return NULL;
+    touchcachedasset(name);
+    if(size) *size = len;
+    return buf;
+}
+
+bool storecachedasset(const char *kind, const char *key, const void *data, int size)
+{
+    if(!cachedassetsscanned) scancachedassets();
+    defformatstring(name)("cache%c%s%c%s", PATHDIV, kind, PATHDIV, key);
+    stream *f = openrawfile(name, "wb");
+    if(!f) return false;
+    stream *gz = opengzfile(NULL, "wb", f, Z_BEST_SPEED);
+    bool written = gz && gz->putlil<int>(size) && gz->write(data, size) == size;
+    DELETEP(gz);
+    delete f;
+    cachedasset a;
+    copystring(a.name, name);
+    if(!written || !getfilestamp(name, a.size, a.mtime)) { remove(findfile(name, "wb")); return false; }
+    a.mtime = uint(time(NULL));
+    loopv(cachedassets) if(!strcmp(cachedassets[i].name, name))
+    {
+        cachedassetbytes -= cachedassets[i].size;
+        cachedassets.removeunordered(i);
+        break;
+    }
+    cachedassets.add(a);
+    cachedassetbytes += a.size;
+    trimassetcache();
+    return true;
+}
+
+void clearassetcache()
+{
+    if(!homedir[0]) return;
+    vector<char *> kinds, files;
+    defformatstring(cachedir)("%scache", homedir);
+    listdir(cachedir, false, NULL, kinds);
+    int removed = 0;
+    loopv(kinds) if(kinds[i][0] != '.')
+    {
+        defformatstring(kinddir)("%s%c%s", cachedir, PATHDIV, kinds[i]);
+        listdir(kinddir, false, NULL, files);
+        loopvj(files) if(files[j][0] != '.')
+        {
+            defformatstring(file)("%s%c%s", kinddir, PATHDIV, files[j]);
+            if(!remove(file)) removed++;
+        }
+        files.deletearrays();
+    }
+    kinds.deletearrays();
+    cachedassets.setsize(0);
+    cachedassetbytes = 0;
+    if(removed) clearfileindex();
+    conoutf("removed %d cached assets", removed);
+}
+COMMAND(clearassetcache, "");
+#endif
@@ -0,0 +1,97 @@
+// threads.h: the subset of SDL's thread API the engine uses, on top of pthreads for builds without SDL
+
+#ifndef __THREADS_H__
+#define __THREADS_H__
+
+#include <pthread.h>
+#include <errno.h>
+#include <sys/time.h>
+
+#define SDL_MUTEX_TIMEDOUT 1
+
+struct SDL_Thread
+{
+    pthread_t handle;
+    int (*fn)(void *);
+    void *data;
+    int status;
+
+    static void *run(void *t)
+    {
+        SDL_Thread *thread = (SDL_Thread *)t;
+        thread->status = thread->fn(thread->data);
+        return NULL;
+    }
+};
+
+static inline SDL_Thread *SDL_CreateThread(int (*fn)(void *), void *data)
+{
+    SDL_Thread *thread = new SDL_Thread;
+    thread->fn = fn;
+    thread->data = data;
+    thread->status = 0;
+    if(pthread_create(&thread->handle, NULL, SDL_Thread::run, thread)) { delete thread; return NULL; }
+    return thread;
+}
+
+static inline void SDL_WaitThread(SDL_Thread *thread, int *status)
+{
+    if(!thread) return;
+    pthread_join(thread->handle, NULL);
+    if(status) *status = thread->status;
+    delete thread;
+}
+
+struct SDL_mutex { pthread_mutex_t handle; };
+
+static inline SDL_mutex *SDL_CreateMutex()
+{
+    SDL_mutex *mutex = new SDL_mutex;
+    pthread_mutex_init(&mutex->handle, NULL);
+    return mutex;
+}
+
+static inline void SDL_DestroyMutex(SDL_mutex *mutex)
+{
+    if(!mutex) return;
+    pthread_mutex_destroy(&mutex->handle);
+    delete mutex;
+}
+
+static inline int SDL_LockMutex(SDL_mutex *mutex) { return pthread_mutex_lock(&mutex->handle) ? -1 : 0; }
+static inline int SDL_UnlockMutex(SDL_mutex *mutex) { return pthread_mutex_unlock(&mutex->handle) ? -1 : 0; }
+
+struct SDL_cond { pthread_cond_t handle; };
+
+static inline SDL_cond *SDL_CreateCond()
+{
+    SDL_cond *cond = new SDL_cond;
+    pthread_cond_init(&cond->handle, NULL);
+    return cond;
+}
+
+static inline void SDL_DestroyCond(SDL_cond *cond)
+{
+    if(!cond) return;
+    pthread_cond_destroy(&cond->handle);
+    delete cond;
+}
+
+static inline int SDL_CondSignal(SDL_cond *cond) { return pthread_cond_signal(&cond->handle) ? -1 : 0; }
+static inline int SDL_CondBroadcast(SDL_cond *cond) { return pthread_cond_broadcast(&cond->handle) ? -1 : 0; }
+static inline int SDL_CondWait(SDL_cond *cond, SDL_mutex *mutex) { return pthread_cond_wait(&cond->handle, &mutex->handle) ? -1 : 0; }
+
+static inline int SDL_CondWaitTimeout(SDL_cond *cond, SDL_mutex *mutex, unsigned int ms)
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    struct timespec abstime;
+    abstime.tv_sec = now.tv_sec + ms/1000;
+    abstime.tv_nsec = (now.tv_usec + (ms%1000)*1000)*1000;
+    if(abstime.tv_nsec >= 1000000000) { abstime.tv_sec++; abstime.tv_nsec -= 1000000000; }
+    int err = pthread_cond_timedwait(&cond->handle, &mutex->handle, &abstime);
+    return err == ETIMEDOUT ? SDL_MUTEX_TIMEDOUT : (err ? -1 : 0);
+}
+
+#endif
+
@@ -1,6 +1,9 @@
 // implementation of generic tools
 
 #include "cube.h"
+#ifndef WIN32
+#include <unistd.h>
+#endif
 
 ////////////////////////// rnd numbers ////////////////////////////////////////
 
@@ -36,3 +39,16 @@ uint randomMT()
     return y;
 }
 
+////////////////////////// system info ////////////////////////////////////////
+
+int numcpus()
+{
+#ifdef WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return max(int(info.dwNumberOfProcessors), 1);
+#else
+    return max(int(sysconf(_SC_NPROCESSORS_ONLN)), 1);
+#endif
+}
+
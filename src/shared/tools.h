@@ -936,6 +936,7 @@ struct stream
     virtual bool putline(const char *str) { return putstring(str) && putchar('\n'); }
     virtual int printf(const char *fmt, ...) { return -1; }
     virtual uint getcrc() { return 0; }
+    virtual const uchar *mapped() { return NULL; } // whole contents, if the stream is already resident in memory
 
     template<class T> bool put(T n) { return write(&n, sizeof(n)) == sizeof(n); }
     template<class T> bool putlil(T n) { return put<T>(lilswap(n)); }
@@ -955,6 +956,7 @@ extern char *path(char *s);
 extern char *path(const char *s, bool copy);
 extern const char *parentdir(const char *directory);
 extern bool fileexists(const char *path, const char *mode);
+extern bool getfilestamp(const char *filename, uint &size, uint &mtime);
 extern bool createdir(const char *path);
 extern size_t fixpackagedir(char *dir);
 extern const char *sethomedir(const char *dir);
@@ -964,13 +966,27 @@ extern stream *openrawfile(const char *filename, const char *mode);
 extern stream *openzipfile(const char *filename, const char *mode);
 extern stream *openfile(const char *filename, const char *mode);
 extern stream *opentempfile(const char *filename, const char *mode);
-extern stream *opengzfile(const char *filename, const char *mode, stream *file = NULL, int level = Z_BEST_COMPRESSION);
+extern stream *opengzfile(const char *filename, const char *mode, stream *file = NULL, int level = Z_BEST_COMPRESSION, int blocksize = 0);
 extern char *loadfile(const char *fn, int *size);
+struct asyncread;
+extern asyncread *loadfileasync(const char *fn);
+extern bool asyncreaddone(asyncread *r);
+extern char *finishasyncread(asyncread *r, int *size);
+extern bool prefetchfile(const char *fn);
+extern char *loadprefetched(const char *fn, int *size);
+extern void flushprefetched();
+extern stream *openreadahead(stream *file, bool autoclose, int size);
 extern bool listdir(const char *dir, bool rel, const char *ext, vector<char *> &files);
 extern int listfiles(const char *dir, const char *ext, vector<char *> &files);
 extern int listzipfiles(const char *dir, const char *ext, vector<char *> &files);
+extern void rescanfiles();
+extern int assetcache;
+extern bool assetcachekey(const void *data, int len, char *key, int maxlen);
+extern char *loadcachedasset(const char *kind, const char *key, int *size);
+extern bool storecachedasset(const char *kind, const char *key, const void *data, int size);
 extern void seedMT(uint seed);
 extern uint randomMT(void);
+extern int numcpus();
 
 #endif
 
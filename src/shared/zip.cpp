@@ -1,5 +1,12 @@
 #include "cube.h"
 
+#ifndef WIN32
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+
 enum
 {
     ZIP_LOCAL_FILE_SIGNATURE = 0x04034B50,
@@ -35,12 +42,15 @@ struct zipdirectoryheader
     ushort commentlength;
 };
 
+struct ziparchive;
+
 struct zipfile
 {
     char *name;
     uint header, offset, size, compressedsize;
+    ziparchive *arch;
 
-    zipfile() : name(NULL), header(0), offset(~0U), size(0), compressedsize(0)
+    zipfile() : name(NULL), header(0), offset(~0U), size(0), compressedsize(0), arch(NULL)
     {
     }
     ~zipfile() 
@@ -49,47 +59,97 @@ struct zipfile
     }
 };
 
-struct zipstream;
-
+/* Archives are mapped into memory whole, so that stored entries can be handed out in place
+ * and deflated entries inflate straight from the mapping instead of through a read buffer.
+ * If the archive can't be mapped it is read into memory instead.
+ */
 struct ziparchive
 {
     char *name;
-    FILE *data;
+    uchar *data;
+    uint datasize;
+    bool mapped;
     hashtable<const char *, zipfile> files;
     int openfiles;
-    zipstream *owner;
 
-    ziparchive() : name(NULL), data(NULL), files(512), openfiles(0), owner(NULL)
+    ziparchive() : name(NULL), data(NULL), datasize(0), mapped(false), files(512), openfiles(0)
     {
     }
     ~ziparchive()
     {
         DELETEA(name);
-        if(data) { fclose(data); data = NULL; }
+        unmap();
+    }
+
+    bool map(const char *filename)
+    {
+#ifdef WIN32
+        HANDLE file = CreateFile(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if(file == INVALID_HANDLE_VALUE) return false;
+        DWORD size = GetFileSize(file, NULL);
+        if(size != INVALID_FILE_SIZE && size > 0)
+        {
+            HANDLE mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+            if(mapping)
+            {
+                data = (uchar *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+                CloseHandle(mapping);
+                if(data) { datasize = size; mapped = true; }
+            }
+        }
+        CloseHandle(file);
+#else
+        int fd = ::open(filename, O_RDONLY);
+        if(fd < 0) return false;
+        struct stat st;
+        if(fstat(fd, &st) >= 0 && st.st_size > 0 && st.st_size <= 0xFFFFFFFF)
+        {
+            void *mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(mapping != MAP_FAILED) { data = (uchar *)mapping; datasize = st.st_size; mapped = true; }
+        }
+        ::close(fd);
+#endif
+        if(data) return true;
+
+        FILE *f = fopen(filename, "rb");
+        if(!f) return false;
+        long size = fseek(f, 0, SEEK_END) >= 0 ? ftell(f) : -1;
+        if(size > 0 && fseek(f, 0, SEEK_SET) >= 0)
+        {
+            data = new uchar[size];
+            if((long)fread(data, 1, size, f) == size) datasize = size;
+            else DELETEA(data);
+        }
+        fclose(f);
+        return data != NULL;
+    }
+
+    void unmap()
+    {
+        if(!data) return;
+        if(mapped)
+        {
+#ifdef WIN32
+            UnmapViewOfFile(data);
+#else
+            munmap(data, datasize);
+#endif
+        }
+        else delete[] data;
+        data = NULL;
+        datasize = 0;
+        mapped = false;
     }
 };
 
-static bool findzipdirectory(FILE *f, zipdirectoryheader &hdr)
+static bool findzipdirectory(ziparchive &arch, zipdirectoryheader &hdr)
 {
-    if(fseek(f, 0, SEEK_END) < 0) return false;
+    if(arch.datasize < ZIP_DIRECTORY_SIZE) return false;
 
-    uchar buf[1024], *src = NULL;
-    int len = 0, offset = ftell(f), end = max(offset - 0xFFFF - ZIP_DIRECTORY_SIZE, 0);
     const uint signature = lilswap<uint>(ZIP_DIRECTORY_SIGNATURE);
-
-    while(offset > end)
-    {
-        int carry = min(len, ZIP_DIRECTORY_SIZE-1), next = min((int)sizeof(buf) - carry, offset - end);
-        offset -= next;
-        memmove(&buf[next], buf, carry);
-        if(next + carry < ZIP_DIRECTORY_SIZE || fseek(f, offset, SEEK_SET) < 0 || (int)fread(buf, 1, next, f) != next) return false;
-        len = next + carry;
-        uchar *search = &buf[next-1];
-        for(; search >= buf; search--) if(*(uint *)search == signature) break; 
-        if(search >= buf) { src = search; break; }
-    }        
-
-    if(&buf[len] - src < ZIP_DIRECTORY_SIZE) return false;
+    const uchar *src = &arch.data[arch.datasize - ZIP_DIRECTORY_SIZE],
+                *end = &arch.data[arch.datasize > 0xFFFF + ZIP_DIRECTORY_SIZE ? arch.datasize - 0xFFFF - ZIP_DIRECTORY_SIZE : 0];
+    for(; *(const uint *)src != signature; src--) if(src <= end) return false;
 
     hdr.signature = lilswap(*(uint *)src); src += 4;
     hdr.disknumber = lilswap(*(ushort *)src); src += 2;
@@ -109,32 +169,32 @@ static bool findzipdirectory(FILE *f, zipdirectoryheader &hdr)
 VAR(dbgzip, 0, 0, 1);
 #endif
 
-static bool readzipdirectory(const char *archname, FILE *f, int entries, int offset, int size, vector<zipfile> &files)
+static bool readzipdirectory(const char *archname, ziparchive &arch, int entries, uint offset, uint size, vector<zipfile> &files)
 {
-    uchar *buf = new uchar[size], *src = buf;
-    if(fseek(f, offset, SEEK_SET) < 0 || (int)fread(buf, 1, size, f) != size) { delete[] buf; return false; }
+    if(offset > arch.datasize || size > arch.datasize - offset) return false;
+    const uchar *buf = &arch.data[offset], *src = buf;
     loopi(entries)
     {
         if(src + ZIP_FILE_SIZE > &buf[size]) break;
 
         zipfileheader hdr;
-        hdr.signature = lilswap(*(uint *)src); src += 4;
-        hdr.version = lilswap(*(ushort *)src); src += 2;
-        hdr.needversion = lilswap(*(ushort *)src); src += 2;
-        hdr.flags = lilswap(*(ushort *)src); src += 2;
-        hdr.compression = lilswap(*(ushort *)src); src += 2;
-        hdr.modtime = lilswap(*(ushort *)src); src += 2;
-        hdr.moddate = lilswap(*(ushort *)src); src += 2;
-        hdr.crc32 = lilswap(*(uint *)src); src += 4;
-        hdr.compressedsize = lilswap(*(uint *)src); src += 4;
-        hdr.uncompressedsize = lilswap(*(uint *)src); src += 4;
-        hdr.namelength = lilswap(*(ushort *)src); src += 2;
-        hdr.extralength = lilswap(*(ushort *)src); src += 2;
-        hdr.commentlength = lilswap(*(ushort *)src); src += 2;
-        hdr.disknumber = lilswap(*(ushort *)src); src += 2;
-        hdr.internalattribs = lilswap(*(ushort *)src); src += 2;
-        hdr.externalattribs = lilswap(*(uint *)src); src += 4;
-        hdr.offset = lilswap(*(uint *)src); src += 4;
+        hdr.signature = lilswap(*(const uint *)src); src += 4;
+        hdr.version = lilswap(*(const ushort *)src); src += 2;
+        hdr.needversion = lilswap(*(const ushort *)src); src += 2;
+        hdr.flags = lilswap(*(const ushort *)src); src += 2;
+        hdr.compression = lilswap(*(const ushort *)src); src += 2;
+        hdr.modtime = lilswap(*(const ushort *)src); src += 2;
+        hdr.moddate = lilswap(*(const ushort *)src); src += 2;
+        hdr.crc32 = lilswap(*(const uint *)src); src += 4;
+        hdr.compressedsize = lilswap(*(const uint *)src); src += 4;
+        hdr.uncompressedsize = lilswap(*(const uint *)src); src += 4;
+        hdr.namelength = lilswap(*(const ushort *)src); src += 2;
+        hdr.extralength = lilswap(*(const ushort *)src); src += 2;
+        hdr.commentlength = lilswap(*(const ushort *)src); src += 2;
+        hdr.disknumber = lilswap(*(const ushort *)src); src += 2;
+        hdr.internalattribs = lilswap(*(const ushort *)src); src += 2;
+        hdr.externalattribs = lilswap(*(const uint *)src); src += 4;
+        hdr.offset = lilswap(*(const uint *)src); src += 4;
         if(hdr.signature != ZIP_FILE_SIGNATURE) break;
         if(!hdr.namelength || !hdr.uncompressedsize || (hdr.compression && (hdr.compression != Z_DEFLATED || !hdr.compressedsize)))
         {
@@ -161,49 +221,87 @@ static bool readzipdirectory(const char *archname, FILE *f, int entries, int off
 
         src += hdr.namelength + hdr.extralength + hdr.commentlength;
     }
-    delete[] buf;
 
     return files.length() > 0;
 }
 
-static bool readlocalfileheader(FILE *f, ziplocalfileheader &h, uint offset)
+static bool readlocalfileheader(ziparchive &arch, ziplocalfileheader &h, uint offset)
 {
-    fseek(f, offset, SEEK_SET);
-    uchar buf[ZIP_LOCAL_FILE_SIZE];
-    if(fread(buf, 1, ZIP_LOCAL_FILE_SIZE, f) != ZIP_LOCAL_FILE_SIZE)
-        return false;
-    uchar *src = buf;
-    h.signature = lilswap(*(uint *)src); src += 4;
-    h.version = lilswap(*(ushort *)src); src += 2;
-    h.flags = lilswap(*(ushort *)src); src += 2;
-    h.compression = lilswap(*(ushort *)src); src += 2;
-    h.modtime = lilswap(*(ushort *)src); src += 2;
-    h.moddate = lilswap(*(ushort *)src); src += 2;
-    h.crc32 = lilswap(*(uint *)src); src += 4;
-    h.compressedsize = lilswap(*(uint *)src); src += 4;
-    h.uncompressedsize = lilswap(*(uint *)src); src += 4;
-    h.namelength = lilswap(*(ushort *)src); src += 2;
-    h.extralength = lilswap(*(ushort *)src); src += 2;
+    if(offset > arch.datasize || arch.datasize - offset < ZIP_LOCAL_FILE_SIZE) return false;
+    const uchar *src = &arch.data[offset];
+    h.signature = lilswap(*(const uint *)src); src += 4;
+    h.version = lilswap(*(const ushort *)src); src += 2;
+    h.flags = lilswap(*(const ushort *)src); src += 2;
+    h.compression = lilswap(*(const ushort *)src); src += 2;
+    h.modtime = lilswap(*(const ushort *)src); src += 2;
+    h.moddate = lilswap(*(const ushort *)src); src += 2;
+    h.crc32 = lilswap(*(const uint *)src); src += 4;
+    h.compressedsize = lilswap(*(const uint *)src); src += 4;
+    h.uncompressedsize = lilswap(*(const uint *)src); src += 4;
+    h.namelength = lilswap(*(const ushort *)src); src += 2;
+    h.extralength = lilswap(*(const ushort *)src); src += 2;
     if(h.signature != ZIP_LOCAL_FILE_SIGNATURE) return false;
     // h.uncompressedsize or h.compressedsize may be zero - so don't validate
     return true;
 }
 
 static vector<ziparchive *> archives;
+static hashtable<const char *, ziparchive *> archivenames(1<<5);
+static hashtable<const char *, zipfile *> zipindex(1<<12);
 
 ziparchive *findzip(const char *name)
 {
-    loopv(archives) if(!strcmp(name, archives[i]->name)) return archives[i];
-    return NULL;
+    ziparchive **arch = archivenames.access(name);
+    return arch ? *arch : NULL;
 }
 
-static bool checkprefix(vector<zipfile> &files, const char *prefix, int prefixlen)
+/* maps every mounted path to the entry of the most recently added archive providing it */
+static void indexzip(ziparchive &arch)
+{
+    enumerate(arch.files, zipfile, f, zipindex[f.name] = &f);
+}
+
+static void reindexzips()
+{
+    zipindex.clear();
+    loopv(archives) indexzip(*archives[i]);
+}
+
+struct zipprefix
+{
+    const char *name;
+    int len;
+};
+
+static inline uint hthash(const zipprefix &p)
+{
+    uint h = 5381;
+    loopi(p.len) h = ((h<<5)+h)^p.name[i];
+    return h;
+}
+
+static inline bool htcmp(const zipprefix &x, const zipprefix &y)
+{
+    return x.len == y.len && !memcmp(x.name, y.name, x.len);
+}
+
+static void indexprefixes(vector<zipfile> &files, hashset<zipprefix> &prefixes)
 {
     loopv(files)
     {
-        if(!strncmp(files[i].name, prefix, prefixlen)) return false;
+        const char *name = files[i].name;
+        for(const char *dir = strchr(name, PATHDIV); dir; dir = strchr(dir+1, PATHDIV))
+        {
+            zipprefix p = { name, int(dir + 1 - name) };
+            prefixes.access(p, p);
+        }
     }
-    return true;
+}
+
+static bool checkprefix(hashset<zipprefix> &prefixes, const char *prefix, int prefixlen)
+{
+    zipprefix p = { prefix, prefixlen };
+    return !prefixes.access(p);
 }
 
 static void mountzip(ziparchive &arch, vector<zipfile> &files, const char *mountdir, const char *stripdir)
@@ -211,6 +309,7 @@ static void mountzip(ziparchive &arch, vector<zipfile> &files, const char *mount
     string packagesdir = "packages/";
     path(packagesdir);
     int striplen = stripdir ? (int)strlen(stripdir) : 0;
+    hashset<zipprefix> prefixes(1<<8);
     if(!mountdir && !stripdir) loopv(files)
     {
         zipfile &f = files[i];
@@ -229,7 +328,8 @@ static void mountzip(ziparchive &arch, vector<zipfile> &files, const char *mount
         {
             const char *ogzdir = foundogz;
             while(--ogzdir >= f.name && *ogzdir != PATHDIV);
-            if(ogzdir < f.name || checkprefix(files, f.name, ogzdir + 1 - f.name))
+            if(ogzdir >= f.name && !prefixes.numelems) indexprefixes(files, prefixes);
+            if(ogzdir < f.name || checkprefix(prefixes, f.name, ogzdir + 1 - f.name))
             {
                 if(ogzdir >= f.name)
                 {
@@ -256,6 +356,7 @@ static void mountzip(ziparchive &arch, vector<zipfile> &files, const char *mount
         zipfile &mf = arch.files[mname];
         mf = f;
         mf.name = mname;
+        mf.arch = &arch;
     }
 }
 
@@ -274,26 +375,27 @@ bool addzip(const char *name, const char *mount = NULL, const char *strip = NULL
         return true;
     }
  
-    FILE *f = fopen(findfile(pname, "rb"), "rb");
-    if(!f) 
+    ziparchive *arch = new ziparchive;
+    if(!arch->map(findfile(pname, "rb")))
     {
         conoutf(CON_ERROR, "could not open file %s", pname);
+        delete arch;
         return false;
     }
     zipdirectoryheader h;
     vector<zipfile> files;
-    if(!findzipdirectory(f, h) || !readzipdirectory(pname, f, h.entries, h.offset, h.size, files))
+    if(!findzipdirectory(*arch, h) || !readzipdirectory(pname, *arch, h.entries, h.offset, h.size, files))
     {
         conoutf(CON_ERROR, "could not read directory in zip %s", pname);
-        fclose(f);
+        delete arch;
         return false;
     }
     
-    ziparchive *arch = new ziparchive;
     arch->name = newstring(pname);
-    arch->data = f;
     mountzip(*arch, files, mount, strip);
     archives.add(arch);
+    archivenames[arch->name] = arch;
+    indexzip(*arch);
 
     conoutf("added zip %s", pname);
     return true;
@@ -319,25 +421,21 @@ bool removezip(const char *name)
     }
     conoutf("removed zip %s", exists->name);
     archives.removeobj(exists); 
+    archivenames.remove(exists->name);
+    reindexzips();
     delete exists;
     return true;
 }
 
 struct zipstream : stream
 {
-    enum
-    {
-        BUFSIZE  = 16384
-    };
-
     ziparchive *arch;
     zipfile *info;
     z_stream zfile;
-    uchar *buf;
     int reading;
     bool ended;
 
-    zipstream() : arch(NULL), info(NULL), buf(NULL), reading(-1), ended(false)
+    zipstream() : arch(NULL), info(NULL), reading(-1), ended(false)
     {
         zfile.zalloc = NULL;
         zfile.zfree = NULL;
@@ -351,20 +449,10 @@ struct zipstream : stream
         close();
     }
 
-    void readbuf(uint size = BUFSIZE)
+    void rewind()
     {
-        if(!zfile.avail_in) zfile.next_in = (Bytef *)buf;
-        size = min(size, uint(&buf[BUFSIZE] - &zfile.next_in[zfile.avail_in]));
-        if(arch->owner != this)
-        {
-            arch->owner = NULL;
-            if(fseek(arch->data, reading, SEEK_SET) >= 0) arch->owner = this;
-            else return;
-        }
-        uint remaining = info->offset + info->compressedsize - reading;
-        int n = arch->owner == this ? (int)fread(zfile.next_in + zfile.avail_in, 1, min(size, remaining), arch->data) : 0;
-        zfile.avail_in += n;
-        reading += n;
+        zfile.next_in = (Bytef *)&arch->data[info->offset];
+        zfile.avail_in = info->compressedsize;
     }
 
     bool open(ziparchive *a, zipfile *f)
@@ -372,10 +460,10 @@ struct zipstream : stream
         if(f->offset == ~0U)
         {
             ziplocalfileheader h;
-            a->owner = NULL;
-            if(!readlocalfileheader(a->data, h, f->header)) return false;
+            if(!readlocalfileheader(*a, h, f->header)) return false;
             f->offset = f->header + ZIP_LOCAL_FILE_SIZE + h.namelength + h.extralength;
         }
+        if(f->offset > a->datasize || a->datasize - f->offset < (f->compressedsize ? f->compressedsize : f->size)) return false;
 
         if(f->compressedsize && inflateInit2(&zfile, -MAX_WBITS) != Z_OK) return false;
 
@@ -384,7 +472,7 @@ struct zipstream : stream
         info = f;
         reading = f->offset;
         ended = false;
-        if(f->compressedsize) buf = new uchar[BUFSIZE];
+        if(f->compressedsize) rewind();
         return true;
     }
 
@@ -401,14 +489,15 @@ struct zipstream : stream
     void close()
     {
         stopreading();
-        DELETEA(buf);
-        if(arch) { arch->owner = NULL; arch->openfiles--; arch = NULL; }
+        if(arch) { arch->openfiles--; arch = NULL; }
     }
 
     long size() { return info->size; }
     bool end() { return reading < 0 || ended; }
     long tell() { return reading >= 0 ? (info->compressedsize ? zfile.total_out : reading - info->offset) : -1; }
 
+    const uchar *mapped() { return reading >= 0 && !info->compressedsize ? &arch->data[info->offset] : NULL; }
+
     bool seek(long pos, int whence)
     {
         if(reading < 0) return false;
@@ -422,9 +511,6 @@ struct zipstream : stream
                 default: return false;
             } 
             pos = clamp(pos, long(info->offset), long(info->offset + info->size));
-            arch->owner = NULL;
-            if(fseek(arch->data, pos, SEEK_SET) < 0) return false;
-            arch->owner = this;
             reading = pos;
             ended = false;
             return true;
@@ -440,11 +526,9 @@ struct zipstream : stream
 
         if(pos >= (long)info->size)
         {
-            reading = info->offset + info->compressedsize;
             zfile.next_in += zfile.avail_in;
             zfile.avail_in = 0;
             zfile.total_in = info->compressedsize; 
-            arch->owner = NULL;
             ended = false;
             return true;
         }
@@ -453,19 +537,8 @@ struct zipstream : stream
         if(pos >= (long)zfile.total_out) pos -= zfile.total_out;
         else 
         {
-            if(zfile.next_in && zfile.total_in <= uint(zfile.next_in - buf))
-            {
-                zfile.avail_in += zfile.total_in;
-                zfile.next_in -= zfile.total_in;
-            }
-            else
-            {
-                arch->owner = NULL;
-                zfile.avail_in = 0;
-                zfile.next_in = NULL;
-                reading = info->offset;
-            }
             inflateReset(&zfile);
+            rewind();
         }
 
         uchar skip[512];
@@ -485,14 +558,8 @@ struct zipstream : stream
         if(reading < 0 || !buf || !len) return 0;
         if(!info->compressedsize)
         {
-            if(arch->owner != this)
-            {
-                arch->owner = NULL;
-                if(fseek(arch->data, reading, SEEK_SET) < 0) { stopreading(); return 0; }
-                arch->owner = this;
-            }
-              
-            int n = (int)fread(buf, 1, min(len, int(info->size + info->offset - reading)), arch->data);
+            int n = min(len, int(info->size + info->offset - reading));
+            memcpy(buf, &arch->data[reading], n);
             reading += n;
             if(n < len) ended = true;
             return n;
@@ -502,7 +569,6 @@ struct zipstream : stream
         zfile.avail_out = len;
         while(zfile.avail_out > 0)
         {
-            if(!zfile.avail_in) readbuf(BUFSIZE);
             int err = inflate(&zfile, Z_NO_FLUSH);
             if(err != Z_OK) 
             {
@@ -524,15 +590,19 @@ struct zipstream : stream
 stream *openzipfile(const char *name, const char *mode)
 {
     for(; *mode; mode++) if(*mode=='w' || *mode=='a') return NULL;
+    zipfile **f = zipindex.access(name);
+    if(!f) return NULL;
+    zipstream *s = new zipstream;
+    if(s->open((*f)->arch, *f)) return s;
+    // fall back to the same path in archives mounted before the one the index points at
     loopvrev(archives)
     {
         ziparchive *arch = archives[i];
-        zipfile *f = arch->files.access(name);
-        if(!f) continue;
-        zipstream *s = new zipstream;
-        if(s->open(arch, f)) return s;
-        delete s;
+        if(arch == (*f)->arch) continue;
+        zipfile *older = arch->files.access(name);
+        if(older && s->open(arch, older)) return s;
     }
+    delete s;
     return NULL;
 }
 